@@ -0,0 +1,114 @@
+/*
+ * Compares the payload codecs of datum_codec.hpp on pairs of images like the
+ * ones of the KITTI databases (two 227x227x3 crops): bytes per record and
+ * encoding and decoding time per record.
+ *
+ * By default the pairs are synthetic (gradients plus noise), which is enough
+ * to compare the speed of the codecs. The sizes only mean something on real
+ * data: pass some images (e.g. KITTI frames) and every two consecutive
+ * images make a pair.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+#include "datum_codec.hpp"
+#include "lmdb_creator.hpp"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define SIZE 227
+#define NUM_PAIRS 200
+
+using namespace std;
+using namespace cv;
+
+typedef struct {
+  Mat img1;
+  Mat img2;
+} ImagePair;
+
+Mat synthetic_image(unsigned int seed) {
+  Mat img(SIZE, SIZE, CV_8UC3);
+  unsigned int state = seed * 2654435761U + 1;
+  for (int r = 0; r < SIZE; ++r) {
+    uchar *row = img.ptr<uchar>(r);
+    for (int c = 0; c < SIZE; ++c) {
+      for (int ch = 0; ch < 3; ++ch) {
+        state = state * 1103515245 + 12345;
+        int noise = (state >> 16) % 16;
+        row[c * 3 + ch] = (r + 2 * c + 40 * ch + seed * 7 + noise) % 256;
+      }
+    }
+  }
+  return img;
+}
+
+vector<ImagePair> make_pairs(int argc, char **argv) {
+  vector<ImagePair> pairs;
+  if (argc < 3) {
+    for (unsigned int i = 0; i < NUM_PAIRS; ++i) {
+      ImagePair pair = {synthetic_image(2 * i), synthetic_image(2 * i + 1)};
+      pairs.push_back(pair);
+    }
+    return pairs;
+  }
+  for (int i = 1; i + 1 < argc; i += 2) {
+    Mat img1 = imread(argv[i], CV_LOAD_IMAGE_COLOR);
+    Mat img2 = imread(argv[i + 1], CV_LOAD_IMAGE_COLOR);
+    if (img1.empty() || img2.empty() || img1.rows < SIZE || img1.cols < SIZE || img2.rows < SIZE ||
+        img2.cols < SIZE) {
+      cout << "Skipping " << argv[i] << " and " << argv[i + 1] << endl;
+      continue;
+    }
+    Rect crop(0, 0, SIZE, SIZE);
+    ImagePair pair = {img1(crop), img2(crop)};
+    pairs.push_back(pair);
+  }
+  return pairs;
+}
+
+int main(int argc, char **argv) {
+  vector<ImagePair> pairs = make_pairs(argc, argv);
+  if (pairs.empty()) {
+    cout << "No pairs to test\n\n" << argv[0] << " [image1 image2 [image1 image2 ...]]\n\n";
+    return 1;
+  }
+  const char *codecs[] = {"raw", "lz4", "png", "jpeg:95", "jpeg:75"};
+  cout << pairs.size() << " pairs of " << SIZE << "x" << SIZE << "x3 images\n\n";
+  cout << left << setw(10) << "codec" << right << setw(14) << "bytes/record" << setw(8) << "ratio" << setw(14)
+       << "encode (us)" << setw(14) << "decode (us)" << endl;
+
+  size_t raw_bytes = 0;
+  vector<char> chw(6 * SIZE * SIZE);
+  for (const char *name : codecs) {
+    DatumCodec codec = parse_codec(name);
+    vector<string> records(pairs.size());
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < pairs.size(); ++i) {
+      records[i] = encode_datum(pairs[i].img1, pairs[i].img2, 0, vector<float>(), codec);
+    }
+    chrono::duration<double, micro> encode_time = chrono::steady_clock::now() - start;
+
+    size_t bytes = 0;
+    Datum datum;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < records.size(); ++i) {
+      bytes += records[i].size();
+      datum.ParseFromString(records[i]);
+      decode_datum_data(datum.data().data(), datum.data().size(), datum.encoded(), datum.channels(),
+                        datum.height(), datum.width(), &chw[0]);
+    }
+    chrono::duration<double, micro> decode_time = chrono::steady_clock::now() - start;
+
+    if (codec.type == CODEC_RAW) {
+      raw_bytes = bytes;
+    }
+    cout << left << setw(10) << name << right << setw(14) << bytes / records.size() << setw(8) << fixed
+         << setprecision(2) << (double)raw_bytes / bytes << setw(14) << setprecision(1)
+         << encode_time.count() / records.size() << setw(14) << decode_time.count() / records.size() << endl;
+  }
+  return 0;
+}
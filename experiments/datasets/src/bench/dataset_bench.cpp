@@ -0,0 +1,564 @@
+/*
+ * Benchmarks of the dataset tools, on synthetic data: no download and no GPU
+ * needed. It times the building blocks of the tools (Datum conversion,
+ * insert2db with several commit intervals, the MNIST warps, load_images and
+ * load_labels, the KITTI crops and egomotion labels) and the MNIST and KITTI
+ * pipelines end to end: preprocess_mnist_siamese and preprocess_kitti_siamese
+ * themselves (from --tools-dir), run on synthetic inputs written to --dir.
+ *
+ * Every case runs --repeat times and the fastest run is reported, one line
+ * per case (tab separated, or JSON lines with --json), so the output of two
+ * revisions can be diffed or loaded in a spreadsheet:
+ *
+ *   benchmark  case  items  seconds  items_per_sec  ns_per_item
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+#include "batch_reader.hpp"
+#include "cli_options.hpp"
+#include "counter_rng.hpp"
+#include "egomotion_labels.hpp"
+#include "image_transforms.hpp"
+#include "lmdb_creator.hpp"
+#include "mnist_transforms.hpp"
+#include "mnist_utils.hpp"
+#include "remap_warp.hpp"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+#define MNIST_SIZE 28
+#define MNIST_IMAGES 60000
+#define MNIST_PAIRS_PER_IMAGE 83 // 5M pairs out of 60K digits, like preprocess_mnist_siamese
+#define KITTI_SIZE 227
+#define KITTI_WIDTH 1241
+#define KITTI_HEIGHT 376
+#define KITTI_FRAMES 64
+#define KITTI_NEIGHBOURS 7
+#define KITTI_SEQUENCES 11 // 00 to 10, the train and val splits of preprocess_kitti_siamese
+#define SEED 0
+
+// Results that are computed only to be timed end up here, so they are not optimized away
+volatile unsigned long sink;
+
+typedef struct {
+  string benchmark;
+  string params;
+  unsigned long items;
+  double seconds; // fastest run
+} BenchResult;
+
+class BenchRunner {
+public:
+  BenchRunner(const CliOptions &opts)
+      : filter(opts.get("filter", "")), repeat(max(opts.get_int("repeat", 3), 1L)), json(opts.has("json")) {}
+
+  bool enabled(const string &benchmark) const { return filter.empty() || benchmark.find(filter) != string::npos; }
+
+  /* setup(run) is not timed, body(run) is. items is what body processes in one run */
+  void run(const string &benchmark, const string &params, unsigned long items, function<void(unsigned int)> setup,
+           function<void(unsigned int)> body) {
+    if (!enabled(benchmark)) {
+      return;
+    }
+    BenchResult result = {benchmark, params, items, 0};
+    for (unsigned int r = 0; r < repeat; ++r) {
+      if (setup) {
+        setup(r);
+      }
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      body(r);
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      if (r == 0 || elapsed.count() < result.seconds) {
+        result.seconds = elapsed.count();
+      }
+    }
+    print(result);
+  }
+
+  void print_header() const {
+    if (!json) {
+      printf("benchmark\tcase\titems\tseconds\titems_per_sec\tns_per_item\n");
+    }
+  }
+
+private:
+  string filter;
+  unsigned int repeat;
+  bool json;
+
+  void print(const BenchResult &r) const {
+    double rate = r.items / r.seconds;
+    double ns = 1e9 * r.seconds / r.items;
+    if (json) {
+      printf("{\"benchmark\": \"%s\", \"case\": \"%s\", \"items\": %lu, \"seconds\": %.6f, \"items_per_sec\": %.1f, "
+             "\"ns_per_item\": %.1f}\n",
+             r.benchmark.c_str(), r.params.c_str(), r.items, r.seconds, rate, ns);
+    } else {
+      printf("%s\t%s\t%lu\t%.6f\t%.1f\t%.1f\n", r.benchmark.c_str(), r.params.c_str(), r.items, r.seconds, rate, ns);
+    }
+    fflush(stdout);
+  }
+};
+
+/************************** Synthetic data **************************/
+
+/* Blobs and gradients plus noise: compresses and warps like real images */
+Mat synthetic_image(int rows, int cols, int channels, uint64_t seed) {
+  Mat img(rows, cols, CV_8UC(channels));
+  CounterRNG rng(SEED, seed);
+  int cx = rng.generate_rand(cols), cy = rng.generate_rand(rows);
+  for (int r = 0; r < rows; ++r) {
+    uchar *row = img.ptr<uchar>(r);
+    for (int c = 0; c < cols; ++c) {
+      int blob = ((r - cy) * (r - cy) + (c - cx) * (c - cx)) < rows * cols / 16 ? 120 : 0;
+      for (int ch = 0; ch < channels; ++ch) {
+        row[c * channels + ch] = (r + 2 * c + 40 * ch + blob + (rng.next() & 15)) & 255;
+      }
+    }
+  }
+  return img;
+}
+
+void write_idx_images(const string &path, unsigned int num_images) {
+  ofstream out(path.c_str(), ios::binary);
+  uint32_t header[4] = {htonl(0x00000803), htonl(num_images), htonl(MNIST_SIZE), htonl(MNIST_SIZE)};
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  for (unsigned int i = 0; i < num_images; ++i) {
+    Mat img = synthetic_image(MNIST_SIZE, MNIST_SIZE, 1, i);
+    out.write(reinterpret_cast<const char *>(img.data), img.total());
+  }
+}
+
+void write_idx_labels(const string &path, unsigned int num_labels) {
+  ofstream out(path.c_str(), ios::binary);
+  uint32_t header[2] = {htonl(0x00000801), htonl(num_labels)};
+  out.write(reinterpret_cast<const char *>(header), sizeof(header));
+  for (unsigned int i = 0; i < num_labels; ++i) {
+    out.put(i % 10);
+  }
+}
+
+/* A camera moving forward and turning a little, like the KITTI sequences */
+void synthetic_pose(unsigned int frame, float *pose) {
+  float yaw = 0.01f * frame;
+  float m[POSE_SIZE] = {cosf(yaw), 0, sinf(yaw), 0.1f * frame, 0, 1, 0, 0.01f * (frame % 5),
+                        -sinf(yaw), 0, cosf(yaw), 0.8f * frame};
+  memcpy(pose, m, sizeof(m));
+}
+
+/* Removes a LMDB made by LMDataBase (a directory with data.mdb and lock.mdb) */
+void remove_lmdb(const string &path) {
+  unlink((path + "/data.mdb").c_str());
+  unlink((path + "/lock.mdb").c_str());
+  rmdir(path.c_str());
+}
+
+LMDataBaseOptions quiet_options(bool async, unsigned int commit_interval) {
+  LMDataBaseOptions options;
+  options.async = async;
+  options.commit_interval = commit_interval;
+  options.verbose = false;
+  return options;
+}
+
+/* Removes a directory with everything in it */
+void remove_tree(const string &path) {
+  string command = "rm -rf '" + path + "'";
+  if (system(command.c_str()) != 0) {
+    cerr << "Could not remove " << path << endl;
+  }
+}
+
+/************************** Tools **************************/
+
+/* Where dataset_bench is, the tools are built in the same directory */
+string default_tools_dir() {
+  char path[4096];
+  ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  if (len <= 0) {
+    return ".";
+  }
+  path[len] = '\0';
+  string exe(path);
+  return exe.substr(0, exe.find_last_of('/'));
+}
+
+bool tool_exists(const string &tool) {
+  if (access(tool.c_str(), X_OK) != 0) {
+    cerr << "Skipping the benchmark of " << tool << ": not found, build the tools or use --tools-dir" << endl;
+    return false;
+  }
+  return true;
+}
+
+/* Runs a tool without its output, throws if it fails */
+void run_tool(const string &tool, const vector<string> &args) {
+  string command = "'" + tool + "'";
+  for (size_t i = 0; i < args.size(); ++i) {
+    command += " '" + args[i] + "'";
+  }
+  if (system((command + " > /dev/null").c_str()) != 0) {
+    throw runtime_error("Failed: " + command);
+  }
+}
+
+/************************** Benchmarks **************************/
+
+void bench_datum(BenchRunner &bench, double scale) {
+  const int shapes[2][2] = {{MNIST_SIZE, 1}, {KITTI_SIZE, 3}};
+  for (int s = 0; s < 2; ++s) {
+    int size = shapes[s][0], channels = shapes[s][1];
+    string params = to_string(size) + "x" + to_string(size) + "x" + to_string(channels);
+    unsigned long n = max((unsigned long)(scale * (s == 0 ? 200000 : 2000)), 1UL);
+    Mat img1 = synthetic_image(size, size, channels, 1);
+    Mat img2 = synthetic_image(size, size, channels, 2);
+    Datum datum;
+    bench.run("mat2datum", params, n, NULL, [&](unsigned int) {
+      for (unsigned long i = 0; i < n; ++i) {
+        Mat2Datum(img1, &datum);
+      }
+    });
+    bench.run("mats2datum", params, n, NULL, [&](unsigned int) {
+      for (unsigned long i = 0; i < n; ++i) {
+        Mats2Datum(img1, img2, &datum);
+      }
+    });
+  }
+}
+
+void bench_insert2db(BenchRunner &bench, double scale, const string &dir) {
+  Mat img1 = synthetic_image(MNIST_SIZE, MNIST_SIZE, 1, 1);
+  Mat img2 = synthetic_image(MNIST_SIZE, MNIST_SIZE, 1, 2);
+  string path = dir + "/bench_insert2db_lmdb";
+  const unsigned int intervals[] = {1, 10, 100, 1000, 10000};
+  for (unsigned int interval : intervals) {
+    // A commit is a sync to disk: fewer records with the small intervals
+    unsigned long n = max((unsigned long)(scale * (interval < 100 ? 2000 : 50000)), 1UL);
+    for (int async = 0; async < 2; ++async) {
+      string params = "commit=" + to_string(interval) + (async ? ",async" : "");
+      bench.run("insert2db", params, n, [&](unsigned int) { remove_lmdb(path); }, [&](unsigned int) {
+        LMDataBase lmdb(path, 2, MNIST_SIZE, quiet_options(async, interval));
+        for (unsigned long i = 0; i < n; ++i) {
+          lmdb.insert2db(img1, img2, i & 1);
+        }
+      });
+    }
+  }
+  remove_lmdb(path);
+}
+
+void bench_transforms(BenchRunner &bench, double scale) {
+  TransformGrid grid = make_transform_grid();
+  CounterRNG rng(SEED, 0);
+  vector<MnistTransform> transforms(MNIST_PAIRS_PER_IMAGE);
+  for (size_t i = 0; i < transforms.size(); ++i) {
+    transforms[i] = draw_mnist_transform(rng, grid);
+  }
+  const int shapes[2][2] = {{MNIST_SIZE, 1}, {KITTI_SIZE, 3}};
+  for (int s = 0; s < 2; ++s) {
+    int size = shapes[s][0], channels = shapes[s][1];
+    unsigned long n = max((unsigned long)(scale * (s == 0 ? 200000 : 1000)), 1UL);
+    Mat img = synthetic_image(size, size, channels, 3);
+    bench.run("transform_image", to_string(size) + "x" + to_string(size) + "x" + to_string(channels), n, NULL,
+              [&](unsigned int) {
+                for (unsigned long i = 0; i < n; ++i) {
+                  const MnistTransform &t = transforms[i % transforms.size()];
+                  sink += transform_image(img, t.tx, t.ty, t.rot).data[0];
+                }
+              });
+  }
+
+  // What preprocess_mnist_siamese does: all the pairs of a digit through the precomputed tables
+  if (!bench.enabled("mnist_warp_tables")) {
+    return;
+  }
+  MnistWarpTables *tables = NULL;
+  bench.run("mnist_warp_tables", "build", NUM_TRASLATIONS * NUM_TRASLATIONS * NUM_ROTATIONS, NULL,
+            [&](unsigned int) {
+              delete tables;
+              tables = new MnistWarpTables(grid, MNIST_SIZE, MNIST_SIZE);
+            });
+  unsigned long n = max((unsigned long)(scale * 2000), 1UL);
+  Mat img = synthetic_image(MNIST_SIZE, MNIST_SIZE, 1, 3);
+  vector<Mat> out(transforms.size());
+  bench.run("mnist_warp_tables", string("warp,") + remap_warp_isa(), n * transforms.size(), NULL,
+            [&](unsigned int) {
+              for (unsigned long i = 0; i < n; ++i) {
+                tables->warp(img, &transforms[0], transforms.size(), &out[0]);
+              }
+            });
+  delete tables;
+}
+
+void bench_mnist_loading(BenchRunner &bench, double scale, const string &dir, unsigned int repeat) {
+  if (!bench.enabled("load_")) {
+    return;
+  }
+  unsigned int n = max((unsigned int)(scale * MNIST_IMAGES), 1u);
+  // The files stay mapped once loaded: a new file for every run
+  vector<string> paths;
+  for (unsigned int r = 0; r < repeat; ++r) {
+    paths.push_back(dir + "/bench-images-idx3-ubyte." + to_string(r));
+  }
+  string labels_path = dir + "/bench-labels-idx1-ubyte";
+  for (unsigned int r = 0; r < repeat; ++r) {
+    write_idx_images(paths[r], n);
+  }
+  // load_images() and load_labels() print the headers of the files, keep them out of the results
+  ostringstream muted;
+  streambuf *stdout_buffer = cout.rdbuf(muted.rdbuf());
+  bench.run("load_images", to_string(n) + "x28x28", n, NULL, [&](unsigned int r) {
+    vector<Mat> imgs = load_images(paths[r]);
+    // Read a pixel of every image, the mapping is lazy
+    for (size_t i = 0; i < imgs.size(); ++i) {
+      sink += imgs[i].at<uchar>(MNIST_SIZE / 2, MNIST_SIZE / 2);
+    }
+  });
+  write_idx_labels(labels_path, n);
+  bench.run("load_labels", to_string(n), n, NULL, [&](unsigned int) { sink += load_labels(labels_path).size(); });
+  cout.rdbuf(stdout_buffer);
+  for (unsigned int r = 0; r < repeat; ++r) {
+    unlink(paths[r].c_str());
+  }
+  unlink(labels_path.c_str());
+}
+
+void bench_kitti_parts(BenchRunner &bench, double scale) {
+  Mat frame1 = synthetic_image(KITTI_HEIGHT, KITTI_WIDTH, 3, 4);
+  Mat frame2 = synthetic_image(KITTI_HEIGHT, KITTI_WIDTH, 3, 5);
+  unsigned long n = max((unsigned long)(scale * 5000), 1UL);
+  // Random crop of both frames and the CHW conversion of the writer
+  vector<char> chw(6 * KITTI_SIZE * KITTI_SIZE);
+  bench.run("kitti_crop", "227x227x3", n, NULL, [&](unsigned int) {
+    CounterRNG rng(SEED, 1);
+    for (unsigned long i = 0; i < n; ++i) {
+      Rect r(rng.generate_rand(KITTI_WIDTH - KITTI_SIZE), rng.generate_rand(KITTI_HEIGHT - KITTI_SIZE), KITTI_SIZE,
+             KITTI_SIZE);
+      Mats2CHW(frame1(r), frame2(r), &chw[0]);
+    }
+  });
+
+  unsigned long num_pairs = max((unsigned long)(scale * 1000000), 1UL);
+  PosePairs poses;
+  poses.reserve(num_pairs);
+  float pose1[POSE_SIZE], pose2[POSE_SIZE];
+  CounterRNG rng(SEED, 2);
+  for (unsigned long i = 0; i < num_pairs; ++i) {
+    unsigned int frame = rng.generate_rand(4000);
+    synthetic_pose(frame, pose1);
+    synthetic_pose(frame + 1 + rng.generate_rand(KITTI_NEIGHBOURS), pose2);
+    poses.push_back(pose1, pose2);
+  }
+  for (int six_dof = 0; six_dof < 2; ++six_dof) {
+    bench.run("kitti_labels", six_dof ? "6dof" : "3dof", num_pairs, NULL, [&](unsigned int) {
+      EgomotionLabels labels;
+      compute_egomotion_labels(poses, six_dof, &labels);
+    });
+  }
+}
+
+/*
+ * preprocess_mnist_siamese itself, run on a synthetic IDX file with
+ * MNIST_PAIRS_PER_IMAGE pairs per digit. Process start and the loading of the
+ * digits are timed too, as in a real build.
+ */
+void bench_mnist_pipeline(BenchRunner &bench, double scale, const string &dir, const string &tools_dir,
+                          unsigned int num_threads) {
+  string tool = tools_dir + "/preprocess_mnist_siamese";
+  if (!bench.enabled("mnist_pipeline") || !tool_exists(tool)) {
+    return;
+  }
+  unsigned int num_imgs = max((unsigned int)(scale * 6000), 1u);
+  unsigned long num_pairs = (unsigned long)num_imgs * MNIST_PAIRS_PER_IMAGE;
+  string idx_path = dir + "/bench-mnist-idx3-ubyte";
+  string out_dir = dir + "/bench_mnist_out";
+  write_idx_images(idx_path, num_imgs);
+  vector<string> args = {idx_path, out_dir, "--threads=" + to_string(num_threads), "--pairs=" + to_string(num_pairs),
+                         "--metrics=/dev/null"};
+  bench.run("mnist_pipeline", "threads=" + to_string(num_threads), num_pairs,
+            [&](unsigned int) {
+              remove_tree(out_dir);
+              mkdir(out_dir.c_str(), 0744);
+            },
+            [&](unsigned int) { run_tool(tool, args); });
+  remove_tree(out_dir);
+  unlink(idx_path.c_str());
+}
+
+/*
+ * preprocess_kitti_siamese itself (egomotion), run on a synthetic dataset:
+ * KITTI_FRAMES PNG frames shared by the 11 sequences, their poses and paths
+ * files. Every run starts from an empty output directory, so the indices of
+ * the sequences are built and every frame is decoded at least once.
+ */
+void bench_kitti_pipeline(BenchRunner &bench, double scale, const string &dir, const string &tools_dir,
+                          unsigned int num_threads) {
+  string tool = tools_dir + "/preprocess_kitti_siamese";
+  if (!bench.enabled("kitti_pipeline") || !tool_exists(tool)) {
+    return;
+  }
+  string root = dir + "/bench_kitti";
+  string paths_dir = root + "/paths";
+  string out_dir = dir + "/bench_kitti_out";
+  mkdir(root.c_str(), 0744);
+  mkdir((root + "/sequences").c_str(), 0744);
+  mkdir((root + "/sequences/frames").c_str(), 0744);
+  mkdir((root + "/poses").c_str(), 0744);
+  mkdir(paths_dir.c_str(), 0744);
+  for (unsigned int f = 0; f < KITTI_FRAMES; ++f) {
+    char name[32];
+    snprintf(name, sizeof(name), "frames/%06u.png", f);
+    imwrite(root + "/sequences/" + name, synthetic_image(KITTI_HEIGHT, KITTI_WIDTH, 3, 100 + f));
+  }
+  for (unsigned int seq = 0; seq < KITTI_SEQUENCES; ++seq) {
+    char name[16];
+    snprintf(name, sizeof(name), "/%02u.txt", seq);
+    ofstream paths((paths_dir + name).c_str());
+    ofstream poses((root + "/poses" + name).c_str());
+    for (unsigned int f = 0; f < KITTI_FRAMES; ++f) {
+      char path[32];
+      snprintf(path, sizeof(path), "frames/%06u.png", f);
+      paths << path << "\n";
+      float pose[POSE_SIZE];
+      synthetic_pose(f, pose);
+      for (unsigned int k = 0; k < POSE_SIZE; ++k) {
+        poses << pose[k] << (k + 1 < POSE_SIZE ? " " : "\n");
+      }
+    }
+  }
+  unsigned long pairs_per_split = max((unsigned long)(scale * 200), 1UL);
+  vector<string> args = {root, out_dir, "ego", "--threads=" + to_string(num_threads),
+                         "--paths-dir=" + paths_dir, "--pairs-per-split=" + to_string(pairs_per_split),
+                         "--metrics=/dev/null"};
+  bench.run("kitti_pipeline", "threads=" + to_string(num_threads), KITTI_SEQUENCES * pairs_per_split,
+            [&](unsigned int) {
+              remove_tree(out_dir);
+              mkdir(out_dir.c_str(), 0744);
+            },
+            [&](unsigned int) { run_tool(tool, args); });
+  remove_tree(out_dir);
+  remove_tree(root);
+}
+
+/*
+ * Reading the KITTI-like pairs back in batches of floats: parsing the Datums
+ * in the consumer thread (what a Data layer does) against a BatchReader with
+ * 1 and num_threads workers.
+ */
+void bench_batch_reader(BenchRunner &bench, double scale, const string &dir, unsigned int num_threads) {
+  if (!bench.enabled("batch_reader")) {
+    return;
+  }
+  string data_path = dir + "/bench_reader_lmdb";
+  string labels_path = dir + "/bench_reader_lmdb_labels";
+  const size_t batch_size = 64;
+  unsigned long n = max((unsigned long)(scale * 2000), (unsigned long)batch_size);
+  remove_lmdb(data_path);
+  remove_lmdb(labels_path);
+  {
+    Mat img1 = synthetic_image(KITTI_SIZE, KITTI_SIZE, 3, 1);
+    Mat img2 = synthetic_image(KITTI_SIZE, KITTI_SIZE, 3, 2);
+    LMDataBase data_lmdb(data_path, 6, KITTI_SIZE, quiet_options(true, 1000));
+    LMDataBase labels_lmdb(labels_path, 3, 1, quiet_options(true, 1000));
+    for (unsigned long i = 0; i < n; ++i) {
+      data_lmdb.insert2db(img1, img2, i & 1);
+      labels_lmdb.insert2db(vector<Label>{(Label)(i % 20), (Label)(i % 19), (Label)(i % 18)});
+    }
+  }
+  size_t num_batches = n / batch_size;
+  size_t pixels = 6 * KITTI_SIZE * KITTI_SIZE;
+  bench.run("batch_reader", "consumer_thread", num_batches * batch_size, NULL, [&](unsigned int) {
+    LMDataBaseReader data(data_path);
+    LMDataBaseReader labels(labels_path);
+    MDB_val key, value;
+    Datum datum;
+    vector<float> batch(batch_size * pixels);
+    vector<float> batch_labels(batch_size * 3);
+    for (size_t b = 0; b < num_batches; ++b) {
+      for (size_t i = 0; i < batch_size && data.next(&key, &value); ++i) {
+        datum.ParseFromArray(value.mv_data, value.mv_size);
+        const unsigned char *src = reinterpret_cast<const unsigned char *>(datum.data().data());
+        for (size_t p = 0; p < pixels; ++p) {
+          batch[i * pixels + p] = src[p];
+        }
+        labels.next(&key, &value);
+        datum.ParseFromArray(value.mv_data, value.mv_size);
+        for (size_t l = 0; l < 3; ++l) {
+          batch_labels[i * 3 + l] = static_cast<unsigned char>(datum.data()[l]);
+        }
+      }
+    }
+  });
+  unsigned int threads[] = {1, num_threads};
+  for (unsigned int t = 0; t < (num_threads > 1 ? 2 : 1); ++t) {
+    bench.run("batch_reader", "threads=" + to_string(threads[t]), num_batches * batch_size, NULL, [&](unsigned int) {
+      BatchReaderOptions options;
+      options.batch_size = batch_size;
+      options.num_batches = num_batches;
+      options.num_threads = threads[t];
+      options.split_pairs = true;
+      BatchReader reader(data_path, labels_path, options);
+      DatumBatch batch;
+      while (reader.next(&batch)) {
+      }
+    });
+  }
+  remove_lmdb(data_path);
+  remove_lmdb(labels_path);
+}
+
+int main(int argc, char **argv) {
+  CliOptions opts(argc, argv);
+  if (opts.has("help")) {
+    cout << argv[0] << " [options]\n\n"
+         << "Options:\n"
+         << "  --filter=S    only the benchmarks whose name contains S (e.g. insert2db)\n"
+         << "  --repeat=N    runs of every case, the fastest one is reported (default: 3)\n"
+         << "  --scale=F     multiplies the work of every case (default: 1)\n"
+         << "  --threads=N   threads of the end to end pipelines and the batch reader (default: all cores)\n"
+         << "  --dir=DIR     where the temporary LMDBs and files are written (default: /tmp)\n"
+         << "  --tools-dir=DIR  where preprocess_mnist_siamese and preprocess_kitti_siamese are, the end\n"
+         << "                to end pipelines run them (default: the directory of " << argv[0] << ")\n"
+         << "  --json        one JSON object per line instead of tab separated values\n\n";
+    return 0;
+  }
+  BenchRunner bench(opts);
+  double scale = opts.get_float("scale", 1.0);
+  unsigned int num_threads = max((unsigned int)opts.get_int("threads", thread::hardware_concurrency()), 1u);
+  string dir = opts.get("dir", "/tmp");
+  string tools_dir = opts.get("tools-dir", default_tools_dir());
+
+  bench.print_header();
+  bench_datum(bench, scale);
+  bench_insert2db(bench, scale, dir);
+  bench_transforms(bench, scale);
+  bench_mnist_loading(bench, scale, dir, max(opts.get_int("repeat", 3), 1L));
+  bench_kitti_parts(bench, scale);
+  try {
+    bench_mnist_pipeline(bench, scale, dir, tools_dir, num_threads);
+    bench_kitti_pipeline(bench, scale, dir, tools_dir, num_threads);
+  } catch (const runtime_error &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  bench_batch_reader(bench, scale, dir, num_threads);
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * Measures how fast the pair generator (pairgen/) makes batches of MNIST or
+ * KITTI pairs, to know how many threads a training needs to keep its GPU
+ * busy. It also prints a checksum of every epoch: it must not change with the
+ * number of threads or the target rate.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+#include "cli_options.hpp"
+#include "kitti_sampler.hpp"
+#include "mnist_sampler.hpp"
+#include "mnist_utils.hpp"
+#include "pair_generator.hpp"
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// 9 Sequences for training, like preprocess_kitti_siamese
+const vector<string> TRAIN_SPLITS = {"00", "01", "02", "03", "04", "05", "06", "07", "08"};
+
+uint64_t checksum(const PairBatch &batch, uint64_t h) {
+  for (size_t i = 0; i < batch.data.size(); ++i) {
+    h = (h ^ batch.data[i]) * 1099511628211ULL;
+  }
+  for (size_t i = 0; i < batch.labels.size(); ++i) {
+    h = (h ^ batch.labels[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+int main(int argc, char **argv) {
+  CliOptions opts(argc, argv);
+  if (opts.positional().size() < 2) {
+    cout << argv[0] << " mnist path/to/train-images-idx3-ubyte [options]\n"
+         << argv[0] << " kitti path/to/sequences_and_poses [options]\n\n"
+         << "Options:\n"
+         << "  --threads=N   generator threads (default: all cores)\n"
+         << "  --batch=N     pairs per batch (default: 64)\n"
+         << "  --batches=N   batches per epoch (default: 100)\n"
+         << "  --epochs=N    (default: 2)\n"
+         << "  --rate=R      maximum pairs per second (default: no limit)\n"
+         << "  --seed=S      (default: 0)\n"
+         << "  --index-dir=DIR  binary indices of the KITTI sequences (default: kitti_index)\n";
+    return 1;
+  }
+  string dataset = opts.positional()[0];
+  string path = opts.positional()[1];
+
+  PairGeneratorOptions options;
+  options.num_threads = opts.get_int("threads", thread::hardware_concurrency());
+  options.prefetch = 2 * max(options.num_threads, 1u);
+  options.batch_size = opts.get_int("batch", 64);
+  options.batches_per_epoch = opts.get_int("batches", 100);
+  options.num_epochs = opts.get_int("epochs", 2);
+  options.target_rate = opts.get_float("rate", 0);
+  options.seed = opts.get_int("seed", 0);
+
+  unique_ptr<PairSampler> sampler;
+  unique_ptr<FrameCache> cache;
+  if (dataset == "mnist") {
+    sampler.reset(new MnistSampler(load_images(path)));
+  } else {
+    vector<string> paths_files, poses_files;
+    for (size_t i = 0; i < TRAIN_SPLITS.size(); ++i) {
+      paths_files.push_back(string(DATA_ROOT "/kitti/paths/") + TRAIN_SPLITS[i] + ".txt");
+      poses_files.push_back(path + "/poses/" + TRAIN_SPLITS[i] + ".txt");
+    }
+    KittiSamplerOptions kitti_options;
+    kitti_options.index_dir = opts.get("index-dir", "kitti_index");
+    cache.reset(new FrameCache((size_t)1024 << 20));
+    sampler.reset(new KittiSampler(paths_files, poses_files, path + "/sequences", *cache, kitti_options));
+  }
+
+  PairGenerator generator(*sampler, options);
+  PairBatch batch;
+  uint64_t epoch_checksum = 14695981039346656037ULL;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  chrono::steady_clock::time_point epoch_start = start;
+  while (generator.next(&batch)) {
+    epoch_checksum = checksum(batch, epoch_checksum);
+    if (batch.index + 1 == options.batches_per_epoch) {
+      chrono::steady_clock::time_point now = chrono::steady_clock::now();
+      chrono::duration<double> elapsed = now - epoch_start;
+      printf("epoch %" PRIu64 ": %.0f pairs/s, checksum %016" PRIx64 "\n", batch.epoch,
+             options.batch_size * options.batches_per_epoch / elapsed.count(), epoch_checksum);
+      epoch_checksum = 14695981039346656037ULL;
+      epoch_start = now;
+    }
+  }
+  chrono::duration<double> total = chrono::steady_clock::now() - start;
+  printf("%.0f pairs/s with %u threads\n", options.num_epochs * options.batches_per_epoch * options.batch_size /
+                                              total.count(), options.num_threads);
+  return 0;
+}
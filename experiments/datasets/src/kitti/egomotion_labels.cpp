@@ -0,0 +1,123 @@
+#include "egomotion_labels.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#define LABEL_BLOCK 256 // pairs processed together, everything lives on the stack
+
+typedef array<float, NUM_BINS> BinEdges;
+
+void PosePairs::reserve(size_t n) {
+  for (unsigned int k = 0; k < POSE_SIZE; ++k) {
+    first[k].reserve(n);
+    second[k].reserve(n);
+  }
+}
+
+void PosePairs::push_back(const float *pose1, const float *pose2) {
+  for (unsigned int k = 0; k < POSE_SIZE; ++k) {
+    first[k].push_back(pose1[k]);
+    second[k].push_back(pose2[k]);
+  }
+}
+
+/*
+ * Upper edges of the bins, accumulated in float step by step. This reproduces
+ * the rounding of the old while loops, so values that lie exactly on an edge
+ * fall in the same bin as before.
+ */
+static BinEdges make_edges(float min, double step) {
+  BinEdges edges;
+  float base = min;
+  for (unsigned int k = 0; k < edges.size(); ++k) {
+    edges[k] = (base += step);
+  }
+  return edges;
+}
+
+/* The bin of a value is the number of edges below it (NaNs go to bin 0) */
+static void bin_values(const float *values, size_t count, const BinEdges &edges, Label *bins) {
+  for (size_t i = 0; i < count; ++i) {
+    int bin = 0;
+    for (unsigned int k = 0; k < edges.size(); ++k) {
+      bin += edges[k] < values[i];
+    }
+    bins[i] = bin;
+  }
+}
+
+void compute_egomotion_labels(const PosePairs &pairs, bool six_dof, EgomotionLabels *labels) {
+  static const BinEdges x_edges = make_edges(X_MIN, X_STEP);
+  static const BinEdges y_edges = make_edges(Y_MIN, Y_STEP);
+  static const BinEdges z_edges = make_edges(Z_MIN, Z_STEP);
+  static const BinEdges ty_edges = make_edges(TY_MIN, TY_STEP);
+  static const BinEdges rx_edges = make_edges(RX_MIN, RX_STEP);
+  static const BinEdges rz_edges = make_edges(RZ_MIN, RZ_STEP);
+
+  size_t n = pairs.size();
+  labels->x.resize(n);
+  labels->y.resize(n);
+  labels->z.resize(n);
+  labels->ty.resize(six_dof ? n : 0);
+  labels->rx.resize(six_dof ? n : 0);
+  labels->rz.resize(six_dof ? n : 0);
+
+  float tx[LABEL_BLOCK], ty[LABEL_BLOCK], tz[LABEL_BLOCK];
+  float rx[LABEL_BLOCK], ry[LABEL_BLOCK], rz[LABEL_BLOCK];
+  float cy[LABEL_BLOCK];
+  float rot[9][LABEL_BLOCK]; // relative rotation, row-major
+  for (size_t begin = 0; begin < n; begin += LABEL_BLOCK) {
+    size_t count = min((size_t)LABEL_BLOCK, n - begin);
+    const float *f[POSE_SIZE];
+    const float *s[POSE_SIZE];
+    for (unsigned int k = 0; k < POSE_SIZE; ++k) {
+      f[k] = pairs.first[k].data() + begin;
+      s[k] = pairs.second[k].data() + begin;
+    }
+
+    // Translations
+    for (size_t i = 0; i < count; ++i) {
+      tx[i] = s[3][i] - f[3][i];
+      ty[i] = s[7][i] - f[7][i];
+      tz[i] = s[11][i] - f[11][i];
+    }
+
+    // R2^T * R1, accumulated in double like the float cv::Mat product did
+    for (unsigned int r = 0; r < 3; ++r) {
+      for (unsigned int c = 0; c < 3; ++c) {
+        const float *s0 = s[r], *s1 = s[4 + r], *s2 = s[8 + r];
+        const float *f0 = f[c], *f1 = f[4 + c], *f2 = f[8 + c];
+        float *out = rot[r * 3 + c];
+        for (size_t i = 0; i < count; ++i) {
+          out[i] = (double)s0[i] * f0[i] + (double)s1[i] * f1[i] + (double)s2[i] * f2[i];
+        }
+      }
+    }
+
+    // Euler angles
+    for (size_t i = 0; i < count; ++i) {
+      cy[i] = sqrt(rot[8][i] * rot[8][i] + rot[5][i] * rot[5][i]);
+      ry[i] = atan2(rot[2][i], cy[i]);
+    }
+    if (six_dof) {
+      for (size_t i = 0; i < count; ++i) {
+        if (cy[i] > (float)THRESHOLD) {
+          rz[i] = atan2(-rot[1][i], rot[0][i]);
+          rx[i] = atan2(-rot[5][i], rot[8][i]);
+        } else {
+          rz[i] = atan2(-rot[3][i], rot[4][i]);
+          rx[i] = 0.0;
+        }
+      }
+    }
+
+    bin_values(tx, count, x_edges, &labels->x[begin]);
+    bin_values(ry, count, y_edges, &labels->y[begin]);
+    bin_values(tz, count, z_edges, &labels->z[begin]);
+    if (six_dof) {
+      bin_values(ty, count, ty_edges, &labels->ty[begin]);
+      bin_values(rx, count, rx_edges, &labels->rx[begin]);
+      bin_values(rz, count, rz_edges, &labels->rz[begin]);
+    }
+  }
+}
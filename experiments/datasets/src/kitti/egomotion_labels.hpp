@@ -0,0 +1,71 @@
+#ifndef _EGOMOTION_LABELS_
+#define _EGOMOTION_LABELS_
+#include <cstddef>
+#include <vector>
+
+/*
+ * Egomotion labels of KITTI pairs, computed for a whole batch of pairs at once.
+ *
+ * The label of a pair is made of the x and z translations between both frames
+ * and the y Euler angle of the relative rotation R2^T * R1, each of them
+ * quantized in NUM_BINS + 1 bins (see the *_MIN and *_STEP constants below).
+ * Optionally the other three degrees of freedom (y translation, x and z
+ * angles) are quantized too.
+ *
+ * The poses are stored as structure of arrays (one array per element of the
+ * 3x4 matrices) and processed in fixed-size blocks, so there are no
+ * allocations per pair and the inner loops can be vectorized by the compiler.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+
+#define THRESHOLD 8.8817841970012523e-16
+#define NUM_BINS 20
+#define POSE_SIZE 12 // 3x4 transform matrix, row-major
+// Translation bins
+// Maximum and minimum distances between pair of frames (rounded):
+// maxx: 18 minx: -18
+// maxz: 14 minz: -14
+// maxy: 1.55734 miny: -1.53587
+#define X_STEP 1.8
+#define X_MIN -18
+#define Z_STEP 1.3
+#define Z_MIN -14
+#define Y_MIN -0.563987
+#define Y_STEP 0.0536 // approximate
+// Bins of the remaining degrees of freedom (only with six_dof), approximate
+#define TY_MIN -1.5
+#define TY_STEP 0.15
+#define RX_MIN -0.1
+#define RX_STEP 0.01
+#define RZ_MIN -0.1
+#define RZ_STEP 0.01
+
+typedef unsigned char Label;
+
+/* Poses of both frames of every pair: first[k][i] is the element k of the pose of the first frame of pair i */
+class PosePairs {
+public:
+  void reserve(size_t n);
+  void push_back(const float *pose1, const float *pose2);
+  size_t size() const { return first[0].size(); }
+
+  vector<float> first[POSE_SIZE];
+  vector<float> second[POSE_SIZE];
+};
+
+typedef struct {
+  // Labels of the paper: x translation, y angle, z translation
+  vector<Label> x;
+  vector<Label> y;
+  vector<Label> z;
+  // Only filled with six_dof: y translation, x angle, z angle
+  vector<Label> ty;
+  vector<Label> rx;
+  vector<Label> rz;
+} EgomotionLabels;
+
+void compute_egomotion_labels(const PosePairs &pairs, bool six_dof, EgomotionLabels *labels);
+#endif
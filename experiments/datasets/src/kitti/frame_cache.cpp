@@ -0,0 +1,103 @@
+#include "frame_cache.hpp"
+#include "build_metrics.hpp"
+#include <fstream>
+#include <vector>
+
+FrameCache::FrameCache(size_t byte_budget, int imread_flags, ImagePool *pool)
+    : byte_budget(byte_budget), imread_flags(imread_flags), pool(pool), bytes_used(0), num_hits(0), num_misses(0) {}
+
+Mat FrameCache::get(const string &path) {
+  unique_lock<mutex> lock(m);
+  unordered_map<string, Entry>::iterator it = entries.find(path);
+  if (it != entries.end()) {
+    lru.splice(lru.begin(), lru, it->second.lru_pos);
+    ++num_hits;
+    return it->second.frame;
+  }
+
+  unordered_map<string, shared_future<Mat>>::iterator pending = in_flight.find(path);
+  if (pending != in_flight.end()) {
+    // Somebody else is decoding this frame right now
+    shared_future<Mat> frame = pending->second;
+    lock.unlock();
+    ++num_hits;
+    return frame.get();
+  }
+
+  promise<Mat> decoded;
+  in_flight[path] = decoded.get_future().share();
+  ++num_misses;
+  lock.unlock();
+
+  Mat frame;
+  try {
+    frame = decode(path);
+  } catch (...) {
+    // The waiters get the same error, and the next get() of the frame tries again
+    lock.lock();
+    in_flight.erase(path);
+    lock.unlock();
+    decoded.set_exception(current_exception());
+    throw;
+  }
+
+  lock.lock();
+  insert(path, frame);
+  in_flight.erase(path);
+  lock.unlock();
+  decoded.set_value(frame);
+  return frame;
+}
+
+Mat FrameCache::decode(const string &path) const {
+  if (pool == NULL) {
+    StageTimer timer(STAGE_DECODE); // reading included
+    return imread(path, imread_flags);
+  }
+  // Same as imread, but the pixels go to a frame of the pool. The buffer of
+  // the file is reused by every decode of the thread.
+  static thread_local vector<uchar> contents;
+  {
+    StageTimer timer(STAGE_LOAD);
+    ifstream file(path.c_str(), ios::binary);
+    if (!file.seekg(0, ios::end)) {
+      return Mat();
+    }
+    contents.resize(file.tellg());
+    file.seekg(0);
+    if (contents.empty() || !file.read(reinterpret_cast<char *>(&contents[0]), contents.size())) {
+      return Mat();
+    }
+  }
+  StageTimer timer(STAGE_DECODE);
+  Mat frame;
+  frame.allocator = pool;
+  imdecode(contents, imread_flags, &frame);
+  return frame;
+}
+
+/* PRECONDITION: m is locked */
+void FrameCache::insert(const string &path, const Mat &frame) {
+  size_t frame_bytes = frame.total() * frame.elemSize();
+  if (frame.empty() || frame_bytes > byte_budget) {
+    return;
+  }
+  while (bytes_used + frame_bytes > byte_budget && !lru.empty()) {
+    unordered_map<string, Entry>::iterator victim = entries.find(lru.back());
+    bytes_used -= victim->second.frame.total() * victim->second.frame.elemSize();
+    entries.erase(victim);
+    lru.pop_back();
+  }
+  lru.push_front(path);
+  Entry entry = {frame, lru.begin()};
+  entries[path] = entry;
+  bytes_used += frame_bytes;
+}
+
+void FrameCache::print_stats(ostream &out) const {
+  lock_guard<mutex> lock(m);
+  unsigned long total = num_hits + num_misses;
+  out << "Frame cache: " << num_hits << " hits, " << num_misses << " misses ("
+      << (total ? 100.0 * num_hits / total : 0.0) << "% hit rate), " << entries.size() << " frames, "
+      << (bytes_used >> 20) << " MB" << endl;
+}
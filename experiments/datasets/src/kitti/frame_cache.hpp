@@ -0,0 +1,71 @@
+#ifndef _FRAME_CACHE_
+#define _FRAME_CACHE_
+#include "image_pool.hpp"
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include <atomic>
+#include <future>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/*
+ * LRU cache of decoded frames, keyed by path.
+ *
+ * The pairs of the KITTI dataset are made of frames that are close in time,
+ * so the same PNGs are decoded over and over. The cache keeps the decoded
+ * frames up to a budget of bytes and evicts the least recently used ones.
+ *
+ * It is safe to use from several threads. If a frame is requested while
+ * another thread is decoding it, the second thread waits for that decode
+ * instead of decoding the frame again.
+ *
+ * The returned Mats are shared with the cache (and with other callers):
+ * do not modify them, clone them or take ROIs instead.
+ *
+ * With a pool the frames are decoded into frames of the pool, which go back
+ * to it once they are evicted and no ROI of them is alive anymore, instead of
+ * allocating (and page faulting) a new frame for every miss.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+using namespace cv;
+
+class FrameCache {
+public:
+  FrameCache(size_t byte_budget, int imread_flags = CV_LOAD_IMAGE_COLOR, ImagePool *pool = NULL);
+
+  Mat get(const string &path);
+
+  unsigned long hits() const { return num_hits; }
+  unsigned long misses() const { return num_misses; }
+  size_t bytes() const {
+    lock_guard<mutex> lock(m);
+    return bytes_used;
+  }
+  void print_stats(ostream &out) const;
+
+private:
+  typedef struct {
+    Mat frame;
+    list<string>::iterator lru_pos;
+  } Entry;
+
+  size_t byte_budget;
+  int imread_flags;
+  ImagePool *pool;
+  size_t bytes_used;
+  atomic<unsigned long> num_hits;
+  atomic<unsigned long> num_misses;
+  mutable mutex m;
+  unordered_map<string, Entry> entries;
+  list<string> lru; // most recently used first
+  unordered_map<string, shared_future<Mat>> in_flight;
+
+  void insert(const string &path, const Mat &frame);
+  Mat decode(const string &path) const;
+};
+#endif
@@ -21,45 +21,48 @@
  * Author: Ezequiel Torti Lopez
  */
 
+#include "build_metrics.hpp"
+#include "cli_options.hpp"
+#include "egomotion_labels.hpp"
+#include "frame_cache.hpp"
 #include "lmdb_creator.hpp"
+#include "ordered_pipeline.hpp"
+#include "sequence_index.hpp"
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 #include <algorithm>
+#include <cassert>
 #include <cinttypes>
-#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <string>
 #include <sys/stat.h>
+#include <thread>
 #include <vector>
 
 using namespace std;
 using namespace cv;
 
-#define THRESHOLD 8.8817841970012523e-16
-#define NUM_BINS 20
 #define HEIGHT 227
 #define WIDTH 227
 #define REAL_WIDTH 1241 
 #define REAL_HEIGHT 376
 #define NUM_CLASSES 3
+#define NUM_CLASSES_6DOF 6
 #define LABEL_WIDTH NUM_BINS
 #define NUM_CHANNELS 3
 #define PAIRS_PER_SPLIT 2300 // approx. ~20K pairs of images
-// Translation bins
-// Maximum and minimum distances between pair of frames (rounded):
-// maxx: 18 minx: -18
-// maxz: 14 minz: -14
-// maxy: 1.55734 miny: -1.53587
-#define X_STEP 1.8
-#define X_MIN -18
-#define Z_STEP 1.3
-#define Z_MIN -14
-#define Y_MIN -0.563987
-#define Y_STEP 0.0536 // approximate
+#define FRAME_CACHE_MB 1024
+// Slots of the pool of decoded frames, large enough for the frames of every
+// sequence (1241x376, 1242x375 or 1226x370), 16 per slab
+#define FRAME_SLOT_BYTES (1242 * 376 * NUM_CHANNELS)
+#define FRAMES_PER_SLAB 16
+#define PREFETCH_PER_THREAD 4
+// The bins of the egomotion labels are defined in egomotion_labels.hpp
 
 #define PATHS_FILES  (DATA_ROOT"/kitti/paths/")
 #define IMAGES       "/sequences/"
@@ -72,7 +75,6 @@ typedef char Byte;
 typedef unsigned char uByte;
 typedef uByte Label;
 typedef array< array<float, 4>, 3> TransformMatrix;
-typedef array< array<float, 3>, 3> RotMatrix;
 typedef struct
 {
     string path1;
@@ -81,176 +83,252 @@ typedef struct
     string path2;
     TransformMatrix t2;
     int i2;
+    // rand() values for the random crop, drawn in pair order before the pairs are
+    // processed in parallel (so the crops are the same as in a serial run)
+    int rand_top;
+    int rand_left;
+    int seq; // index of the sequence in the split
 } ImgPair;
-typedef struct 
-{
-    float x;
-    float y;
-    float z;
-} EulerAngles;
 typedef struct
 {
     Mat img1;
     Mat img2;
     Label sfa;
-    Label x;
-    Label y;
-    Label z;
+    string encoded; // the whole serialized Datum, when a codec is used
 } DataBlob;
+typedef struct
+{
+    unsigned int num_threads;
+    size_t prefetch; // pairs decoded ahead of the LMDB writers
+    bool locality_order; // process in (sequence, frame) order, shuffle through the keys
+    string index_dir; // where the binary indices of the sequences are kept
+    string paths_dir; // where the paths files of the sequences (00.txt...) are
+    unsigned int pairs_per_split; // pairs drawn from every sequence
+    bool six_dof; // label the 6 degrees of freedom instead of x, y angle and z
+    bool combined_layout; // labels in the float_data of the data records, no labels LMDB
+    unsigned int num_shards; // LMDBs written in parallel per database
+    DatumCodec codec; // payload of the data records
+    string mean_file; // binaryproto with the mean of the data records, empty for none
+    // Build only the records whose position in the processing order is part (mod num_parts)
+    unsigned int part;
+    unsigned int num_parts;
+    bool resume; // continue an unfinished build of the same LMDBs
+} BuildConfig;
 
 // 9 Sequences for training, 2 for validation
 const vector<string> TRAIN_SPLITS = {"00.txt", "01.txt", "02.txt", "03.txt", "04.txt", "05.txt", "06.txt", "07.txt", "08.txt"};
 const vector<string> VAL_SPLITS = {"09.txt", "10.txt"};
 
 unsigned int generate_rand(int range_limit);
-RotMatrix multiply_rot_matrix(RotMatrix& t1, RotMatrix& t2);
-RotMatrix get_rot_matrix(TransformMatrix& t);
-EulerAngles mat2euler(RotMatrix& m);
-void create_lmdbs(string images_root, string lmdb_path, const vector<string> split);
-vector<ImgPair> generate_pairs(const string images_root, const vector<string> split, bool is_sfa);
-DataBlob process_images(ImgPair p);
+void create_lmdbs(string images_root, string lmdb_path, const vector<string> split, bool is_sfa,
+                  FrameCache &cache, const BuildConfig &config);
+vector<ImgPair> generate_pairs(const string images_root, const vector<string> split, bool is_sfa,
+                               const BuildConfig &config);
+TransformMatrix get_transform_matrix(const SequenceIndex &index, unsigned int frame);
+DataBlob process_images(ImgPair p, FrameCache &cache);
+vector<Label> pair_label_vector(const EgomotionLabels &labels, unsigned int pair, bool six_dof);
 
-vector<ImgPair> generate_pairs(const string images_root, const vector<string> split, bool is_sfa) {
+vector<ImgPair> generate_pairs(const string images_root, const vector<string> split, bool is_sfa,
+                               const BuildConfig &config) {
     int neighbours = 7;
     if (is_sfa)
         neighbours = 20;
-    vector<ImgPair> pairs_paths;
+
+    // Paths and poses of every sequence, from the binary indices (built in parallel if needed)
+    vector<string> paths_files, poses_files;
     for (unsigned int i=0; i<split.size(); ++i) {
-        // Load original paths
-        ifstream fsplit;
-        fsplit.open(PATHS_FILES+split[i]);
-        string path;
-        vector<string> split_paths;
-        while (fsplit >> path) {
-            split_paths.push_back(images_root+"/"+IMAGES"/"+path);
-        }
-        fsplit.close();
+        paths_files.push_back(config.paths_dir+"/"+split[i]);
+        poses_files.push_back(images_root+"/"+POSES+"/"+split[i]);
+    }
+    vector<shared_ptr<SequenceIndex>> indices =
+        open_sequence_indices(paths_files, poses_files, config.index_dir, config.num_threads);
 
-        // Load transform matrix 
-        fsplit.open(images_root+"/"+POSES+"/"+split[i]);
-        TransformMatrix m;
-        vector<TransformMatrix> split_matrix;
-        while (fsplit >> m[0][0] >> m[0][1] >> m[0][2] >> m[0][3] >>
-                         m[1][0] >> m[1][1] >> m[1][2] >> m[1][3] >> 
-                         m[2][0] >> m[2][1] >> m[2][2] >> m[2][3]) {
-            split_matrix.push_back(m);
-        }
+    vector<ImgPair> pairs_paths;
+    for (unsigned int i=0; i<split.size(); ++i) {
+        const SequenceIndex &seq_index = *indices[i];
+        assert(seq_index.num_poses() >= seq_index.num_frames());
+        // Same as the size of the list of paths
+        const unsigned int num_frames = seq_index.num_frames();
 
         // Generate pairs
-        for (unsigned int j=0; j<PAIRS_PER_SPLIT; ++j) {
-            int index = generate_rand(split_paths.size());
+        for (unsigned int j=0; j<config.pairs_per_split; ++j) {
+            int index = generate_rand(num_frames);
             int pair_index = 0;
             int pair_offset = generate_rand(neighbours)+1;
             if (index==0) {
                 pair_index = index + pair_offset;
-            } else if (static_cast<unsigned int>(index) == split_paths.size()-1) {
+            } else if (static_cast<unsigned int>(index) == num_frames-1) {
                 pair_index = index - pair_offset;
             } else {
                 if (generate_rand(2)) { // go to the left
                     // Careful with this substraction. If the 2 operands were unsigned int we could get in trouble (overflow)
                     pair_index = (index - pair_offset >= 0) ? index - pair_offset : 0;  
                 } else { // go to the right
-                    pair_index = (static_cast<unsigned int>(index + pair_offset) <= split_paths.size()-1) ? index + pair_offset : split_paths.size()-1;  
+                    pair_index = (static_cast<unsigned int>(index + pair_offset) <= num_frames-1) ? index + pair_offset : num_frames-1;  
                 }
             }
-            ImgPair pair = {split_paths[index], split_matrix[index], index, split_paths[pair_index], split_matrix[pair_index], pair_index};
+            ImgPair pair = {images_root+"/"+IMAGES"/"+seq_index.path(index), get_transform_matrix(seq_index, index), index,
+                            images_root+"/"+IMAGES"/"+seq_index.path(pair_index), get_transform_matrix(seq_index, pair_index), pair_index};
+            pair.seq = i;
             pairs_paths.push_back(pair);
         }
     }
     return pairs_paths;
 }
 
-void create_lmdbs(string images_root, string lmdb_path, const vector<string> split, bool is_sfa)
+void create_lmdbs(string images_root, string lmdb_path, const vector<string> split, bool is_sfa,
+                  FrameCache &cache, const BuildConfig &config)
 {
+    // Write from dedicated threads so the PNG decoding overlaps with the disk writes.
+    // The queued crops keep their whole frame alive, so keep the queue short.
+    LMDataBaseOptions db_options;
+    db_options.async = true;
+    db_options.queue_capacity = 32;
+    db_options.num_shards = config.num_shards;
+    // The records depend on these options (rand() is replayed from srand(0) on resume)
+    db_options.checkpoint = config.num_shards == 1;
+    db_options.build_params = string("preprocess_kitti_siamese ") + (is_sfa ? "sfa" : "ego") +
+                              " order=" + (config.locality_order ? "locality" : "shuffled") +
+                              " labels=" + (config.six_dof ? "6dof" : "3dof") +
+                              " layout=" + (config.combined_layout ? "combined" : "two") +
+                              " codec=" + codec_name(config.codec) + " part=" + to_string(config.part) + "/" +
+                              to_string(config.num_parts) + " pairs_per_split=" + to_string(config.pairs_per_split);
+    db_options.resume = config.resume;
     LMDataBase *labels_lmdb = NULL;
-    if (!is_sfa){
+    bool combined = !is_sfa && config.combined_layout;
+    if (!is_sfa && !combined){
       string labels_path = lmdb_path + "_labels";
-      labels_lmdb = new LMDataBase(labels_path, (size_t)NUM_CLASSES, 1);
+      size_t num_classes = config.six_dof ? NUM_CLASSES_6DOF : NUM_CLASSES;
+      labels_lmdb = new LMDataBase(labels_path, num_classes, 1, db_options);
     }
-    LMDataBase *data_lmdb = new LMDataBase(lmdb_path, (size_t)6, (size_t)HEIGHT);
+    LMDataBaseOptions data_options = db_options;
+    data_options.mean_file = config.mean_file;
+    LMDataBase *data_lmdb = new LMDataBase(lmdb_path, (size_t)6, (size_t)HEIGHT, data_options);
 
     // Generate pairs of images for each sequence 
-    vector<ImgPair> pairs = generate_pairs(images_root, split, is_sfa);
+    vector<ImgPair> pairs = generate_pairs(images_root, split, is_sfa, config);
     random_shuffle(std::begin(pairs), std::end(pairs));
-
     for (unsigned int i = 0; i<pairs.size(); i++)
     {
-      DataBlob data = process_images(pairs[i]);
-      data_lmdb->insert2db(data.img1, data.img2, data.sfa);
-      if (!is_sfa) {
-       vector<Label> labels = {(Label)data.x, (Label)data.y, (Label)data.z};
-       labels_lmdb->insert2db(labels);
+      pairs[i].rand_top = rand();
+      pairs[i].rand_left = rand();
+    }
+
+    // Egomotion labels of all the pairs in one batch
+    EgomotionLabels labels;
+    if (!is_sfa)
+    {
+      static_assert(sizeof(TransformMatrix) == POSE_SIZE * sizeof(float), "TransformMatrix must be contiguous");
+      PosePairs poses;
+      poses.reserve(pairs.size());
+      for (unsigned int i = 0; i<pairs.size(); i++)
+      {
+        poses.push_back(&pairs[i].t1[0][0], &pairs[i].t2[0][0]);
+      }
+      compute_egomotion_labels(poses, config.six_dof, &labels);
+    }
+
+    // Order in which the pairs are processed. In locality mode the pairs are processed
+    // sequence by sequence and frame by frame, so neighbouring frames are decoded
+    // (and found in the frame cache) together. Each record is stored with its
+    // position in the shuffled list as key, so the cursor order of the LMDBs is
+    // still the shuffled one and the databases are identical to the default mode.
+    vector<unsigned int> order(pairs.size());
+    for (unsigned int i = 0; i<order.size(); i++)
+    {
+      order[i] = i;
+    }
+    if (config.locality_order)
+    {
+      stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        int first_a = min(pairs[a].i1, pairs[a].i2);
+        int first_b = min(pairs[b].i1, pairs[b].i2);
+        return pairs[a].seq < pairs[b].seq || (pairs[a].seq == pairs[b].seq && first_a < first_b);
+      });
+    }
+    // Every machine draws all the pairs and builds its own part of them (with their final keys)
+    if (config.num_parts > 1)
+    {
+      vector<unsigned int> part_order;
+      for (unsigned int i = config.part; i<order.size(); i += config.num_parts)
+      {
+        part_order.push_back(order[i]);
+      }
+      order.swap(part_order);
+    }
+
+    // With --resume, each database skips the records it already has (the
+    // first ones in processing order). Everything above is drawn again anyway,
+    // so rand() is in the same state for the next split.
+    unsigned int data_done = data_lmdb->resumed_records();
+    unsigned int labels_done = (labels_lmdb != NULL) ? labels_lmdb->resumed_records() : data_done;
+    unsigned int resume_at = min(min(data_done, labels_done), (unsigned int)order.size());
+    order.erase(order.begin(), order.begin() + resume_at);
+
+    // Decode, crop and encode the pairs in parallel, they come back in processing order
+    auto process_pair = [&](size_t i) {
+      DataBlob data = process_images(pairs[order[i]], cache);
+      if (config.codec.type != CODEC_RAW) {
+        vector<float> float_data;
+        if (combined) {
+          vector<Label> pair_labels = pair_label_vector(labels, order[i], config.six_dof);
+          float_data.assign(pair_labels.begin(), pair_labels.end());
+        }
+        {
+          StageTimer timer(STAGE_SERIALIZE);
+          data.encoded = encode_datum(data.img1, data.img2, data.sfa, float_data, config.codec);
+        }
+        // Do not keep the frames alive in the writer queue
+        data.img1.release();
+        data.img2.release();
+      }
+      return data;
+    };
+    OrderedPipeline<DataBlob> pipeline(order.size(), process_pair, config.num_threads, config.prefetch);
+    DataBlob data;
+    for (unsigned int i = 0; pipeline.next(&data); i++)
+    {
+      unsigned int key = order[i];
+      bool to_data = resume_at + i >= data_done;
+      bool to_labels = labels_lmdb != NULL && resume_at + i >= labels_done;
+      if (to_labels)
+        labels_lmdb->insert2db(pair_label_vector(labels, key, config.six_dof), key);
+      if (!to_data)
+        continue;
+      if (!data.encoded.empty()) {
+        data_lmdb->insert2db(data.encoded, key);
+      } else if (combined) {
+        data_lmdb->insert2db(data.img1, data.img2, data.sfa, pair_label_vector(labels, key, config.six_dof), key);
+      } else {
+        data_lmdb->insert2db(data.img1, data.img2, data.sfa, key);
       }
     }
 
     delete data_lmdb;
-    if (!is_sfa)
+    if (labels_lmdb != NULL)
       delete labels_lmdb;
+    cache.print_stats(cout);
     return;
 }
 
-//float maxy=-40000.0, miny=40000.0;
-DataBlob process_images(ImgPair p)
+DataBlob process_images(ImgPair p, FrameCache &cache)
 {
     DataBlob final_data;
 
-    Mat im1 = imread(p.path1, CV_LOAD_IMAGE_COLOR);
-    Mat im2 = imread(p.path2, CV_LOAD_IMAGE_COLOR);
+    // The frames are shared with the cache, the crops below are just views
+    Mat im1 = cache.get(p.path1);
+    Mat im2 = cache.get(p.path2);
     assert(im1.cols>0 && im2.cols>0 && im1.rows>0 && im2.rows>0);
 
-    unsigned int top = generate_rand(min(im1.rows, im2.rows) - HEIGHT);
-    unsigned int left = generate_rand(min(im1.cols, im2.cols) - WIDTH);
+    // Same as generate_rand(), with the numbers drawn beforehand
+    StageTimer timer(STAGE_TRANSFORM);
+    unsigned int top = p.rand_top % (min(im1.rows, im2.rows) - HEIGHT);
+    unsigned int left = p.rand_left % (min(im1.cols, im2.cols) - WIDTH);
     Rect r(left, top, WIDTH, HEIGHT);
 
     final_data.img1 = im1(r);
     final_data.img2 = im2(r);
 
-    float x,y,z;
-    int bin_x = 0, bin_y = 0, bin_z = 0;
-    // Translations
-    x = p.t2[0][3] - p.t1[0][3];
-    z = p.t2[2][3] - p.t1[2][3];
-
-    // bin for x
-    float base_x = X_MIN;
-    while ((base_x += X_STEP) < x && bin_x < NUM_BINS) {
-        ++bin_x;
-    }
-    // bin for z
-    float base_z = Z_MIN;
-    while ((base_z += Z_STEP) < z && bin_z < NUM_BINS) {
-        ++bin_z;
-    }
-
-    // Euler angle
-    //cout << "Transform matrix 1" << endl;
-    //cout <<  "[[ " <<p.t1[0][0] << ", " <<  p.t1[0][1] << ", " <<  p.t1[0][2] << ", " <<  p.t1[0][3] << "]," << 
-    //         "[ " <<p.t1[1][0] << ", " <<  p.t1[1][1] << ", " <<  p.t1[1][2] << ", " <<  p.t1[1][3] << "], " <<  
-    //         "[ " <<p.t1[2][0] << ", " <<  p.t1[2][1] << ", " <<  p.t1[2][2] << ", " <<  p.t1[2][3] << "]]"<< endl;
-    //cout << "Transform matrix 2" << endl;
-    //cout <<  "[[ " <<p.t2[0][0] << ", " <<  p.t2[0][1] << ", " <<  p.t2[0][2] << ", " <<  p.t2[0][3] << "]," << 
-    //         "[ " <<p.t2[1][0] << ", " <<  p.t2[1][1] << ", " <<  p.t2[1][2] << ", " <<  p.t2[1][3] << "]," <<  
-    //         "[ " <<p.t2[2][0] << ", " <<  p.t2[2][1] << ", " <<  p.t2[2][2] << ", " <<  p.t2[2][3] << "]]" << endl;
-
-    RotMatrix r1 = get_rot_matrix(p.t1);
-    RotMatrix r2 = get_rot_matrix(p.t2);
-    RotMatrix rot = multiply_rot_matrix(r1, r2);
-    EulerAngles eu = mat2euler(rot);
-    y = eu.y;
-    //cout << "Final results:" << endl;
-    //cout << "x trans: " << x << " Y euler: " << y << " Z trans: " << z << endl;
-    //maxy = (y>maxy) ? y : maxy;
-    //miny = (y<miny) ? y : miny;
-    //std::cout << "maxy: " << maxy << " miny: " << miny << std::endl;
-    // bin for y
-    float base_y = Y_MIN;
-    while ((base_y += Y_STEP) < y && bin_y < NUM_BINS) {
-        ++bin_y;
-    }
-
-    final_data.x = bin_x;
-    final_data.y = bin_y;
-    final_data.z = bin_z;
     final_data.sfa = abs(p.i1 - p.i2) <= 7;
 
     // Debugging
@@ -262,6 +340,18 @@ DataBlob process_images(ImgPair p)
     return final_data;
 }
 
+/* Labels of a pair in the order they are stored: x, y, z (and ty, rx, rz with six_dof) */
+vector<Label> pair_label_vector(const EgomotionLabels &labels, unsigned int pair, bool six_dof)
+{
+    vector<Label> pair_labels = {labels.x[pair], labels.y[pair], labels.z[pair]};
+    if (six_dof) {
+        pair_labels.push_back(labels.ty[pair]);
+        pair_labels.push_back(labels.rx[pair]);
+        pair_labels.push_back(labels.rz[pair]);
+    }
+    return pair_labels;
+}
+
 /* Generate a random number between 0 and range_limit-1
  * Useful to get a random element in an array of size range_limit
  */
@@ -270,67 +360,63 @@ unsigned int generate_rand(int range_limit)
     return rand() % range_limit;
 }
 
-RotMatrix multiply_rot_matrix(RotMatrix& t1, RotMatrix& t2){
-    cv::Mat cvt1(3,3,CV_32FC1,&t1);
-    cv::Mat cvt2(3,3,CV_32FC1,&t2);
-    cv::Mat cvres = cvt2.t() * cvt1;
-    RotMatrix res;
-    for (int i = 0; i < cvres.rows; i++) {
-      const float *cvr = cvres.ptr<float>(i);
-      for (int j = 0; j < cvres.cols; j++) {
-        res[i][j] = cvr[j];
-      }
-    }
-    return res;
-}
-
-RotMatrix get_rot_matrix(TransformMatrix& t){
-    RotMatrix rot;
-    for (unsigned int i = 0; i<t.size(); ++i){
-        for (unsigned int j = 0; j<t.size(); ++j){ // t is square
-            rot[i][j] = t[i][j];
+TransformMatrix get_transform_matrix(const SequenceIndex &index, unsigned int frame){
+    TransformMatrix m;
+    const float *pose = index.pose(frame);
+    for (unsigned int i = 0; i<m.size(); ++i){
+        for (unsigned int j = 0; j<m[i].size(); ++j){
+            m[i][j] = pose[i*m[i].size() + j];
         }
     }
-    return rot;
+    return m;
 }
 
-EulerAngles mat2euler(RotMatrix& m){
-    float threshold = THRESHOLD;
-	float cy = sqrt(m[2][2]*m[2][2] + m[1][2]*m[1][2]);
-    float z=0.0, y=0.0, x=0.0;
-    if (cy > threshold) {
-        z = atan2(-m[0][1], m[0][0]);
-        y = atan2(m[0][2], cy);
-        x = atan2(-m[1][2], m[2][2]);
-    } else {
-        z = atan2(-m[1][0], m[1][1]);
-        y = atan2(m[0][2], cy);
-        x = 0.0;
-    }
-    //cout << "Rotmat" << endl;
-    //cout <<  "[[ " <<m[0][0] << ", " <<  m[0][1] << ", " <<  m[0][2] << "]," << 
-    //         "[ " <<m[1][0] << ", " <<  m[1][1] << ", " <<  m[1][2]  << "]," <<  
-    //         "[ " <<m[2][0] << ", " <<  m[2][1] << ", " <<  m[2][2]  << "]]" << endl;
-    //cout << "Euler:" << endl;
-    //cout << "x: " << x << " y: " << y << " z: " << z << endl;
-    return (EulerAngles){x,y,z};
-}
-
-
 int main(int argc, char** argv)
 {
-  if (argc < 4) {
+  CliOptions opts(argc, argv);
+  if (opts.positional().size() < 3) {
     cout << "You must provide the path where the KITTI original dataset\n"
          << "lives ('sequences' and 'poses' folders downloaded from the official website),\n"
          << "the path were you want to save your generated LMDBs and\n"
          << "say if this lmdb has to be created for SFA ('sfa') or only for Egomotion ('ego')\n\n"
-         << argv[0] << " path/to/sequences_and_poses path/where/to/save/LMDB sfa\n\n";
+         << argv[0] << " path/to/sequences_and_poses path/where/to/save/LMDB sfa [options]\n\n"
+         << "Options:\n"
+         << "  --cache=MB     memory used to keep decoded frames between pairs (default: " << FRAME_CACHE_MB << ")\n"
+         << "  --threads=N    number of threads decoding and cropping the pairs (default: all cores)\n"
+         << "  --prefetch=N   number of pairs decoded ahead of the writers (default: "
+         << PREFETCH_PER_THREAD << " per thread)\n"
+         << "  --order=locality   decode the pairs grouped by sequence and frame and shuffle them\n"
+         << "                     through the LMDB keys instead. Same databases, better cache hit rate.\n"
+         << "  --index-dir=DIR    where to keep the binary indices of the sequences\n"
+         << "                     (default: path/where/to/save/LMDB/kitti_index)\n"
+         << "  --paths-dir=DIR    where the paths files of the sequences (00.txt to 10.txt) are\n"
+         << "                     (default: " << PATHS_FILES << ")\n"
+         << "  --pairs-per-split=N\n"
+         << "                     pairs drawn from every sequence (default: " << PAIRS_PER_SPLIT << ")\n"
+         << "  --labels=6dof      also label the y translation and the x and z angles\n"
+         << "                     (6 labels per pair instead of 3)\n"
+         << "  --layout=combined  store the egomotion labels in the float_data of the data records\n"
+         << "                     instead of a separate labels LMDB (see split_combined_lmdb)\n"
+         << "  --codec=C          payload of the data records: raw (default), png, jpeg, jpeg:Q\n"
+         << "                     (quality Q) or lz4. Encoded in parallel by the worker threads.\n"
+         << "                     Caffe's Data layers (experiments/*.py) can not read encoded pairs,\n"
+         << "                     only decode_datum_data() and BatchReader can.\n"
+         << "  --shards=K         write each database as K LMDB shards in parallel (default: 1)\n"
+         << "  --part=I/N         build only the part I (0..N-1) of N of the records, to split a\n"
+         << "                     build among N machines. Join the parts with merge_lmdb_shards.\n"
+         << "  --mean=FILE        also compute the mean of the train images while they are written and\n"
+         << "                     save it in FILE (a binaryproto, like compute_image_mean)\n"
+         << "  --resume           continue a build that stopped (it checkpoints every commit) with the\n"
+         << "                     same options, the LMDBs are the same as in a build that never stopped.\n"
+         << "                     Not with --shards.\n"
+         << "  --metrics=F        where to write the JSON with the time spent in each stage of the\n"
+         << "                     build (default: path/where/to/save/LMDB/build_metrics.json, - for stdout)\n\n";
   } else {
     srand(0);
-    string images_root(argv[1]);
-    string lmdb_data_path = string(argv[2]) + "/" + LMDB_TRAIN;
-    string val_lmdb_data_path = string(argv[2]) + "/" + LMDB_VAL;
-    string sfa_flag = argv[3];
+    string images_root(opts.positional()[0]);
+    string lmdb_data_path = opts.positional()[1] + "/" + LMDB_TRAIN;
+    string val_lmdb_data_path = opts.positional()[1] + "/" + LMDB_VAL;
+    string sfa_flag = opts.positional()[2];
     bool is_sfa = sfa_flag == "sfa";
     if (is_sfa){
         lmdb_data_path += "_sfa_lmdb";
@@ -339,10 +425,44 @@ int main(int argc, char** argv)
         lmdb_data_path += "_egomotion_lmdb";
         val_lmdb_data_path += "_egomotion_lmdb";
     }
+    // Declared before the cache, so it outlives the frames in the cache
+    ImagePool frame_pool(FRAME_SLOT_BYTES, FRAMES_PER_SLAB);
+    FrameCache cache((size_t)opts.get_int("cache", FRAME_CACHE_MB) << 20, CV_LOAD_IMAGE_COLOR, &frame_pool);
+    BuildConfig config;
+    config.num_threads = opts.get_int("threads", thread::hardware_concurrency());
+    config.prefetch = opts.get_int("prefetch", PREFETCH_PER_THREAD * max(config.num_threads, 1u));
+    config.locality_order = opts.get("order", "shuffled") == "locality";
+    config.combined_layout = opts.get("layout", "two") == "combined";
+    config.six_dof = opts.get("labels", "3dof") == "6dof";
+    config.num_shards = opts.get_int("shards", 1);
+    config.codec = parse_codec(opts.get("codec", "raw"));
+    config.part = 0;
+    config.num_parts = 1;
+    if (opts.has("part") && (sscanf(opts.get("part", "").c_str(), "%u/%u", &config.part, &config.num_parts) != 2 ||
+                             config.part >= config.num_parts)) {
+      cout << "--part must be I/N with 0 <= I < N\n";
+      return 1;
+    }
+    config.resume = opts.has("resume");
+    if (config.resume && config.num_shards > 1) {
+      cout << "--resume does not work with --shards\n";
+      return 1;
+    }
+    config.index_dir = opts.get("index-dir", opts.positional()[1] + "/kitti_index");
+    config.paths_dir = opts.get("paths-dir", PATHS_FILES);
+    config.pairs_per_split = opts.get_int("pairs-per-split", PAIRS_PER_SPLIT);
+    config.mean_file = opts.get("mean", "");
     cout << "Creating train LMDB's\n";
-    create_lmdbs(images_root, lmdb_data_path, TRAIN_SPLITS, is_sfa);
+    create_lmdbs(images_root, lmdb_data_path, TRAIN_SPLITS, is_sfa, cache, config);
     cout << "Creating val LMDB's\n";
-    create_lmdbs(images_root, val_lmdb_data_path, VAL_SPLITS, is_sfa);
+    config.mean_file = "";
+    create_lmdbs(images_root, val_lmdb_data_path, VAL_SPLITS, is_sfa, cache, config);
+    frame_pool.print_stats(cout, "Frame");
+    build_metrics().print_summary(cout);
+    string metrics_path = opts.get("metrics", opts.positional()[1] + "/build_metrics.json");
+    if (!write_build_metrics(metrics_path, "preprocess_kitti_siamese")) {
+      cerr << "Could not write the build metrics to " << metrics_path << endl;
+    }
   }
   return 0;
 }
@@ -0,0 +1,234 @@
+#include "sequence_index.hpp"
+#include "ordered_pipeline.hpp"
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "KITTIIDX"
+#define INDEX_VERSION 2
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_frames;
+  uint32_t num_poses;
+  uint32_t reserved;
+  uint64_t source_checksum;
+  SourceStamp paths_stamp;
+  SourceStamp poses_stamp;
+  uint64_t poses_offset;
+  uint64_t path_offsets_offset;
+  uint64_t path_data_offset;
+  uint64_t file_size;
+} IndexHeader;
+
+static string read_file(const string &path) {
+  ifstream f(path.c_str(), ios::in | ios::binary);
+  if (!f) {
+    throw runtime_error("Could not open " + path);
+  }
+  return string(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+}
+
+/* FNV-1a, 64 bits */
+static uint64_t fnv1a(const string &text, uint64_t hash = 14695981039346656037ULL) {
+  for (size_t i = 0; i < text.size(); ++i) {
+    hash ^= static_cast<unsigned char>(text[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static uint64_t sources_checksum(const string &paths_file, const string &poses_file) {
+  return fnv1a(read_file(poses_file), fnv1a(read_file(paths_file)));
+}
+
+static SourceStamp source_stamp(const string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    throw runtime_error("Could not open " + path);
+  }
+  SourceStamp stamp;
+  stamp.size = st.st_size;
+  stamp.mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+  return stamp;
+}
+
+static bool same_stamp(const SourceStamp &a, const SourceStamp &b) {
+  return a.size == b.size && a.mtime_ns == b.mtime_ns;
+}
+
+SequenceIndex::~SequenceIndex() {
+  if (data != NULL) {
+    munmap(const_cast<char *>(data), size);
+  }
+}
+
+string SequenceIndex::path(size_t i) const {
+  return string(path_data + path_offsets[i], path_offsets[i + 1] - path_offsets[i]);
+}
+
+shared_ptr<SequenceIndex> SequenceIndex::open(const string &paths_file, const string &poses_file,
+                                              const string &index_file) {
+  // The text files are only read (and hashed) when their size or modification time changed
+  SourceStamp paths_stamp = source_stamp(paths_file);
+  SourceStamp poses_stamp = source_stamp(poses_file);
+  shared_ptr<SequenceIndex> index = map_file(index_file);
+  if (index) {
+    const IndexHeader *header = reinterpret_cast<const IndexHeader *>(index->data);
+    if (same_stamp(header->paths_stamp, paths_stamp) && same_stamp(header->poses_stamp, poses_stamp)) {
+      return index;
+    }
+  }
+  uint64_t checksum = sources_checksum(paths_file, poses_file);
+  if (index && reinterpret_cast<const IndexHeader *>(index->data)->source_checksum == checksum) {
+    // Same contents (e.g. the files were copied or touched): only the stamps are out of date
+    update_stamps(index_file, paths_stamp, poses_stamp);
+    return index;
+  }
+  cout << "Building index " << index_file << endl;
+  build(paths_file, poses_file, index_file, checksum, paths_stamp, poses_stamp);
+  index = map_file(index_file);
+  if (!index) {
+    throw runtime_error("Could not build the index " + index_file);
+  }
+  return index;
+}
+
+/* Returns NULL if the file does not exist or is not a valid index */
+shared_ptr<SequenceIndex> SequenceIndex::map_file(const string &index_file) {
+  int fd = ::open(index_file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return shared_ptr<SequenceIndex>();
+  }
+  struct stat st;
+  fstat(fd, &st);
+  shared_ptr<SequenceIndex> index(new SequenceIndex());
+  index->size = st.st_size;
+  if (index->size >= sizeof(IndexHeader)) {
+    void *addr = mmap(NULL, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    index->data = (addr == MAP_FAILED) ? NULL : static_cast<const char *>(addr);
+  }
+  ::close(fd);
+  if (index->data == NULL) {
+    return shared_ptr<SequenceIndex>();
+  }
+
+  const IndexHeader *header = reinterpret_cast<const IndexHeader *>(index->data);
+  if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 || header->version != INDEX_VERSION ||
+      header->file_size != index->size) {
+    return shared_ptr<SequenceIndex>();
+  }
+  index->frames = header->num_frames;
+  index->poses_count = header->num_poses;
+  index->poses = reinterpret_cast<const float *>(index->data + header->poses_offset);
+  index->path_offsets = reinterpret_cast<const uint32_t *>(index->data + header->path_offsets_offset);
+  index->path_data = index->data + header->path_data_offset;
+  return index;
+}
+
+/*
+ * Rewrites the stamps of the sources in the header of index_file. Best effort:
+ * if it fails, the sources are just hashed again the next time.
+ */
+void SequenceIndex::update_stamps(const string &index_file, const SourceStamp &paths_stamp,
+                                  const SourceStamp &poses_stamp) {
+  int fd = ::open(index_file.c_str(), O_WRONLY);
+  if (fd < 0) {
+    return;
+  }
+  SourceStamp stamps[2] = {paths_stamp, poses_stamp};
+  if (pwrite(fd, stamps, sizeof(stamps), offsetof(IndexHeader, paths_stamp)) != (ssize_t)sizeof(stamps)) {
+    cerr << "Could not update the index " << index_file << endl;
+  }
+  ::close(fd);
+}
+
+void SequenceIndex::build(const string &paths_file, const string &poses_file, const string &index_file,
+                          uint64_t checksum, const SourceStamp &paths_stamp, const SourceStamp &poses_stamp) {
+  // Same tokenization as reading the files with ifstream >>
+  istringstream paths_text(read_file(paths_file));
+  vector<uint32_t> path_offsets(1, 0);
+  string path_data, path;
+  while (paths_text >> path) {
+    path_data += path;
+    path_offsets.push_back(path_data.size());
+  }
+
+  string poses_text = read_file(poses_file);
+  vector<float> poses;
+  const char *p = poses_text.c_str();
+  while (true) {
+    float m[12];
+    int read = 0;
+    for (; read < 12; ++read) {
+      char *end;
+      m[read] = strtof(p, &end);
+      if (end == p) {
+        break;
+      }
+      p = end;
+    }
+    if (read < 12) {
+      break;
+    }
+    poses.insert(poses.end(), m, m + 12);
+  }
+
+  IndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+  header.version = INDEX_VERSION;
+  header.num_frames = path_offsets.size() - 1;
+  header.num_poses = poses.size() / 12;
+  header.source_checksum = checksum;
+  header.paths_stamp = paths_stamp;
+  header.poses_stamp = poses_stamp;
+  header.poses_offset = sizeof(IndexHeader);
+  header.path_offsets_offset = header.poses_offset + poses.size() * sizeof(float);
+  header.path_data_offset = header.path_offsets_offset + path_offsets.size() * sizeof(uint32_t);
+  header.file_size = header.path_data_offset + path_data.size();
+
+  // Write to a temporary file and rename it, so a crash never leaves a half-written index
+  string tmp_file = index_file + ".tmp";
+  ofstream out(tmp_file.c_str(), ios::out | ios::binary | ios::trunc);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(poses.data()), poses.size() * sizeof(float));
+  out.write(reinterpret_cast<const char *>(path_offsets.data()), path_offsets.size() * sizeof(uint32_t));
+  out.write(path_data.data(), path_data.size());
+  out.close();
+  if (!out || rename(tmp_file.c_str(), index_file.c_str()) != 0) {
+    throw runtime_error("Could not write the index " + index_file);
+  }
+}
+
+vector<shared_ptr<SequenceIndex>> open_sequence_indices(const vector<string> &paths_files,
+                                                        const vector<string> &poses_files, const string &index_dir,
+                                                        unsigned int num_threads) {
+  mkdir(index_dir.c_str(), 0744);
+  OrderedPipeline<shared_ptr<SequenceIndex>> pipeline(
+      paths_files.size(),
+      [&](size_t i) {
+        string name = paths_files[i].substr(paths_files[i].find_last_of('/') + 1);
+        name = name.substr(0, name.find_last_of('.')) + ".idx";
+        return SequenceIndex::open(paths_files[i], poses_files[i], index_dir + "/" + name);
+      },
+      num_threads, paths_files.size());
+  vector<shared_ptr<SequenceIndex>> indices;
+  shared_ptr<SequenceIndex> index;
+  while (pipeline.next(&index)) {
+    indices.push_back(index);
+  }
+  return indices;
+}
@@ -0,0 +1,73 @@
+#ifndef _SEQUENCE_INDEX_
+#define _SEQUENCE_INDEX_
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Compiled binary index of a KITTI sequence: the table of frame paths
+ * (paths/NN.txt) and the 3x4 pose of every frame (poses/NN.txt).
+ *
+ * Parsing the text files float by float is slow, so the first time a sequence
+ * is used its index is written to index_dir/NN.idx and later runs just mmap
+ * it. The index stores the size and modification time of both text files,
+ * and a checksum of their contents: they are only read again when the size or
+ * the time of any of them changes, and the index is rebuilt if the contents
+ * changed too.
+ *
+ * Layout of the file (host byte order):
+ *   IndexHeader
+ *   float poses[num_poses][12]           (row-major 3x4 matrices)
+ *   uint32_t path_offsets[num_frames + 1]
+ *   char path_data[]                      (paths, not null-terminated)
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+
+/* Size and modification time of a source file, a cheap check of whether it changed */
+typedef struct {
+  uint64_t size;
+  uint64_t mtime_ns;
+} SourceStamp;
+
+class SequenceIndex {
+public:
+  ~SequenceIndex();
+
+  /* Maps index_file, (re)building it first if it is missing or out of date */
+  static shared_ptr<SequenceIndex> open(const string &paths_file, const string &poses_file, const string &index_file);
+
+  size_t num_frames() const { return frames; }
+  size_t num_poses() const { return poses_count; }
+  string path(size_t i) const;
+  // 12 floats, row-major 3x4 transform matrix
+  const float *pose(size_t i) const { return poses + 12 * i; }
+
+private:
+  SequenceIndex() : data(NULL), size(0), frames(0), poses_count(0), poses(NULL), path_offsets(NULL), path_data(NULL) {}
+
+  const char *data;
+  size_t size;
+  uint32_t frames;
+  uint32_t poses_count;
+  const float *poses;
+  const uint32_t *path_offsets;
+  const char *path_data;
+
+  static shared_ptr<SequenceIndex> map_file(const string &index_file);
+  static void update_stamps(const string &index_file, const SourceStamp &paths_stamp, const SourceStamp &poses_stamp);
+  static void build(const string &paths_file, const string &poses_file, const string &index_file, uint64_t checksum,
+                    const SourceStamp &paths_stamp, const SourceStamp &poses_stamp);
+};
+
+/*
+ * Opens (building them if needed) the indices of several sequences in parallel.
+ * index_dir is created if it does not exist.
+ */
+vector<shared_ptr<SequenceIndex>> open_sequence_indices(const vector<string> &paths_files,
+                                                        const vector<string> &poses_files, const string &index_dir,
+                                                        unsigned int num_threads);
+#endif
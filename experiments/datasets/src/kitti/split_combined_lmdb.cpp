@@ -0,0 +1,63 @@
+/*
+ * Converts a KITTI egomotion LMDB created with --layout=combined (labels in
+ * the float_data field of each data record) to the usual two LMDBs layout:
+ * one with the pairs of images and one with the vectors of labels, both with
+ * the same keys. The records are the same (byte by byte) as the ones that
+ * preprocess_kitti_siamese writes without --layout=combined.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+#include "lmdb_creator.hpp"
+#include "lmdb_reader.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+void split_combined_lmdb(const string &combined_path, const string &lmdb_path) {
+  LMDataBaseReader reader(combined_path);
+  cout << "Reading " << reader.size() << " records from " << combined_path << endl;
+
+  LMDataBase *data_lmdb = NULL;
+  LMDataBase *labels_lmdb = NULL;
+  MDB_val key, value;
+  Datum datum;
+  string serialized;
+  vector<Label> labels;
+  while (reader.next(&key, &value)) {
+    if (!datum.ParseFromArray(value.mv_data, value.mv_size)) {
+      throw runtime_error("Corrupted record " + string(static_cast<char *>(key.mv_data), key.mv_size));
+    }
+    // The databases are created with the shape of the first record
+    if (data_lmdb == NULL) {
+      data_lmdb = new LMDataBase(lmdb_path, datum.channels(), datum.height());
+      labels_lmdb = new LMDataBase(lmdb_path + "_labels", datum.float_data_size(), 1);
+    }
+    unsigned int k = lmdb_key_to_uint(key);
+
+    labels.resize(datum.float_data_size());
+    for (int i = 0; i < datum.float_data_size(); ++i) {
+      labels[i] = datum.float_data(i);
+    }
+    labels_lmdb->insert2db(labels, k);
+
+    datum.clear_float_data();
+    datum.SerializeToString(&serialized);
+    data_lmdb->insert2db(serialized, k);
+  }
+  delete data_lmdb;
+  delete labels_lmdb;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    cout << "You must provide the path of a LMDB created with --layout=combined and\n"
+         << "the path of the new data LMDB (the labels go to the same path + '_labels')\n\n"
+         << argv[0] << " path/to/kitti_train_egomotion_lmdb path/to/new/kitti_train_egomotion_lmdb\n\n";
+    return 1;
+  }
+  split_combined_lmdb(argv[1], argv[2]);
+  return 0;
+}
@@ -0,0 +1,203 @@
+#include "batch_reader.hpp"
+#include "datum_codec.hpp"
+#include "lmdb_creator.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+BatchReader::BatchReader(const string &data_path, const string &labels_path, const BatchReaderOptions &options)
+    : options(options), data_reader(data_path), num_records(0), datum_channels(0), datum_height(0), datum_width(0),
+      label_count(0), labels_in_data(false) {
+  if (options.batch_size == 0) {
+    throw runtime_error("A BatchReader needs batches of at least one record");
+  }
+  if (!labels_path.empty()) {
+    labels_reader.reset(new LMDataBaseReader(labels_path));
+  }
+  index_keys();
+
+  // The shape of every record is the one of the first record
+  MDB_val key, value;
+  Datum datum;
+  data_reader.rewind();
+  data_reader.next(&key, &value);
+  if (!datum.ParseFromArray(value.mv_data, value.mv_size) || datum.channels() * datum.height() * datum.width() == 0) {
+    throw runtime_error("The records of " + data_path + " are not Datums with their shape");
+  }
+  datum_channels = datum.channels();
+  datum_height = datum.height();
+  datum_width = datum.width();
+  if (labels_reader) {
+    labels_reader->rewind();
+    labels_reader->next(&key, &value);
+    if (!datum.ParseFromArray(value.mv_data, value.mv_size)) {
+      throw runtime_error("The records of " + labels_path + " are not Datums");
+    }
+    label_count = (datum.float_data_size() > 0) ? datum.float_data_size() : datum.channels();
+  } else if (datum.float_data_size() > 0) {
+    labels_in_data = true;
+    label_count = datum.float_data_size();
+  }
+
+  size_t pixels = (size_t)datum_channels * datum_height * datum_width;
+  if (!options.mean_file.empty()) {
+    BlobProto blob;
+    if (!ReadProtoFromBinaryFile(options.mean_file.c_str(), &blob) || (size_t)blob.data_size() != pixels) {
+      throw runtime_error("The mean in " + options.mean_file + " is not one of " + to_string(datum_channels) + "x" +
+                          to_string(datum_height) + "x" + to_string(datum_width) + " images");
+    }
+    mean.assign(blob.data().begin(), blob.data().end());
+  }
+
+  // A buffer for every batch that can be alive at the same time: the ones
+  // waiting in the pipeline, the ones being filled and the consumer's
+  size_t num_buffers = options.prefetch + options.num_threads + 2;
+  pool.reset(new ImagePool(options.batch_size * pixels * sizeof(float), num_buffers));
+  // The labels and the label_data of every batch
+  labels_pool.reset(new ImagePool(options.batch_size * max(label_count, 1) * sizeof(float), 2 * num_buffers));
+  size_t num_batches = (options.num_batches > 0) ? options.num_batches : numeric_limits<size_t>::max();
+  pipeline.reset(new OrderedPipeline<DatumBatch>(num_batches, [this](size_t b) { return make_batch(b); },
+                                                 options.num_threads, options.prefetch));
+}
+
+BatchReader::~BatchReader() {
+  // The workers use everything else
+  pipeline.reset();
+}
+
+bool BatchReader::next(DatumBatch *batch) { return pipeline->next(batch); }
+
+/*
+ * Keeps the key of every batch_size-th record, where the workers start
+ * reading. Only the keys are read, not the records.
+ */
+void BatchReader::index_keys() {
+  MDB_val key, value;
+  data_reader.rewind();
+  for (num_records = 0; data_reader.next(&key, &value); ++num_records) {
+    string key_str(static_cast<const char *>(key.mv_data), key.mv_size);
+    if (key_str == CHECKPOINT_KEY) {
+      throw runtime_error("The database is from an unfinished build (it has a checkpoint), resume it first");
+    }
+    if (num_records % options.batch_size == 0) {
+      batch_keys.push_back(key_str);
+    }
+  }
+  if (num_records == 0) {
+    throw runtime_error("The database is empty");
+  }
+  if (labels_reader && labels_reader->size() != num_records) {
+    throw runtime_error("The data and labels databases have a different number of records (" +
+                        to_string(num_records) + " and " + to_string(labels_reader->size()) + ")");
+  }
+}
+
+/* Runs in the worker threads */
+DatumBatch BatchReader::make_batch(size_t b) {
+  DatumBatch batch;
+  batch.index = b;
+  batch.size = options.batch_size;
+  batch.channels = datum_channels;
+  batch.height = datum_height;
+  batch.width = datum_width;
+  size_t pixels = (size_t)datum_channels * datum_height * datum_width;
+  batch.data = pool->create(batch.size, pixels, CV_32F);
+  batch.labels = labels_pool->create(batch.size, 1, CV_32S);
+  if (label_count > 0) {
+    batch.label_data = labels_pool->create(batch.size, label_count, CV_32F);
+  }
+  if (options.split_pairs && datum_channels % 2 == 0) {
+    // Views: same buffer, every row is the pair and each view takes half of it
+    int half = pixels / 2;
+    batch.first = batch.data(Rect(0, 0, half, batch.size));
+    batch.second = batch.data(Rect(half, 0, half, batch.size));
+  }
+
+  // Every worker reads its batch with its own cursors, from the closest indexed key
+  size_t position = (b % num_records) * batch.size % num_records; // b * batch_size, without overflows
+  unique_ptr<LMDataBaseRangeReader> data_range(
+      new LMDataBaseRangeReader(data_reader, batch_keys[position / batch.size], ""));
+  unique_ptr<LMDataBaseRangeReader> labels_range;
+  if (labels_reader) {
+    labels_range.reset(new LMDataBaseRangeReader(*labels_reader, batch_keys[position / batch.size], ""));
+  }
+  MDB_val key, value, label_key, label_value;
+  for (size_t skip = position % batch.size; skip > 0; --skip) {
+    data_range->next(&key, &value);
+    if (labels_range) {
+      labels_range->next(&label_key, &label_value);
+    }
+  }
+
+  Datum datum;
+  Datum label_datum;
+  vector<char> decoded;
+  for (size_t i = 0; i < batch.size; ++i) {
+    if (!data_range->next(&key, &value)) {
+      // After the last record, the first one again
+      data_range.reset(new LMDataBaseRangeReader(data_reader, "", ""));
+      data_range->next(&key, &value);
+      if (labels_range) {
+        labels_range.reset(new LMDataBaseRangeReader(*labels_reader, "", ""));
+      }
+    }
+    string key_str(static_cast<const char *>(key.mv_data), key.mv_size);
+    if (!datum.ParseFromArray(value.mv_data, value.mv_size)) {
+      throw runtime_error("The record " + key_str + " is not a Datum");
+    }
+    if (datum.channels() != datum_channels || datum.height() != datum_height || datum.width() != datum_width) {
+      throw runtime_error("The record " + key_str + " is not a " + to_string(datum_channels) + "x" +
+                          to_string(datum_height) + "x" + to_string(datum_width) + " image");
+    }
+    const unsigned char *src = reinterpret_cast<const unsigned char *>(datum.data().data());
+    if (datum.encoded() || datum.data().size() != pixels) {
+      decoded.resize(pixels);
+      decode_datum_data(datum.data().data(), datum.data().size(), datum.encoded(), datum_channels, datum_height,
+                        datum_width, &decoded[0]);
+      src = reinterpret_cast<const unsigned char *>(&decoded[0]);
+    }
+    float *dst = batch.data.ptr<float>(i);
+    float scale = options.scale;
+    if (mean.empty()) {
+      for (size_t p = 0; p < pixels; ++p) {
+        dst[p] = src[p] * scale;
+      }
+    } else {
+      const float *m = &mean[0];
+      for (size_t p = 0; p < pixels; ++p) {
+        dst[p] = (src[p] - m[p]) * scale;
+      }
+    }
+    batch.labels.ptr<int>(i)[0] = datum.label();
+
+    if (labels_in_data) {
+      if (datum.float_data_size() != label_count) {
+        throw runtime_error("The record " + key_str + " does not have " + to_string(label_count) + " labels");
+      }
+      copy(datum.float_data().begin(), datum.float_data().end(), batch.label_data.ptr<float>(i));
+    } else if (labels_range) {
+      if (!labels_range->next(&label_key, &label_value) || label_key.mv_size != key.mv_size ||
+          memcmp(label_key.mv_data, key.mv_data, key.mv_size) != 0) {
+        throw runtime_error("The labels database does not have the key " + key_str + " where the data has it");
+      }
+      if (!label_datum.ParseFromArray(label_value.mv_data, label_value.mv_size)) {
+        throw runtime_error("The labels of " + key_str + " are not a Datum");
+      }
+      float *dst = batch.label_data.ptr<float>(i);
+      if (label_datum.float_data_size() == label_count) {
+        copy(label_datum.float_data().begin(), label_datum.float_data().end(), dst);
+      } else if (label_datum.data().size() == (size_t)label_count) {
+        for (int l = 0; l < label_count; ++l) {
+          dst[l] = static_cast<unsigned char>(label_datum.data()[l]);
+        }
+      } else {
+        throw runtime_error("The record " + key_str + " of the labels database does not have " +
+                            to_string(label_count) + " labels");
+      }
+    }
+  }
+  return batch;
+}
@@ -0,0 +1,122 @@
+#ifndef _BATCH_READER_
+#define _BATCH_READER_
+#include "image_pool.hpp"
+#include "lmdb_reader.hpp"
+#include "ordered_pipeline.hpp"
+#include "opencv2/core/core.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Reads the databases written by LMDataBase in batches, for training from
+ * C++ instead of Caffe's Data layers.
+ *
+ * The Data layers of the experiment_*.py scripts read the data LMDB and the
+ * labels LMDB with two cursors and parse every Datum in the training thread. A
+ * BatchReader walks both databases in lockstep (their keys must be the same)
+ * in a pool of background threads: each batch is parsed, decoded (encoded
+ * Datums too, see datum_codec.hpp) and converted to floats, with the mean
+ * subtracted, ahead of the consumer. The batches come back in the order of
+ * the keys and, like in Caffe, the reader starts again from the first record
+ * after the last one (a batch can have the end of an epoch and the beginning
+ * of the next one).
+ *
+ * The pixels of a batch are a single NCHW buffer of floats, (pixel - mean) *
+ * scale like Caffe's transform_param. The pixels and the labels come from
+ * ImagePools of the reader, with room for prefetch + num_threads + 2 batches:
+ * as long as the consumer keeps at most 2 batches alive, the same buffers are
+ * used over and over (the pixel buffers can be pinned once, e.g. with
+ * cudaHostRegister) and nothing is allocated per batch. A consumer that keeps
+ * more batches makes the pools allocate new buffers. With split_pairs the two
+ * images of the pairs (6 or 2 channels) are also available as two views of
+ * that buffer, like a Slice layer, without copying them.
+ *
+ * Usage:
+ *   BatchReaderOptions options;
+ *   options.batch_size = 128;
+ *   options.mean_file = "mean.binaryproto";
+ *   BatchReader reader("kitti_train_egomotion_lmdb", "kitti_train_egomotion_lmdb_labels", options);
+ *   DatumBatch batch;
+ *   while (reader.next(&batch)) { ... batch.data / batch.first / batch.second / batch.label_data ... }
+ *
+ * Every batch must be released before the reader is destroyed.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+using namespace cv;
+
+struct BatchReaderOptions {
+  size_t batch_size;
+  uint64_t num_batches; // 0: never stop
+  unsigned int num_threads;
+  size_t prefetch; // batches ready ahead of the consumer
+  // binaryproto (like compute_image_mean's or LMDataBaseOptions::mean_file) subtracted from every image
+  string mean_file;
+  float scale;
+  // Also give the two images of every pair as views (DatumBatch::first and second)
+  bool split_pairs;
+
+  BatchReaderOptions()
+      : batch_size(64), num_batches(0), num_threads(2), prefetch(4), scale(1), split_pairs(false) {}
+};
+
+typedef struct {
+  uint64_t index; // of the batch since the reader was created
+  size_t size;
+  int channels;
+  int height;
+  int width;
+  // size x (channels * height * width) floats: the records in NCHW order
+  Mat data;
+  // With split_pairs, size x (channels / 2 * height * width) views of data: the first and the second image
+  Mat first;
+  Mat second;
+  Mat labels; // size x 1 ints: the label of every Datum (the SFA label of the pairs)
+  // size x num_labels floats: the labels LMDB, or the float_data of the records (combined layout)
+  Mat label_data;
+} DatumBatch;
+
+class BatchReader {
+public:
+  /*
+   * labels_path can be empty: no labels LMDB. Throws runtime_error if a
+   * database can not be opened, if they have a different number of records,
+   * or if the records do not have their shape.
+   */
+  BatchReader(const string &data_path, const string &labels_path, const BatchReaderOptions &options);
+  ~BatchReader();
+
+  // Blocks until the next batch is ready. Returns false after num_batches
+  bool next(DatumBatch *batch);
+
+  size_t size() const { return num_records; }
+  int channels() const { return datum_channels; }
+  int height() const { return datum_height; }
+  int width() const { return datum_width; }
+  int num_labels() const { return label_count; }
+
+private:
+  BatchReaderOptions options;
+  LMDataBaseReader data_reader;
+  unique_ptr<LMDataBaseReader> labels_reader;
+  size_t num_records;
+  int datum_channels;
+  int datum_height;
+  int datum_width;
+  int label_count;
+  bool labels_in_data; // combined layout: the labels are the float_data of the records
+  vector<string> batch_keys; // key of the records 0, batch_size, 2 * batch_size, ...
+  vector<float> mean;
+  unique_ptr<ImagePool> pool;
+  unique_ptr<ImagePool> labels_pool;
+  // After the pool: the batches in the pipeline go back to the pool when it is destroyed
+  unique_ptr<OrderedPipeline<DatumBatch>> pipeline;
+
+  void index_keys();
+  DatumBatch make_batch(size_t b);
+};
+#endif
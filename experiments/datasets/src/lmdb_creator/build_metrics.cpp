@@ -0,0 +1,138 @@
+#include "build_metrics.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sys/resource.h>
+
+static const char *STAGE_NAMES[NUM_BUILD_STAGES] = {"load", "decode", "transform", "serialize", "put", "commit"};
+
+const char *build_stage_name(BuildStage stage) { return STAGE_NAMES[stage]; }
+
+BuildMetrics::BuildMetrics() : bytes_written(0), records(0), start(chrono::steady_clock::now()) {
+  for (int s = 0; s < NUM_BUILD_STAGES; ++s) {
+    stages[s].count = 0;
+    stages[s].total_ns = 0;
+    stages[s].max_ns = 0;
+    for (int b = 0; b < NUM_LATENCY_BUCKETS; ++b) {
+      stages[s].buckets[b] = 0;
+    }
+  }
+}
+
+void BuildMetrics::record(BuildStage stage, uint64_t ns) {
+  StageCounters &s = stages[stage];
+  s.count.fetch_add(1, memory_order_relaxed);
+  s.total_ns.fetch_add(ns, memory_order_relaxed);
+  uint64_t max_ns = s.max_ns.load(memory_order_relaxed);
+  while (ns > max_ns && !s.max_ns.compare_exchange_weak(max_ns, ns, memory_order_relaxed)) {
+  }
+  int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+  s.buckets[min(bucket, NUM_LATENCY_BUCKETS - 1)].fetch_add(1, memory_order_relaxed);
+}
+
+double BuildMetrics::percentile_us(const StageCounters &s, double q) const {
+  uint64_t count = s.count.load(memory_order_relaxed);
+  uint64_t seen = 0;
+  for (int b = 0; b < NUM_LATENCY_BUCKETS; ++b) {
+    seen += s.buckets[b].load(memory_order_relaxed);
+    if (seen > 0 && seen >= q * count) {
+      return min(1ULL << b, (unsigned long long)s.max_ns.load(memory_order_relaxed)) / 1000.0;
+    }
+  }
+  return s.max_ns.load(memory_order_relaxed) / 1000.0;
+}
+
+void BuildMetrics::print_summary(ostream &out) const {
+  chrono::duration<double> wall = chrono::steady_clock::now() - start;
+  uint64_t num_records = records.load(memory_order_relaxed);
+  out << "Build metrics: " << num_records << " records in " << fixed << setprecision(1) << wall.count() << " s ("
+      << num_records / max(wall.count(), 1e-9) << " records/s), " << (bytes_written.load(memory_order_relaxed) >> 20)
+      << " MB written, peak RSS " << (peak_rss_bytes() >> 20) << " MB\n";
+  for (int i = 0; i < NUM_BUILD_STAGES; ++i) {
+    const StageCounters &s = stages[i];
+    uint64_t count = s.count.load(memory_order_relaxed);
+    if (count == 0) {
+      continue;
+    }
+    double total = s.total_ns.load(memory_order_relaxed) / 1e9;
+    out << "  " << left << setw(10) << STAGE_NAMES[i] << right << setw(12) << count << " ops" << setw(10)
+        << setprecision(2) << total << " s" << setw(12) << setprecision(1) << 1e6 * total / count << " us/op"
+        << "  p99 <= " << setprecision(1) << percentile_us(s, 0.99) << " us\n";
+  }
+  out.unsetf(ios::floatfield);
+  out << flush;
+}
+
+void BuildMetrics::write_json(ostream &out, const string &tool) const {
+  chrono::duration<double> wall = chrono::steady_clock::now() - start;
+  uint64_t num_records = records.load(memory_order_relaxed);
+  out << "{\n"
+      << "  \"tool\": \"" << tool << "\",\n"
+      << "  \"wall_seconds\": " << fixed << setprecision(3) << wall.count() << ",\n"
+      << "  \"records\": " << num_records << ",\n"
+      << "  \"records_per_sec\": " << setprecision(1) << num_records / max(wall.count(), 1e-9) << ",\n"
+      << "  \"bytes_written\": " << bytes_written.load(memory_order_relaxed) << ",\n"
+      << "  \"peak_rss_bytes\": " << peak_rss_bytes() << ",\n"
+      << "  \"stages\": {";
+  for (int i = 0; i < NUM_BUILD_STAGES; ++i) {
+    const StageCounters &s = stages[i];
+    uint64_t count = s.count.load(memory_order_relaxed);
+    uint64_t total_ns = s.total_ns.load(memory_order_relaxed);
+    out << (i ? "," : "") << "\n    \"" << STAGE_NAMES[i] << "\": {\"count\": " << count << ", \"total_seconds\": "
+        << setprecision(6) << total_ns / 1e9 << ", \"mean_us\": " << setprecision(3)
+        << (count ? total_ns / 1e3 / count : 0.0) << ", \"max_us\": " << s.max_ns.load(memory_order_relaxed) / 1e3
+        << ", \"p50_us\": " << percentile_us(s, 0.5) << ", \"p90_us\": " << percentile_us(s, 0.9)
+        << ", \"p99_us\": " << percentile_us(s, 0.99) << ",\n      \"histogram_log2_ns\": [";
+    // Without the empty buckets at the end
+    int last = NUM_LATENCY_BUCKETS - 1;
+    while (last > 0 && s.buckets[last].load(memory_order_relaxed) == 0) {
+      --last;
+    }
+    for (int b = 0; b <= last; ++b) {
+      out << (b ? ", " : "") << s.buckets[b].load(memory_order_relaxed);
+    }
+    out << "]}";
+  }
+  out << "\n  }\n}\n";
+  out.unsetf(ios::floatfield);
+}
+
+BuildMetrics &build_metrics() {
+  static BuildMetrics metrics;
+  return metrics;
+}
+
+size_t peak_rss_bytes() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return (size_t)usage.ru_maxrss * 1024; // kilobytes on Linux
+}
+
+bool write_build_metrics(const string &path, const string &tool) {
+  if (path == "-") {
+    build_metrics().write_json(cout, tool);
+    return true;
+  }
+  ofstream out(path.c_str());
+  if (!out) {
+    return false;
+  }
+  build_metrics().write_json(out, tool);
+  return out.good();
+}
+
+ProgressReporter::ProgressReporter(double interval_seconds)
+    : interval(chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(interval_seconds))),
+      start(chrono::steady_clock::now()), last(start) {}
+
+void ProgressReporter::update(unsigned long done) {
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  if (now - last < interval) {
+    return;
+  }
+  last = now;
+  chrono::duration<double> elapsed = now - start;
+  cout << "Processed " << done << " (" << (unsigned long)(done / elapsed.count()) << "/s)   \r" << flush;
+}
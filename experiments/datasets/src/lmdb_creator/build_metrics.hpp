@@ -0,0 +1,109 @@
+#ifndef _BUILD_METRICS_
+#define _BUILD_METRICS_
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+/*
+ * Counters of where the time of a database build goes.
+ *
+ * Every stage of the tools (reading files, decoding images, warping or
+ * cropping them, serializing the Datums, the LMDB puts and commits) records
+ * the latency of each of its operations with a StageTimer. A stage keeps the
+ * number of operations, the total and maximum time and a histogram of
+ * power-of-two buckets (bucket i counts latencies in [2^(i-1), 2^i) ns), all
+ * in relaxed atomics so any thread can record without locks. The counters of
+ * the process are build_metrics(); LMDataBase and FrameStoreWriter record
+ * their puts, commits, bytes and records there by themselves.
+ *
+ * At the end the tools print a summary and write it as JSON (see
+ * write_json()), together with the wall time and the peak RSS of the process.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+
+#define NUM_LATENCY_BUCKETS 40 // up to 2^39 ns (~9 minutes)
+
+enum BuildStage {
+  STAGE_LOAD = 0,  // reading source files
+  STAGE_DECODE,    // decoding images (PNG, JPEG...)
+  STAGE_TRANSFORM, // warps and crops
+  STAGE_SERIALIZE, // Datums (CHW pixels or encoded payloads)
+  STAGE_PUT,       // mdb_put
+  STAGE_COMMIT,    // mdb_txn_commit
+  NUM_BUILD_STAGES
+};
+
+const char *build_stage_name(BuildStage stage);
+
+class BuildMetrics {
+public:
+  BuildMetrics();
+
+  void record(BuildStage stage, uint64_t ns);
+  void add_bytes_written(uint64_t bytes) { bytes_written.fetch_add(bytes, memory_order_relaxed); }
+  void add_records(uint64_t n) { records.fetch_add(n, memory_order_relaxed); }
+
+  // One line per stage with operations, total time and mean and 99th percentile latency
+  void print_summary(ostream &out) const;
+  void write_json(ostream &out, const string &tool) const;
+
+private:
+  struct alignas(64) StageCounters {
+    atomic<uint64_t> count;
+    atomic<uint64_t> total_ns;
+    atomic<uint64_t> max_ns;
+    atomic<uint64_t> buckets[NUM_LATENCY_BUCKETS];
+  };
+
+  StageCounters stages[NUM_BUILD_STAGES];
+  alignas(64) atomic<uint64_t> bytes_written;
+  atomic<uint64_t> records;
+  chrono::steady_clock::time_point start;
+
+  // Bound of the latency of q of the operations of a stage (the top of their bucket, at most the maximum)
+  double percentile_us(const StageCounters &s, double q) const;
+};
+
+// The metrics of this process
+BuildMetrics &build_metrics();
+
+// Maximum resident set size of the process so far
+size_t peak_rss_bytes();
+
+// Writes the JSON of build_metrics() to path ("-" is stdout). Returns false if path can not be written
+bool write_build_metrics(const string &path, const string &tool);
+
+/* Records the time between its construction and its destruction in a stage */
+class StageTimer {
+public:
+  explicit StageTimer(BuildStage stage) : stage(stage), start(chrono::steady_clock::now()) {}
+  ~StageTimer() {
+    chrono::steady_clock::duration elapsed = chrono::steady_clock::now() - start;
+    build_metrics().record(stage, chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+  }
+
+private:
+  BuildStage stage;
+  chrono::steady_clock::time_point start;
+};
+
+/*
+ * "Processed N records" on a single line, at most once per interval instead
+ * of once per record
+ */
+class ProgressReporter {
+public:
+  explicit ProgressReporter(double interval_seconds = 1.0);
+  void update(unsigned long done);
+
+private:
+  chrono::steady_clock::duration interval;
+  chrono::steady_clock::time_point start;
+  chrono::steady_clock::time_point last;
+};
+#endif
@@ -0,0 +1,149 @@
+#include "chw_kernels.hpp"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+void hwc_to_planes_scalar(const unsigned char *src, size_t num_pixels, int channels, char *dst,
+                          size_t plane_stride) {
+  if (channels == 1) {
+    memcpy(dst, src, num_pixels);
+    return;
+  }
+  for (int c = 0; c < channels; ++c) {
+    char *plane = dst + c * plane_stride;
+    const unsigned char *p = src + c;
+    for (size_t i = 0; i < num_pixels; ++i, p += channels) {
+      plane[i] = static_cast<char>(*p);
+    }
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * pshufb masks to gather one channel of 16 BGR pixels (48 bytes, loaded in
+ * three registers a, b, c). Each channel is the OR of the three shuffles;
+ * -1 zeroes the byte.
+ */
+#define X -1
+static const char MASKS_3C[3][3][16] = {
+    // channel 0: a[0,3,..,15] b[2,5,..,14] c[1,4,..,13]
+    {{0, 3, 6, 9, 12, 15, X, X, X, X, X, X, X, X, X, X},
+     {X, X, X, X, X, X, 2, 5, 8, 11, 14, X, X, X, X, X},
+     {X, X, X, X, X, X, X, X, X, X, X, 1, 4, 7, 10, 13}},
+    // channel 1: a[1,4,..,13] b[0,3,..,15] c[2,5,..,14]
+    {{1, 4, 7, 10, 13, X, X, X, X, X, X, X, X, X, X, X},
+     {X, X, X, X, X, 0, 3, 6, 9, 12, 15, X, X, X, X, X},
+     {X, X, X, X, X, X, X, X, X, X, X, 2, 5, 8, 11, 14}},
+    // channel 2: a[2,5,..,14] b[1,4,..,13] c[0,3,..,15]
+    {{2, 5, 8, 11, 14, X, X, X, X, X, X, X, X, X, X, X},
+     {X, X, X, X, X, 1, 4, 7, 10, 13, X, X, X, X, X, X},
+     {X, X, X, X, X, X, X, X, X, X, 0, 3, 6, 9, 12, 15}}};
+#undef X
+
+__attribute__((target("ssse3"))) static void hwc3_to_planes_ssse3(const unsigned char *src, size_t num_pixels,
+                                                                   char *dst, size_t plane_stride) {
+  __m128i masks[3][3];
+  for (int c = 0; c < 3; ++c) {
+    for (int r = 0; r < 3; ++r) {
+      masks[c][r] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(MASKS_3C[c][r]));
+    }
+  }
+  size_t i = 0;
+  for (; i + 16 <= num_pixels; i += 16, src += 48) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+    for (int ch = 0; ch < 3; ++ch) {
+      __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, masks[ch][0]), _mm_shuffle_epi8(b, masks[ch][1])),
+                               _mm_shuffle_epi8(c, masks[ch][2]));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + ch * plane_stride + i), v);
+    }
+  }
+  hwc_to_planes_scalar(src, num_pixels - i, 3, dst + i, plane_stride);
+}
+
+/*
+ * Same shuffles as the SSSE3 version, but every 128-bit lane holds a different
+ * group of 16 pixels (pshufb does not cross lanes), so 32 pixels are done per
+ * iteration and each channel is written with a single 32-byte store.
+ */
+__attribute__((target("avx2"))) static void hwc3_to_planes_avx2(const unsigned char *src, size_t num_pixels,
+                                                                 char *dst, size_t plane_stride) {
+  __m256i masks[3][3];
+  for (int c = 0; c < 3; ++c) {
+    for (int r = 0; r < 3; ++r) {
+      masks[c][r] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(MASKS_3C[c][r])));
+    }
+  }
+  size_t i = 0;
+  for (; i + 32 <= num_pixels; i += 32, src += 96) {
+    __m256i a = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48)), 1);
+    __m256i b = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 64)), 1);
+    __m256i c = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 80)), 1);
+    for (int ch = 0; ch < 3; ++ch) {
+      __m256i v = _mm256_or_si256(
+          _mm256_or_si256(_mm256_shuffle_epi8(a, masks[ch][0]), _mm256_shuffle_epi8(b, masks[ch][1])),
+          _mm256_shuffle_epi8(c, masks[ch][2]));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + ch * plane_stride + i), v);
+    }
+  }
+  hwc3_to_planes_ssse3(src, num_pixels - i, dst + i, plane_stride);
+}
+#endif
+
+typedef void (*Hwc3Kernel)(const unsigned char *, size_t, char *, size_t);
+
+static void hwc3_to_planes_scalar(const unsigned char *src, size_t num_pixels, char *dst, size_t plane_stride) {
+  hwc_to_planes_scalar(src, num_pixels, 3, dst, plane_stride);
+}
+
+static const char *select_isa() {
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return "ssse3";
+  }
+#endif
+  return "scalar";
+}
+
+const char *hwc_to_planes_isa() {
+  static const char *isa = select_isa();
+  return isa;
+}
+
+static Hwc3Kernel select_hwc3_kernel() {
+#ifdef HAVE_X86_KERNELS
+  const char *isa = hwc_to_planes_isa();
+  if (strcmp(isa, "avx2") == 0) {
+    return hwc3_to_planes_avx2;
+  }
+  if (strcmp(isa, "ssse3") == 0) {
+    return hwc3_to_planes_ssse3;
+  }
+#endif
+  return hwc3_to_planes_scalar;
+}
+
+void hwc_to_planes(const unsigned char *src, size_t num_pixels, int channels, char *dst, size_t plane_stride) {
+  static const Hwc3Kernel hwc3_kernel = select_hwc3_kernel();
+  if (channels == 3) {
+    hwc3_kernel(src, num_pixels, dst, plane_stride);
+  } else {
+    // 1 channel is a plain memcpy (already vectorized by libc)
+    hwc_to_planes_scalar(src, num_pixels, channels, dst, plane_stride);
+  }
+}
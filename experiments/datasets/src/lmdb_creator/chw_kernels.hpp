@@ -0,0 +1,32 @@
+#ifndef _CHW_KERNELS_
+#define _CHW_KERNELS_
+#include <cstddef>
+
+/*
+ * Kernels to deinterleave HWC pixels (OpenCV layout) into CHW planes
+ * (Caffe's Datum layout).
+ *
+ * hwc_to_planes() takes `num_pixels` interleaved pixels of `channels` bytes
+ * each and writes channel c of pixel i in dst[c * plane_stride + i].
+ * A continuous image can be transposed in a single call with
+ * num_pixels = plane_stride = rows * cols.
+ *
+ * Only the 3 channel layout has SIMD kernels (SSSE3 and AVX2), the best one
+ * for the running CPU is picked the first time the function is called. 1
+ * channel is a plain memcpy. Every other layout (and the CPUs without SSSE3)
+ * use the scalar version. There is no 6 channel kernel: Mats2CHW() transposes
+ * the pairs one row at a time, calling the 3 channel kernel on the row of
+ * each image. All versions write exactly the same bytes.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+void hwc_to_planes(const unsigned char *src, size_t num_pixels, int channels, char *dst, size_t plane_stride);
+
+// Always the portable version, regardless of the CPU. Useful to check the others
+void hwc_to_planes_scalar(const unsigned char *src, size_t num_pixels, int channels, char *dst,
+                          size_t plane_stride);
+
+// Name of the kernel set picked for this CPU ("avx2", "ssse3" or "scalar")
+const char *hwc_to_planes_isa();
+#endif
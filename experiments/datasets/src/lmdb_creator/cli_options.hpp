@@ -0,0 +1,59 @@
+#ifndef _CLI_OPTIONS_
+#define _CLI_OPTIONS_
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Minimal command line parser shared by the preprocessing tools.
+ *
+ * Arguments of the form --name=value (or just --name for flags) are options,
+ * everything else is a positional argument, in the order it was given.
+ * argv[0] is not included in the positional arguments.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+class CliOptions {
+public:
+  CliOptions(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg(argv[i]);
+      if (arg.compare(0, 2, "--") == 0) {
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos) {
+          options[arg.substr(2)] = "";
+        } else {
+          options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+        }
+      } else {
+        positional_args.push_back(arg);
+      }
+    }
+  }
+
+  const std::vector<std::string> &positional() const { return positional_args; }
+
+  bool has(const std::string &name) const { return options.count(name) > 0; }
+
+  std::string get(const std::string &name, const std::string &def) const {
+    std::map<std::string, std::string>::const_iterator it = options.find(name);
+    return (it == options.end()) ? def : it->second;
+  }
+
+  long get_int(const std::string &name, long def) const {
+    std::map<std::string, std::string>::const_iterator it = options.find(name);
+    return (it == options.end() || it->second.empty()) ? def : strtol(it->second.c_str(), NULL, 10);
+  }
+
+  double get_float(const std::string &name, double def) const {
+    std::map<std::string, std::string>::const_iterator it = options.find(name);
+    return (it == options.end() || it->second.empty()) ? def : strtod(it->second.c_str(), NULL);
+  }
+
+private:
+  std::vector<std::string> positional_args;
+  std::map<std::string, std::string> options;
+};
+#endif
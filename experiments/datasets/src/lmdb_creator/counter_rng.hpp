@@ -0,0 +1,57 @@
+#ifndef _COUNTER_RNG_
+#define _COUNTER_RNG_
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ * Counter-based random number stream.
+ *
+ * The n-th number of a stream is a pure function of (seed, stream, n): it is
+ * the splitmix64 finalizer applied to a key derived from (seed, stream) plus
+ * the counter n. This makes it possible to give every source image (or every
+ * block of work) its own independent stream, generate them in any order or in
+ * any number of threads, and still get exactly the same numbers as a serial run.
+ * The position of a stream is just its counter, so it can be saved and restored.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+class CounterRNG {
+public:
+  CounterRNG(uint64_t seed, uint64_t stream) : key(mix(mix(seed) ^ (stream * 0xD1B54A32D192ED03ULL))), counter(0) {}
+
+  uint64_t next() { return mix(key + 0x9E3779B97F4A7C15ULL * ++counter); }
+
+  /* Generate a random number between 0 and range_limit-1
+   * Same contract as generate_rand() in the preprocessing tools
+   */
+  unsigned int generate_rand(unsigned int range_limit) { return next() % range_limit; }
+
+  uint64_t position() const { return counter; }
+  void seek(uint64_t pos) { counter = pos; }
+
+private:
+  uint64_t key;
+  uint64_t counter;
+
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+};
+
+/*
+ * Fisher-Yates shuffle driven by a CounterRNG. Unlike std::random_shuffle (which
+ * uses the global rand()) the result only depends on the stream, so it is the
+ * same on every platform and standard library.
+ */
+template <typename T> void shuffle_with(std::vector<T> &v, CounterRNG &rng) {
+  for (size_t i = v.size(); i > 1; --i) {
+    size_t j = rng.next() % i;
+    std::swap(v[i - 1], v[j]);
+  }
+}
+#endif
@@ -0,0 +1,348 @@
+#include "datum_codec.hpp"
+#include "datum_writer.hpp"
+#include "lmdb_creator.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+
+#define LZ4_MAGIC "LZ4C"
+#define LZ4_HEADER_SIZE 8 // magic + raw size
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the last 5 bytes are always literals
+#define LZ4_MF_LIMIT 12     // and the last match starts at least 12 bytes before the end
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_LOG 14
+// Rows of a JPEG MCU with 4:2:0 subsampling: the images of a pair start at a multiple of it
+#define JPEG_MCU_ROWS 16
+
+DatumCodec parse_codec(const string &name) {
+  DatumCodec codec;
+  if (name == "raw") {
+    codec.type = CODEC_RAW;
+  } else if (name == "png") {
+    codec.type = CODEC_PNG;
+  } else if (name == "lz4") {
+    codec.type = CODEC_LZ4;
+  } else if (name == "jpeg" || name.compare(0, 5, "jpeg:") == 0) {
+    codec.type = CODEC_JPEG;
+    if (name.size() > 5) {
+      codec.quality = atoi(name.c_str() + 5);
+    }
+    if (codec.quality < 1 || codec.quality > 100) {
+      throw runtime_error("JPEG quality must be between 1 and 100: " + name);
+    }
+  } else {
+    throw runtime_error("Unknown codec " + name + " (use raw, png, jpeg, jpeg:Q or lz4)");
+  }
+  return codec;
+}
+
+string codec_name(const DatumCodec &codec) {
+  switch (codec.type) {
+  case CODEC_PNG:
+    return "png";
+  case CODEC_JPEG:
+    return "jpeg:" + to_string(codec.quality);
+  case CODEC_LZ4:
+    return "lz4";
+  default:
+    return "raw";
+  }
+}
+
+static void encode_lz4(const Mat &img1, const Mat &img2, size_t raw_size, vector<char> *payload) {
+  vector<char> raw(raw_size);
+  if (img2.empty()) {
+    Mat2CHW(img1, &raw[0]);
+  } else {
+    Mats2CHW(img1, img2, &raw[0]);
+  }
+  payload->resize(LZ4_HEADER_SIZE + lz4_bound(raw_size));
+  memcpy(&(*payload)[0], LZ4_MAGIC, 4);
+  uint32_t size = raw_size;
+  for (int i = 0; i < 4; ++i) {
+    (*payload)[4 + i] = (size >> (8 * i)) & 0xFF;
+  }
+  size_t compressed = lz4_compress(&raw[0], raw_size, &(*payload)[LZ4_HEADER_SIZE]);
+  payload->resize(LZ4_HEADER_SIZE + compressed);
+}
+
+/* Rows of each image of a pair in the encoded image, see encode_image() */
+static int pair_rows(int height, bool jpeg) {
+  return jpeg ? (height + JPEG_MCU_ROWS - 1) / JPEG_MCU_ROWS * JPEG_MCU_ROWS : height;
+}
+
+static void encode_image(const Mat &img1, const Mat &img2, const DatumCodec &codec, vector<char> *payload) {
+  Mat img = img1;
+  if (!img2.empty()) {
+    // JPEG blocks must not have rows of both images, or the DCT mixes them: each
+    // image is padded (with its last row) to a whole number of MCUs
+    int rows = pair_rows(img1.rows, codec.type == CODEC_JPEG);
+    if (rows == img1.rows) {
+      vconcat(img1, img2, img);
+    } else {
+      Mat padded1, padded2;
+      copyMakeBorder(img1, padded1, 0, rows - img1.rows, 0, 0, BORDER_REPLICATE);
+      copyMakeBorder(img2, padded2, 0, rows - img2.rows, 0, 0, BORDER_REPLICATE);
+      vconcat(padded1, padded2, img);
+    }
+  }
+  vector<int> params;
+  string ext = ".png";
+  if (codec.type == CODEC_JPEG) {
+    ext = ".jpg";
+    params.push_back(CV_IMWRITE_JPEG_QUALITY);
+    params.push_back(codec.quality);
+  }
+  vector<uchar> buffer;
+  if (!imencode(ext, img, buffer, params)) {
+    throw runtime_error("Could not encode the image as " + ext);
+  }
+  payload->assign(buffer.begin(), buffer.end());
+}
+
+string encode_datum(const Mat &img1, const Mat &img2, int label, const vector<float> &float_data,
+                    const DatumCodec &codec) {
+  assert(img1.depth() == CV_8U);
+  DatumHeader header;
+  header.channels = img1.channels() + (img2.empty() ? 0 : img2.channels());
+  header.height = img1.rows;
+  header.width = img1.cols;
+  header.has_label = label >= 0;
+  header.label = label;
+  header.float_data = float_data;
+  header.encoded = codec.type != CODEC_RAW;
+  size_t raw_size = header.channels * header.height * header.width;
+
+  vector<char> payload;
+  if (codec.type == CODEC_LZ4) {
+    encode_lz4(img1, img2, raw_size, &payload);
+  } else if (codec.type != CODEC_RAW) {
+    encode_image(img1, img2, codec, &payload);
+  }
+
+  size_t data_size = header.encoded ? payload.size() : raw_size;
+  string serialized(datum_wire_size(header, data_size), '\0');
+  char *data = write_datum_prefix(header, data_size, &serialized[0]);
+  if (header.encoded) {
+    memcpy(data, payload.data(), payload.size());
+  } else if (img2.empty()) {
+    Mat2CHW(img1, data);
+  } else {
+    Mats2CHW(img1, img2, data);
+  }
+  write_datum_suffix(header, data + data_size);
+  return serialized;
+}
+
+void decode_datum_data(const char *data, size_t size, bool encoded, int channels, int height, int width, char *dst) {
+  size_t raw_size = (size_t)channels * height * width;
+  if (!encoded) {
+    if (size != raw_size) {
+      throw runtime_error("The size of the Datum data does not match its shape");
+    }
+    memcpy(dst, data, size);
+    return;
+  }
+
+  if (size >= LZ4_HEADER_SIZE && memcmp(data, LZ4_MAGIC, 4) == 0) {
+    uint32_t stored_size = 0;
+    for (int i = 0; i < 4; ++i) {
+      stored_size |= (uint32_t)(unsigned char)data[4 + i] << (8 * i);
+    }
+    if (stored_size != raw_size ||
+        !lz4_decompress(data + LZ4_HEADER_SIZE, size - LZ4_HEADER_SIZE, dst, raw_size)) {
+      throw runtime_error("Corrupted LZ4 Datum");
+    }
+    return;
+  }
+
+  vector<uchar> buffer(data, data + size);
+  Mat img = imdecode(buffer, CV_LOAD_IMAGE_UNCHANGED);
+  if (img.cols == width && img.rows == height && img.channels() == channels) {
+    Mat2CHW(img, dst);
+  } else if (img.cols == width && img.rows == 2 * height && 2 * img.channels() == channels) {
+    // A pair of images, one below the other
+    Mats2CHW(img(Rect(0, 0, width, height)), img(Rect(0, height, width, height)), dst);
+  } else if (img.cols == width && img.rows == 2 * pair_rows(height, true) && 2 * img.channels() == channels) {
+    // A JPEG pair, every image padded to whole MCUs
+    int rows = pair_rows(height, true);
+    Mats2CHW(img(Rect(0, 0, width, height)), img(Rect(0, rows, width, height)), dst);
+  } else {
+    throw runtime_error("Could not decode the Datum or its shape does not match");
+  }
+}
+
+Mat decode_datum_image(const char *data, size_t size, bool encoded, int channels, int height, int width) {
+  if (encoded && !(size >= LZ4_HEADER_SIZE && memcmp(data, LZ4_MAGIC, 4) == 0)) {
+    vector<uchar> buffer(data, data + size);
+    Mat img = imdecode(buffer, CV_LOAD_IMAGE_UNCHANGED);
+    if (img.empty()) {
+      throw runtime_error("Could not decode the Datum");
+    }
+    return img;
+  }
+  vector<char> chw((size_t)channels * height * width);
+  decode_datum_data(data, size, encoded, channels, height, width, &chw[0]);
+  Mat img(height, width, CV_8UC(channels));
+  size_t plane = (size_t)height * width;
+  for (int h = 0; h < height; ++h) {
+    uchar *row = img.ptr<uchar>(h);
+    for (int w = 0; w < width; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        row[w * channels + c] = chw[c * plane + h * width + w];
+      }
+    }
+  }
+  return img;
+}
+
+size_t lz4_bound(size_t size) { return size + size / 255 + 16; }
+
+static inline uint32_t read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) { return (v * 2654435761U) >> (32 - LZ4_HASH_LOG); }
+
+static inline unsigned char *write_length(unsigned char *op, size_t length) {
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = length;
+  return op;
+}
+
+static inline unsigned char *write_sequence(unsigned char *op, const unsigned char *literals, size_t num_literals,
+                                            size_t offset, size_t match_length, bool last) {
+  unsigned char *token = op++;
+  *token = (num_literals >= 15 ? 15 : num_literals) << 4;
+  if (num_literals >= 15) {
+    op = write_length(op, num_literals - 15);
+  }
+  memcpy(op, literals, num_literals);
+  op += num_literals;
+  if (last) {
+    return op;
+  }
+  *op++ = offset & 0xFF;
+  *op++ = offset >> 8;
+  size_t length = match_length - LZ4_MIN_MATCH;
+  *token |= (length >= 15 ? 15 : length);
+  if (length >= 15) {
+    op = write_length(op, length - 15);
+  }
+  return op;
+}
+
+/* Greedy compressor with a single hash table, like the fast mode of the reference LZ4 */
+size_t lz4_compress(const char *source, size_t size, char *destination) {
+  const unsigned char *src = reinterpret_cast<const unsigned char *>(source);
+  const unsigned char *end = src + size;
+  const unsigned char *anchor = src;
+  unsigned char *op = reinterpret_cast<unsigned char *>(destination);
+
+  if (size > LZ4_MF_LIMIT) {
+    const unsigned char *match_limit = end - LZ4_MF_LIMIT;
+    const unsigned char *extend_limit = end - LZ4_LAST_LITERALS;
+    vector<uint32_t> table(1 << LZ4_HASH_LOG, 0);
+    const unsigned char *ip = src + 1;
+    while (ip < match_limit) {
+      uint32_t h = lz4_hash(read32(ip));
+      const unsigned char *ref = src + table[h];
+      table[h] = ip - src;
+      if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(ref) != read32(ip)) {
+        // Skip faster over data that does not compress
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        --ip;
+        --ref;
+      }
+      const unsigned char *match_end = ip + LZ4_MIN_MATCH;
+      const unsigned char *ref_end = ref + LZ4_MIN_MATCH;
+      while (match_end < extend_limit && *match_end == *ref_end) {
+        ++match_end;
+        ++ref_end;
+      }
+      op = write_sequence(op, anchor, ip - anchor, ip - ref, match_end - ip, false);
+      anchor = ip = match_end;
+      if (ip < match_limit) {
+        table[lz4_hash(read32(ip - 2))] = ip - 2 - src;
+      }
+    }
+  }
+  op = write_sequence(op, anchor, end - anchor, 0, 0, true);
+  return op - reinterpret_cast<unsigned char *>(destination);
+}
+
+bool lz4_decompress(const char *source, size_t size, char *destination, size_t dst_size) {
+  const unsigned char *ip = reinterpret_cast<const unsigned char *>(source);
+  const unsigned char *ip_end = ip + size;
+  unsigned char *dst = reinterpret_cast<unsigned char *>(destination);
+  unsigned char *op = dst;
+  unsigned char *op_end = dst + dst_size;
+
+  while (ip < ip_end) {
+    unsigned int token = *ip++;
+    size_t num_literals = token >> 4;
+    if (num_literals == 15) {
+      unsigned char b;
+      do {
+        if (ip >= ip_end) {
+          return false;
+        }
+        b = *ip++;
+        num_literals += b;
+      } while (b == 255);
+    }
+    if (num_literals > (size_t)(ip_end - ip) || num_literals > (size_t)(op_end - op)) {
+      return false;
+    }
+    memcpy(op, ip, num_literals);
+    ip += num_literals;
+    op += num_literals;
+    if (ip == ip_end) {
+      break; // the last sequence has no match
+    }
+
+    if (ip_end - ip < 2) {
+      return false;
+    }
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst)) {
+      return false;
+    }
+    size_t length = token & 15;
+    if (length == 15) {
+      unsigned char b;
+      do {
+        if (ip >= ip_end) {
+          return false;
+        }
+        b = *ip++;
+        length += b;
+      } while (b == 255);
+    }
+    length += LZ4_MIN_MATCH;
+    if (length > (size_t)(op_end - op)) {
+      return false;
+    }
+    const unsigned char *ref = op - offset;
+    if (offset >= length) {
+      memcpy(op, ref, length);
+    } else {
+      // Overlapping match (runs of a repeated pattern)
+      for (size_t i = 0; i < length; ++i) {
+        op[i] = ref[i];
+      }
+    }
+    op += length;
+  }
+  return op == op_end;
+}
@@ -0,0 +1,71 @@
+#ifndef _DATUM_CODEC_
+#define _DATUM_CODEC_
+#include "opencv2/core/core.hpp"
+#include <string>
+#include <vector>
+
+/*
+ * Compressed payloads for the Datums of a database.
+ *
+ *   raw   the usual CHW pixels (encoded = false)
+ *   png   lossless PNG, like convert_imageset --encoded
+ *   jpeg  JPEG with the given quality (jpeg:Q, 95 by default)
+ *   lz4   the raw CHW pixels compressed with LZ4 (block format), a lot
+ *         faster to decode than PNG. The payload is "LZ4C", the size of the
+ *         raw pixels (uint32, little endian) and the LZ4 block.
+ *
+ * Encoded Datums have encoded = true and keep channels, height and width of
+ * the decoded image, so readers know the shape before decoding. PNG and JPEG
+ * can not store more than 4 channels, so a pair of images is encoded as a
+ * single image with img2 below img1 (2 * height rows). With JPEG each image
+ * is first padded with its last row to a multiple of 16 rows, so no block
+ * (16 rows of an MCU with 4:2:0) has pixels of both. Single images encoded
+ * with PNG or JPEG are the same as the ones of convert_imageset, so stock
+ * Caffe can read them; pairs and lz4 need decode_datum_data().
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+using namespace cv;
+
+enum CodecType { CODEC_RAW, CODEC_PNG, CODEC_JPEG, CODEC_LZ4 };
+
+struct DatumCodec {
+  CodecType type;
+  int quality; // jpeg only
+
+  DatumCodec() : type(CODEC_RAW), quality(95) {}
+};
+
+// "raw", "png", "jpeg", "jpeg:Q" or "lz4". Throws runtime_error for anything else
+DatumCodec parse_codec(const string &name);
+string codec_name(const DatumCodec &codec);
+
+/*
+ * Serialized Datum with img1 (and img2 if it is not empty) encoded with codec.
+ * label < 0 means no label. Meant to be called from the threads that generate
+ * the images, the result goes to LMDataBase::insert2db(serialized, key).
+ */
+string encode_datum(const Mat &img1, const Mat &img2, int label, const vector<float> &float_data,
+                    const DatumCodec &codec);
+
+/*
+ * Writes in dst the channels * height * width bytes of CHW pixels of a Datum,
+ * encoded or not. Throws runtime_error if the payload can not be decoded.
+ */
+void decode_datum_data(const char *data, size_t size, bool encoded, int channels, int height, int width, char *dst);
+
+/*
+ * Decodes a Datum with a single image to a HWC Mat. Encoded PNG/JPEG images
+ * can have channels, height and width set to 0 (like the ones written by
+ * convert_imageset --encoded).
+ */
+Mat decode_datum_image(const char *data, size_t size, bool encoded, int channels, int height, int width);
+
+// LZ4 block format. dst must have room for lz4_bound(size) bytes
+size_t lz4_bound(size_t size);
+size_t lz4_compress(const char *src, size_t size, char *dst);
+// Returns false if src is not a valid block that decompresses to exactly dst_size bytes
+bool lz4_decompress(const char *src, size_t size, char *dst, size_t dst_size);
+#endif
@@ -0,0 +1,83 @@
+#include "datum_writer.hpp"
+#include <cstring>
+
+// Datum field numbers (see caffe.proto)
+#define FIELD_CHANNELS 1
+#define FIELD_HEIGHT 2
+#define FIELD_WIDTH 3
+#define FIELD_DATA 4
+#define FIELD_LABEL 5
+#define FIELD_FLOAT_DATA 6
+#define FIELD_ENCODED 7
+
+#define WIRETYPE_VARINT 0
+#define WIRETYPE_LENGTH_DELIMITED 2
+#define WIRETYPE_FIXED32 5
+
+static size_t varint_size(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+// Negative int32 are sign-extended to 64 bits (10 bytes), like protobuf does
+static size_t int32_size(int value) { return varint_size((uint64_t)(int64_t)value); }
+
+static char *write_varint(uint64_t value, char *dst) {
+  while (value >= 0x80) {
+    *dst++ = static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  *dst++ = static_cast<char>(value);
+  return dst;
+}
+
+static char *write_tag(int field, int wire_type, char *dst) {
+  return write_varint((uint64_t)((field << 3) | wire_type), dst);
+}
+
+static char *write_int32_field(int field, int value, char *dst) {
+  dst = write_tag(field, WIRETYPE_VARINT, dst);
+  return write_varint((uint64_t)(int64_t)value, dst);
+}
+
+size_t datum_wire_size(const DatumHeader &header, size_t data_size) {
+  // All the tags of Datum fit in one byte
+  size_t size = 0;
+  size += 1 + int32_size(header.channels);
+  size += 1 + int32_size(header.height);
+  size += 1 + int32_size(header.width);
+  size += 1 + varint_size(data_size) + data_size;
+  if (header.has_label) {
+    size += 1 + int32_size(header.label);
+  }
+  // float_data is not packed: one tag and one fixed32 per element
+  size += header.float_data.size() * (1 + sizeof(float));
+  size += 1 + 1; // encoded
+  return size;
+}
+
+char *write_datum_prefix(const DatumHeader &header, size_t data_size, char *dst) {
+  dst = write_int32_field(FIELD_CHANNELS, header.channels, dst);
+  dst = write_int32_field(FIELD_HEIGHT, header.height, dst);
+  dst = write_int32_field(FIELD_WIDTH, header.width, dst);
+  dst = write_tag(FIELD_DATA, WIRETYPE_LENGTH_DELIMITED, dst);
+  return write_varint(data_size, dst);
+}
+
+char *write_datum_suffix(const DatumHeader &header, char *dst) {
+  if (header.has_label) {
+    dst = write_int32_field(FIELD_LABEL, header.label, dst);
+  }
+  for (size_t i = 0; i < header.float_data.size(); ++i) {
+    dst = write_tag(FIELD_FLOAT_DATA, WIRETYPE_FIXED32, dst);
+    // fixed32 is little-endian on the wire, same as every host we build on
+    memcpy(dst, &header.float_data[i], sizeof(float));
+    dst += sizeof(float);
+  }
+  dst = write_int32_field(FIELD_ENCODED, header.encoded ? 1 : 0, dst);
+  return dst;
+}
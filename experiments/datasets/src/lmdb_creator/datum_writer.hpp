@@ -0,0 +1,45 @@
+#ifndef _DATUM_WRITER_
+#define _DATUM_WRITER_
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Hand-written serializer for caffe::Datum.
+ *
+ * Datum.SerializeToString() needs the pixels to be in the Datum first, so the
+ * usual path copies them three times: into the Datum, into the serialized
+ * string and into the LMDB page. These functions write the same bytes that
+ * protobuf would write, in two steps, straight into a buffer owned by someone
+ * else (an LMDB page reserved with MDB_RESERVE):
+ *
+ *   size_t size = datum_wire_size(header, data_size);
+ *   char *data = write_datum_prefix(header, data_size, buffer);
+ *   ... write data_size bytes of pixels in data ...
+ *   write_datum_suffix(header, data + data_size);
+ *
+ * Fields are written in field number order, exactly like protobuf does, so
+ * the records stay readable by stock Caffe.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+struct DatumHeader {
+  int channels;
+  int height;
+  int width;
+  bool has_label;
+  int label;
+  std::vector<float> float_data;
+  bool encoded;
+
+  DatumHeader() : channels(0), height(0), width(0), has_label(false), label(0), encoded(false) {}
+};
+
+size_t datum_wire_size(const DatumHeader &header, size_t data_size);
+// Writes the fields before the payload (channels, height, width and the data tag/length)
+// and returns the address where the data_size bytes of the payload go
+char *write_datum_prefix(const DatumHeader &header, size_t data_size, char *dst);
+// Writes the fields after the payload (label, float_data, encoded). Returns the end of the record
+char *write_datum_suffix(const DatumHeader &header, char *dst);
+#endif
@@ -0,0 +1,219 @@
+#include "frame_store.hpp"
+#include "build_metrics.hpp"
+#include "datum_writer.hpp"
+#include "image_transforms.hpp"
+#include "lmdb_reader.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#define TB 1099511627776
+#define FRAMES_DB "frames"
+#define PAIRS_DB "pairs"
+#define FRAME_STORE_COMMIT_INTERVAL 1000
+
+static_assert(sizeof(PairEntry) == 56, "PairEntry is stored as it is, its layout can not change");
+
+PairEntry make_pair_entry(uint32_t frame_a, uint32_t frame_b) {
+  PairEntry pair;
+  memset(&pair, 0, sizeof(pair));
+  pair.frame_a = frame_a;
+  pair.frame_b = frame_b;
+  pair.transform_a = TRANSFORM_IDENTITY;
+  pair.transform_b = TRANSFORM_IDENTITY;
+  pair.label = -1;
+  return pair;
+}
+
+Mat apply_frame_transform(const Mat &frame, uint8_t transform, const float *params) {
+  switch (transform) {
+  case TRANSFORM_IDENTITY:
+    return frame;
+  case TRANSFORM_CROP: {
+    Rect crop(params[0], params[1], params[2], params[3]);
+    if (crop.x < 0 || crop.y < 0 || crop.width <= 0 || crop.height <= 0 || crop.x + crop.width > frame.cols ||
+        crop.y + crop.height > frame.rows) {
+      throw runtime_error("The crop of a pair is outside of its frame");
+    }
+    return frame(crop).clone();
+  }
+  case TRANSFORM_AFFINE:
+    return transform_image(frame, params[0], params[1], params[2]);
+  default:
+    throw runtime_error("Unknown frame transformation " + to_string(transform));
+  }
+}
+
+static void check(int rc, const string &what) {
+  if (rc != MDB_SUCCESS) {
+    throw runtime_error(what + ": " + mdb_strerror(rc));
+  }
+}
+
+FrameStoreWriter::FrameStoreWriter(const string &path, const DatumCodec &codec)
+    : codec(codec), mdb_env(NULL), mdb_txn(NULL), frames(0), pairs(0), num_uncommitted(0) {
+  mkdir(path.c_str(), 0744);
+  check(mdb_env_create(&mdb_env), "Could not create the LMDB environment");
+  mdb_env_set_mapsize(mdb_env, TB);
+  mdb_env_set_maxdbs(mdb_env, 2);
+  check(mdb_env_open(mdb_env, path.c_str(), 0, 0664), "Could not open " + path);
+  check(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), "Could not begin a transaction");
+  check(mdb_dbi_open(mdb_txn, FRAMES_DB, MDB_CREATE, &frames_dbi), "Could not open the frames of " + path);
+  check(mdb_dbi_open(mdb_txn, PAIRS_DB, MDB_CREATE, &pairs_dbi), "Could not open the pairs of " + path);
+  MDB_stat stat;
+  mdb_stat(mdb_txn, frames_dbi, &stat);
+  if (stat.ms_entries > 0) {
+    throw runtime_error(path + " already has frames, remove it first");
+  }
+}
+
+FrameStoreWriter::~FrameStoreWriter() {
+  int rc;
+  {
+    StageTimer timer(STAGE_COMMIT);
+    rc = mdb_txn_commit(mdb_txn);
+  }
+  if (rc != MDB_SUCCESS) {
+    cerr << "Could not commit the frame store: " << mdb_strerror(rc) << endl;
+  }
+  mdb_env_close(mdb_env);
+}
+
+void FrameStoreWriter::put(MDB_dbi dbi, unsigned int key, const void *value, size_t size) {
+  char key_str[11];
+  MDB_val mdb_key, mdb_data;
+  mdb_key.mv_size = snprintf(key_str, sizeof(key_str), "%08u", key);
+  mdb_key.mv_data = key_str;
+  mdb_data.mv_size = size;
+  mdb_data.mv_data = const_cast<void *>(value);
+  {
+    StageTimer timer(STAGE_PUT);
+    check(mdb_put(mdb_txn, dbi, &mdb_key, &mdb_data, 0), "Could not write to the frame store");
+  }
+  build_metrics().add_bytes_written(mdb_key.mv_size + size);
+  build_metrics().add_records(1);
+  if (++num_uncommitted == FRAME_STORE_COMMIT_INTERVAL) {
+    StageTimer timer(STAGE_COMMIT);
+    check(mdb_txn_commit(mdb_txn), "Could not commit the frame store");
+    check(mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn), "Could not begin a transaction");
+    num_uncommitted = 0;
+  }
+}
+
+uint32_t FrameStoreWriter::add_frame(const Mat &frame) {
+  string datum;
+  {
+    StageTimer timer(STAGE_SERIALIZE);
+    datum = encode_datum(frame, Mat(), -1, vector<float>(), codec);
+  }
+  put(frames_dbi, frames, datum.data(), datum.size());
+  return frames++;
+}
+
+uint32_t FrameStoreWriter::add_encoded_frame(const string &file_contents) {
+  // Like convert_imageset --encoded: the shape is only known after decoding
+  DatumHeader header;
+  header.encoded = true;
+  string datum(datum_wire_size(header, file_contents.size()), '\0');
+  char *data = write_datum_prefix(header, file_contents.size(), &datum[0]);
+  memcpy(data, file_contents.data(), file_contents.size());
+  write_datum_suffix(header, data + file_contents.size());
+  put(frames_dbi, frames, datum.data(), datum.size());
+  return frames++;
+}
+
+void FrameStoreWriter::add_pair(const PairEntry &pair, unsigned int key) {
+  if (pair.frame_a >= frames || pair.frame_b >= frames) {
+    throw runtime_error("A pair refers to a frame that is not in the store yet");
+  }
+  put(pairs_dbi, key, &pair, sizeof(pair));
+  pairs++;
+}
+
+void FrameStoreWriter::add_pair(const PairEntry &pair) { add_pair(pair, pairs); }
+
+FrameStoreReader::FrameStoreReader(const string &path)
+    : mdb_env(NULL), mdb_txn(NULL), pairs_cursor(NULL), frames(0), pairs(0), started(false), last_frame_id(0) {
+  int rc = mdb_env_create(&mdb_env);
+  if (rc == MDB_SUCCESS) {
+    mdb_env_set_mapsize(mdb_env, TB);
+    mdb_env_set_maxdbs(mdb_env, 2);
+    rc = mdb_env_open(mdb_env, path.c_str(), MDB_RDONLY | MDB_NOTLS, 0664);
+  }
+  if (rc == MDB_SUCCESS) {
+    rc = mdb_txn_begin(mdb_env, NULL, MDB_RDONLY, &mdb_txn);
+  }
+  if (rc == MDB_SUCCESS) {
+    rc = mdb_dbi_open(mdb_txn, FRAMES_DB, 0, &frames_dbi);
+  }
+  if (rc == MDB_SUCCESS) {
+    rc = mdb_dbi_open(mdb_txn, PAIRS_DB, 0, &pairs_dbi);
+  }
+  if (rc == MDB_SUCCESS) {
+    rc = mdb_cursor_open(mdb_txn, pairs_dbi, &pairs_cursor);
+  }
+  if (rc != MDB_SUCCESS) {
+    if (mdb_txn != NULL) {
+      mdb_txn_abort(mdb_txn);
+    }
+    mdb_env_close(mdb_env);
+    throw runtime_error("Could not open the frame store " + path + ": " + mdb_strerror(rc));
+  }
+  MDB_stat stat;
+  mdb_stat(mdb_txn, frames_dbi, &stat);
+  frames = stat.ms_entries;
+  mdb_stat(mdb_txn, pairs_dbi, &stat);
+  pairs = stat.ms_entries;
+}
+
+FrameStoreReader::~FrameStoreReader() {
+  mdb_cursor_close(pairs_cursor);
+  mdb_txn_abort(mdb_txn);
+  mdb_env_close(mdb_env);
+}
+
+Mat FrameStoreReader::frame(uint32_t id) {
+  if (!last_frame.empty() && id == last_frame_id) {
+    return last_frame;
+  }
+  char key_str[11];
+  MDB_val mdb_key, mdb_data;
+  mdb_key.mv_size = snprintf(key_str, sizeof(key_str), "%08u", id);
+  mdb_key.mv_data = key_str;
+  int rc = mdb_get(mdb_txn, frames_dbi, &mdb_key, &mdb_data);
+  if (rc != MDB_SUCCESS) {
+    throw runtime_error("Could not read the frame " + to_string(id) + ": " + mdb_strerror(rc));
+  }
+  caffe::Datum datum;
+  if (!datum.ParseFromArray(mdb_data.mv_data, mdb_data.mv_size)) {
+    throw runtime_error("The frame " + to_string(id) + " is not a Datum");
+  }
+  last_frame = decode_datum_image(datum.data().data(), datum.data().size(), datum.encoded(), datum.channels(),
+                                  datum.height(), datum.width());
+  last_frame_id = id;
+  return last_frame;
+}
+
+bool FrameStoreReader::next_pair(unsigned int *key, PairEntry *pair) {
+  MDB_val mdb_key, mdb_data;
+  int rc = mdb_cursor_get(pairs_cursor, &mdb_key, &mdb_data, started ? MDB_NEXT : MDB_FIRST);
+  started = true;
+  if (rc == MDB_NOTFOUND) {
+    return false;
+  }
+  check(rc, "Could not read the pairs");
+  if (mdb_data.mv_size != sizeof(PairEntry)) {
+    throw runtime_error("Corrupted pair entry");
+  }
+  memcpy(pair, mdb_data.mv_data, sizeof(PairEntry));
+  *key = lmdb_key_to_uint(mdb_key);
+  return true;
+}
+
+void FrameStoreReader::materialize(const PairEntry &pair, Mat *img1, Mat *img2) {
+  *img1 = apply_frame_transform(frame(pair.frame_a), pair.transform_a, pair.params_a);
+  *img2 = apply_frame_transform(frame(pair.frame_b), pair.transform_b, pair.params_b);
+}
@@ -0,0 +1,116 @@
+#ifndef _FRAME_STORE_
+#define _FRAME_STORE_
+#include "datum_codec.hpp"
+#include "opencv2/core/core.hpp"
+#include <lmdb.h>
+#include <cstdint>
+#include <string>
+
+/*
+ * Deduplicated storage for databases of pairs of images.
+ *
+ * In the siamese databases the same source images are stored over and over:
+ * every MNIST digit is half of ~83 pairs and every KITTI frame is in many
+ * pairs. A frame store keeps each distinct image (frame) once and describes
+ * every pair with a small fixed-size entry: the ids of both frames, the
+ * transformation applied to each of them and the labels of the pair.
+ *
+ * It is a single LMDB environment (a directory) with two databases:
+ *   "frames"  key %08u frame id -> Datum with the image (raw or encoded)
+ *   "pairs"   key %08u          -> PairEntry (56 bytes, host byte order)
+ *
+ * The pairs are iterated in key order, like the records of a LMDB made with
+ * LMDataBase, and FrameStoreReader::materialize() builds the images of a pair
+ * when they are needed. convert_frame_store converts between this format and
+ * the usual data (+ labels) LMDBs.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+using namespace cv;
+
+#define FRAME_STORE_MAX_LABELS 8
+
+enum FrameTransform {
+  TRANSFORM_IDENTITY = 0,
+  TRANSFORM_CROP = 1,   // params: left, top, width, height
+  TRANSFORM_AFFINE = 2, // params: tx, ty, rot (degrees), see transform_image()
+};
+
+typedef struct {
+  uint32_t frame_a;
+  uint32_t frame_b;
+  uint8_t transform_a;
+  uint8_t transform_b;
+  uint8_t num_labels;
+  uint8_t reserved;
+  int32_t label; // -1: no label
+  float params_a[4];
+  float params_b[4];
+  uint8_t labels[FRAME_STORE_MAX_LABELS];
+} PairEntry;
+
+// A pair without transformations, label or labels
+PairEntry make_pair_entry(uint32_t frame_a, uint32_t frame_b);
+// Applies one of the FrameTransforms to a frame
+Mat apply_frame_transform(const Mat &frame, uint8_t transform, const float *params);
+
+class FrameStoreWriter {
+public:
+  // The frames added with add_frame() are stored with codec
+  FrameStoreWriter(const string &path, const DatumCodec &codec = DatumCodec());
+  ~FrameStoreWriter();
+
+  // Stores a frame and returns its id. Ids are consecutive, starting at 0
+  uint32_t add_frame(const Mat &frame);
+  // Stores an image file (e.g. a PNG read from disk) without decoding it
+  uint32_t add_encoded_frame(const string &file_contents);
+  // Stores a pair under the given key or under the next one
+  void add_pair(const PairEntry &pair, unsigned int key);
+  void add_pair(const PairEntry &pair);
+
+  unsigned long num_frames() const { return frames; }
+  unsigned long num_pairs() const { return pairs; }
+
+private:
+  DatumCodec codec;
+  MDB_env *mdb_env;
+  MDB_txn *mdb_txn;
+  MDB_dbi frames_dbi;
+  MDB_dbi pairs_dbi;
+  unsigned long frames;
+  unsigned long pairs;
+  unsigned int num_uncommitted;
+
+  void put(MDB_dbi dbi, unsigned int key, const void *value, size_t size);
+};
+
+class FrameStoreReader {
+public:
+  // Throws runtime_error if path is not a frame store
+  explicit FrameStoreReader(const string &path);
+  ~FrameStoreReader();
+
+  size_t num_frames() const { return frames; }
+  size_t num_pairs() const { return pairs; }
+  Mat frame(uint32_t id);
+  // Iterates the pairs in key order
+  bool next_pair(unsigned int *key, PairEntry *pair);
+  // The images of a pair, with their transformations applied
+  void materialize(const PairEntry &pair, Mat *img1, Mat *img2);
+
+private:
+  MDB_env *mdb_env;
+  MDB_txn *mdb_txn;
+  MDB_dbi frames_dbi;
+  MDB_dbi pairs_dbi;
+  MDB_cursor *pairs_cursor;
+  size_t frames;
+  size_t pairs;
+  bool started;
+  // Consecutive pairs often share a frame (MNIST pairs are made of one digit)
+  uint32_t last_frame_id;
+  Mat last_frame;
+};
+#endif
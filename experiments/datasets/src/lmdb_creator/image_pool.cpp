@@ -0,0 +1,114 @@
+#include "image_pool.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#define SLOT_ALIGNMENT 64 // every image starts in its own cache line
+
+ImagePool::ImagePool(size_t slot_bytes, size_t slots_per_slab)
+    : slot_bytes((slot_bytes + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT),
+      slots_per_slab(slots_per_slab) {
+  if (slot_bytes == 0 || slots_per_slab == 0) {
+    throw runtime_error("An image pool needs slots of at least one byte and slabs of at least one slot");
+  }
+  memset(&counters, 0, sizeof(counters));
+  counters.slot_bytes = this->slot_bytes;
+}
+
+ImagePool::~ImagePool() {
+  lock_guard<mutex> lock(m);
+  if (counters.in_use > 0) {
+    // Freeing the slabs would leave those Mats pointing to freed memory
+    cerr << "ImagePool destroyed with " << counters.in_use << " images still in use, leaking its slabs" << endl;
+    return;
+  }
+  for (size_t i = 0; i < slabs.size(); ++i) {
+    fastFree(slabs[i]);
+  }
+}
+
+/* PRECONDITION: m is locked */
+void ImagePool::add_slab() const {
+  // The pixels of all the slots, then their UMatData headers
+  size_t pixels_bytes = slots_per_slab * slot_bytes;
+  size_t header_bytes = (sizeof(UMatData) + SLOT_ALIGNMENT - 1) / SLOT_ALIGNMENT * SLOT_ALIGNMENT;
+  uchar *slab = static_cast<uchar *>(fastMalloc(pixels_bytes + slots_per_slab * header_bytes));
+  slabs.push_back(slab);
+  // In reverse so the slots are taken in address order
+  for (size_t i = slots_per_slab; i-- > 0;) {
+    Slot slot = {slab + i * slot_bytes, slab + pixels_bytes + i * header_bytes, false};
+    free_slots.push_back(slot);
+  }
+  counters.slabs++;
+}
+
+Mat ImagePool::create(int rows, int cols, int type) {
+  Mat img;
+  img.allocator = this;
+  img.create(rows, cols, type);
+  return img;
+}
+
+UMatData *ImagePool::allocate(int dims, const int *sizes, int type, void *data, size_t *step, int flags,
+                              UMatUsageFlags usage_flags) const {
+  // Same steps as the default allocator: continuous images
+  size_t total = CV_ELEM_SIZE(type);
+  for (int i = dims - 1; i >= 0; i--) {
+    if (step != NULL) {
+      step[i] = total;
+    }
+    total *= sizes[i];
+  }
+  if (data != NULL || total > slot_bytes) {
+    if (data == NULL) {
+      lock_guard<mutex> lock(m);
+      counters.allocations++;
+      counters.oversized++;
+    }
+    return Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+  }
+
+  Slot slot;
+  {
+    lock_guard<mutex> lock(m);
+    if (free_slots.empty()) {
+      add_slab();
+    }
+    slot = free_slots.back();
+    free_slots.pop_back();
+    counters.allocations++;
+    counters.recycled += slot.used;
+    counters.in_use++;
+    counters.peak_in_use = max(counters.peak_in_use, counters.in_use);
+  }
+  UMatData *u = new (slot.header) UMatData(this);
+  u->data = u->origdata = slot.pixels;
+  u->size = total;
+  return u;
+}
+
+bool ImagePool::allocate(UMatData *data, int, UMatUsageFlags) const { return data != NULL; }
+
+void ImagePool::deallocate(UMatData *u) const {
+  if (u == NULL) {
+    return;
+  }
+  Slot slot = {u->origdata, u, true};
+  u->~UMatData();
+  lock_guard<mutex> lock(m);
+  free_slots.push_back(slot);
+  counters.in_use--;
+}
+
+ImagePoolStats ImagePool::stats() const {
+  lock_guard<mutex> lock(m);
+  return counters;
+}
+
+void ImagePool::print_stats(ostream &out, const string &name) const {
+  ImagePoolStats s = stats();
+  out << name << " pool: " << s.allocations << " images (" << (s.allocations ? 100.0 * s.recycled / s.allocations : 0.0)
+      << "% in recycled slots, " << s.oversized << " too large), peak " << s.peak_in_use << " in use, " << s.slabs
+      << " slabs (" << (s.slabs * slots_per_slab * slot_bytes >> 20) << " MB)" << endl;
+}
@@ -0,0 +1,83 @@
+#ifndef _IMAGE_POOL_
+#define _IMAGE_POOL_
+#include "opencv2/core/core.hpp"
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Pool of fixed-size image buffers, allocated in slabs and recycled.
+ *
+ * The generators make millions of images of the same size (the transformed
+ * MNIST digits, the decoded KITTI frames) that only live until the writer
+ * has stored their record. Allocating each of them with malloc means
+ * millions of allocations, and the heap of a long run keeps growing with
+ * fragmentation. An ImagePool hands out slots of slot_bytes from big slabs
+ * and takes them back for the next images, so after the first records the
+ * pool does not allocate anymore.
+ *
+ * It is an OpenCV MatAllocator: set it as the allocator of a Mat before
+ * create() (or use ImagePool::create()) and the pixels come from the pool.
+ * The slot goes back to the pool when the last Mat that refers to it is
+ * released, e.g. when the async writer of a LMDataBase is done with the
+ * record, so nobody has to return the images by hand. The UMatData headers
+ * are part of the slots too. Images larger than a slot come from the heap.
+ *
+ * It is safe to use from several threads. Every Mat of the pool must be
+ * released before the pool is destroyed.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+using namespace cv;
+
+#define IMAGE_POOL_SLOTS_PER_SLAB 1024
+
+typedef struct {
+  size_t slot_bytes;
+  unsigned long slabs;
+  unsigned long allocations; // images created in the pool
+  unsigned long recycled;    // of them, in a slot that was used before
+  unsigned long oversized;   // larger than a slot, allocated from the heap
+  unsigned long in_use;      // slots taken right now
+  unsigned long peak_in_use;
+} ImagePoolStats;
+
+class ImagePool : public MatAllocator {
+public:
+  ImagePool(size_t slot_bytes, size_t slots_per_slab = IMAGE_POOL_SLOTS_PER_SLAB);
+  ~ImagePool();
+
+  // A rows x cols image of the given type with its pixels in the pool
+  Mat create(int rows, int cols, int type);
+
+  ImagePoolStats stats() const;
+  void print_stats(ostream &out, const string &name) const;
+
+  // MatAllocator interface
+  UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, int flags,
+                     UMatUsageFlags usage_flags) const;
+  bool allocate(UMatData *data, int access_flags, UMatUsageFlags usage_flags) const;
+  void deallocate(UMatData *data) const;
+
+private:
+  typedef struct {
+    uchar *pixels;
+    void *header; // room for the UMatData of the image
+    bool used;    // it had an image before
+  } Slot;
+
+  size_t slot_bytes;
+  size_t slots_per_slab;
+  // The MatAllocator methods are const, the state of the pool is not
+  mutable mutex m;
+  mutable vector<uchar *> slabs;
+  mutable vector<Slot> free_slots;
+  mutable ImagePoolStats counters;
+
+  /* PRECONDITION: m is locked */
+  void add_slab() const;
+};
+#endif
@@ -0,0 +1,23 @@
+#include "image_transforms.hpp"
+#include "remap_warp.hpp"
+
+/*
+ * rot (Rotation) is in degrees
+ * tx, ty (Translations) are pixels
+ */
+Mat transform_image(const Mat &img, float tx, float ty, float rot) {
+  if (img.type() == CV_8UC1 && img.rows <= 254 && img.cols <= 254) {
+    // Same pixels as warpAffine, through a remap table (see remap_warp.hpp)
+    double m[6];
+    rotation_translation_matrix(tx, ty, rot, img.rows, img.cols, m);
+    return remap_warp(img, RemapTable(m, img.rows, img.cols));
+  }
+  Mat res;
+  Point2f mid(img.cols / 2, img.rows / 2);
+  Mat rotMat = getRotationMatrix2D(mid, rot, 1.0);
+  Mat transMat = (Mat_<double>(2, 3) << 0, 0, tx, 0, 0, ty);
+  rotMat = rotMat + transMat;
+  // Set constant value for border to be white
+  warpAffine(img, res, rotMat, Size(img.cols, img.rows), INTER_LINEAR, BORDER_CONSTANT, Scalar(0, 0, 0));
+  return res;
+}
@@ -0,0 +1,22 @@
+#ifndef _IMAGE_TRANSFORMS_
+#define _IMAGE_TRANSFORMS_
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+
+/*
+ * Transformations used to make the pairs of images of the siamese databases.
+ * They live in the library so the tools that generate the pairs and the
+ * readers that rebuild them from a frame store (see frame_store.hpp) always
+ * produce the same pixels.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace cv;
+
+/*
+ * Rotates img rot degrees around its center and translates it (tx, ty) pixels.
+ * The uncovered pixels are black.
+ */
+Mat transform_image(const Mat &img, float tx, float ty, float rot);
+#endif
@@ -1,16 +1,161 @@
 #include "lmdb_creator.hpp"
 #include "caffe/util/io.hpp"
 
-LMDataBase::LMDataBase(string lmdb_path, size_t dat_channels, size_t dat_size)
-    : datum_channels(dat_channels), datum_size(dat_size), num_inserts(0) {
+static void check_lmdb(int rc, const string &what) {
+  if (rc != MDB_SUCCESS) {
+    throw runtime_error(what + ": " + mdb_strerror(rc));
+  }
+}
+
+LMDataBase::LMDataBase(string lmdb_path, size_t dat_channels, size_t dat_size, const LMDataBaseOptions &options)
+    : lmdb_path(lmdb_path), datum_channels(dat_channels), datum_size(dat_size), num_inserts(0), num_uncommitted(0),
+      num_resumed(0), options(options), mean(NULL), queue(NULL), stopping(false), num_queued(0), flush_target(0),
+      num_committed(0), failed(false) {
   // Set database environment
   mkdir(static_cast<const char *>(lmdb_path.c_str()), 0744);
+  if (!options.mean_file.empty()) {
+    mean = new MeanAccumulator();
+  }
+  if (options.num_shards > 1) {
+    if (options.resume) {
+      throw runtime_error("Sharded LMDBs can not be resumed: " + lmdb_path);
+    }
+    LMDataBaseOptions shard_options = options;
+    shard_options.num_shards = 1;
+    shard_options.async = true; // one writer thread per shard
+    shard_options.verbose = false;
+    shard_options.mean_file = "";
+    for (unsigned int s = 0; s < options.num_shards; ++s) {
+      ShardInfo info = {shard_name(s), 0, -1, -1};
+      shard_info.push_back(info);
+      shards.push_back(new LMDataBase(lmdb_path + "/" + info.name, dat_channels, dat_size, shard_options));
+      if (mean != NULL) {
+        // Every shard sums its own images, they are merged here at the end.
+        // No record has been submitted to the shard yet.
+        shards.back()->mean = new MeanAccumulator();
+      }
+    }
+    return;
+  }
   // Create LMDB
   mdb_env_create(&mdb_env);
   mdb_env_set_mapsize(mdb_env, TB);
   mdb_env_open(mdb_env, static_cast<const char *>(lmdb_path.c_str()), 0, 0664);
   mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn);
   mdb_open(mdb_txn, NULL, 0, &mdb_dbi);
+  if (options.resume) {
+    resume_build();
+  }
+
+  if (options.async) {
+    queue = new MPSCRing<LMRecord>(options.queue_capacity);
+    writer = thread(&LMDataBase::writer_loop, this);
+  }
+}
+
+/*
+ * Commits the last records. Throws the first write error, if there was one
+ * (e.g. a commit that failed in the writer thread after the last insert2db),
+ * unless an exception is already propagating.
+ */
+LMDataBase::~LMDataBase() noexcept(false) {
+  if (!shards.empty()) {
+    for (size_t s = 0; s < shards.size(); ++s) {
+      if (mean != NULL) {
+        shards[s]->flush();
+        mean->merge(*shards[s]->mean);
+      }
+      delete shards[s];
+    }
+    write_shard_manifest(lmdb_path, shard_info);
+    if (options.verbose) {
+      cout << "\nFinished creation of " << shards.size() << " LMDB shards with " << num_inserts << " records.\n";
+    }
+    save_mean();
+    return;
+  }
+  if (options.async) {
+    wait_for_writer();
+    stopping = true;
+    writer.join();
+    delete queue;
+  }
+  close_env_lmdb();
+  if (failed) {
+    // The database keeps the records of the last commit (and their checkpoint), the mean is not saved
+    delete mean;
+    if (!uncaught_exception()) {
+      rethrow_write_error();
+    }
+    return;
+  }
+  if (options.verbose) {
+    cout << "\nFinished creation of LMDB with " << num_inserts << " pairs of images.\n";
+  }
+  save_mean();
+}
+
+/*
+ * Continues from the checkpoint of an unfinished build: its records are the
+ * first num_resumed of the build (the checkpoint is committed together with
+ * them). Without a checkpoint the build either finished or never committed
+ * anything, and all the entries are records. The images that are already
+ * there are added to the mean again.
+ */
+void LMDataBase::resume_build() {
+  MDB_val key, value;
+  key.mv_size = strlen(CHECKPOINT_KEY);
+  key.mv_data = const_cast<char *>(CHECKPOINT_KEY);
+  if (mdb_get(mdb_txn, mdb_dbi, &key, &value) == 0) {
+    string checkpoint(static_cast<const char *>(value.mv_data), value.mv_size);
+    size_t newline = checkpoint.find('\n');
+    string params = (newline == string::npos) ? "" : checkpoint.substr(newline + 1);
+    if (params != options.build_params) {
+      throw runtime_error("Can not resume " + lmdb_path + ": it was built with '" + params + "' instead of '" +
+                          options.build_params + "'");
+    }
+    num_resumed = strtoul(checkpoint.c_str(), NULL, 10);
+  } else {
+    MDB_stat stat;
+    mdb_stat(mdb_txn, mdb_dbi, &stat);
+    num_resumed = stat.ms_entries;
+  }
+  num_inserts = num_resumed;
+  if (options.verbose && num_resumed > 0) {
+    cout << "Resuming " << lmdb_path << " after " << num_resumed << " records" << endl;
+  }
+  if (mean == NULL || num_resumed == 0) {
+    return;
+  }
+  MDB_cursor *cursor;
+  mdb_cursor_open(mdb_txn, mdb_dbi, &cursor);
+  LMRecord record;
+  while (mdb_cursor_get(cursor, &key, &value, MDB_NEXT) == 0) {
+    if (key.mv_size == strlen(CHECKPOINT_KEY) && memcmp(key.mv_data, CHECKPOINT_KEY, key.mv_size) == 0) {
+      continue;
+    }
+    record.value.assign(static_cast<const char *>(value.mv_data), value.mv_size);
+    add_to_mean(record);
+  }
+  mdb_cursor_close(cursor);
+}
+
+/* Writes options.mean_file, if there is one. Shards only sum their images */
+void LMDataBase::save_mean() {
+  if (mean == NULL || options.mean_file.empty()) {
+    delete mean;
+    return;
+  }
+  if (mean->count() == 0) {
+    cerr << "No images to compute the mean of " << lmdb_path << endl;
+  } else {
+    mean->write_binaryproto(options.mean_file);
+    if (options.verbose) {
+      mean->print_stats(cout);
+      cout << "Saved the mean of " << lmdb_path << " in " << options.mean_file << endl;
+    }
+  }
+  delete mean;
 }
 
 void LMDataBase::insert2db(const Mat &img, int label = -10) {
@@ -18,18 +163,11 @@ void LMDataBase::insert2db(const Mat &img, int label = -10) {
   assert((size_t)img.rows == datum_size);
   assert((size_t)img.channels() == datum_channels);
 
-  string data_value;
-  Datum datum;
-  // TODO: fix this linking error
-  //CVMatToDatum(img, &datum);
-  Mat2Datum(img, &datum);
-  if (label != -10) {
-    datum.set_label(label);
-  }
-  datum.SerializeToString(&data_value);
-
-  save_data_to_lmdb(data_value);
-  cout << "Processed " << ++num_inserts << "\r" << flush;
+  LMRecord record;
+  record.img1 = img;
+  record.label = label;
+  record.key = -1;
+  submit(record);
 }
 
 void LMDataBase::insert2db(const Mat &img1, const Mat &img2, int label = -10) {
@@ -40,60 +178,394 @@ void LMDataBase::insert2db(const Mat &img1, const Mat &img2, int label = -10) {
   assert((size_t)img1.channels() == datum_channels/2);
   assert((size_t)img2.channels() == datum_channels/2);
 
-  string data_value;
-  Datum datum;
-  Mats2Datum(img1, img2, &datum);
-  if (label != -10) {
-    datum.set_label(label);
-  }
-  datum.SerializeToString(&data_value);
-
-  save_data_to_lmdb(data_value);
-  cout << "Processed " << ++num_inserts << "\r" << flush;
+  LMRecord record;
+  record.img1 = img1;
+  record.img2 = img2;
+  record.label = label;
+  record.key = -1;
+  submit(record);
 }
 
 void LMDataBase::insert2db(const vector<Label> &labels) {
   assert(labels.size() == datum_channels);
 
-  string label_value;
-  Datum datum;
-  datum.set_channels(labels.size());
-  datum.set_height(1);
-  datum.set_width(1);
-  datum.clear_data();
-  datum.clear_float_data();
-  datum.set_encoded(false);
-  datum.set_data(reinterpret_cast<const char*>(&labels[0]), datum_channels);
-  datum.SerializeToString(&label_value);
+  LMRecord record;
+  record.labels = labels;
+  record.key = -1;
+  submit(record);
+}
+
+void LMDataBase::insert2db(const Mat &img, int label, unsigned int key) {
+  assert((size_t)img.cols == datum_size);
+  assert((size_t)img.rows == datum_size);
+  assert((size_t)img.channels() == datum_channels);
 
-  save_data_to_lmdb(label_value);
+  LMRecord record;
+  record.img1 = img;
+  record.label = label;
+  record.key = key;
+  submit(record);
+}
 
-  ++num_inserts;
+void LMDataBase::insert2db(const Mat &img1, const Mat &img2, int label, unsigned int key) {
+  assert((size_t)img1.cols == datum_size);
+  assert((size_t)img1.rows == datum_size);
+  assert((size_t)img2.cols == datum_size);
+  assert((size_t)img2.rows == datum_size);
+
+  LMRecord record;
+  record.img1 = img1;
+  record.img2 = img2;
+  record.label = label;
+  record.key = key;
+  submit(record);
+}
+
+void LMDataBase::insert2db(const vector<Label> &labels, unsigned int key) {
+  assert(labels.size() == datum_channels);
+
+  LMRecord record;
+  record.labels = labels;
+  record.key = key;
+  submit(record);
 }
 
-void LMDataBase::save_data_to_lmdb(string &data_value) {
+void LMDataBase::insert2db(const Mat &img1, const Mat &img2, int label, const vector<Label> &labels,
+                           unsigned int key) {
+  assert((size_t)img1.cols == datum_size);
+  assert((size_t)img1.rows == datum_size);
+  assert((size_t)img2.cols == datum_size);
+  assert((size_t)img2.rows == datum_size);
+
+  LMRecord record;
+  record.img1 = img1;
+  record.img2 = img2;
+  record.label = label;
+  record.labels = labels;
+  record.key = key;
+  submit(record);
+}
+
+void LMDataBase::insert2db(const string &serialized_datum, unsigned int key) {
+  LMRecord record;
+  record.value = serialized_datum;
+  record.key = key;
+  submit(record);
+}
+
+void LMDataBase::flush() {
+  if (!shards.empty()) {
+    for (size_t s = 0; s < shards.size(); ++s) {
+      shards[s]->flush();
+    }
+    return;
+  }
+  if (failed) {
+    rethrow_write_error();
+  }
+  if (!options.async) {
+    try {
+      commit_data_to_lmdb();
+    } catch (...) {
+      fail(current_exception());
+      throw;
+    }
+    return;
+  }
+  wait_for_writer();
+  if (failed) {
+    rethrow_write_error();
+  }
+}
+
+/* Waits until the writer thread commits every record queued so far, or fails */
+void LMDataBase::wait_for_writer() {
+  unsigned long target = num_queued.load();
+  unsigned long current = flush_target.load();
+  while (current < target && !flush_target.compare_exchange_weak(current, target)) {
+  }
+  unique_lock<mutex> lock(flush_mutex);
+  flushed.wait(lock, [&] { return num_committed >= target || failed; });
+}
+
+/*
+ * Keeps the first write error. Nothing is written or committed after it: the
+ * records on disk are the ones of the last commit, so the checkpoint (if any)
+ * is still right and the build can be resumed.
+ */
+void LMDataBase::fail(exception_ptr error) {
+  lock_guard<mutex> lock(flush_mutex);
+  if (!write_error) {
+    write_error = error;
+  }
+  failed = true;
+  flushed.notify_all();
+}
+
+void LMDataBase::rethrow_write_error() {
+  exception_ptr error;
+  {
+    lock_guard<mutex> lock(flush_mutex);
+    error = write_error;
+  }
+  rethrow_exception(error);
+}
+
+void LMDataBase::submit(LMRecord &record) {
+  if (!shards.empty()) {
+    // Keys are assigned here so the records keep the insertion order across shards
+    if (record.key < 0) {
+      record.key = num_inserts;
+    }
+    unsigned int s = record.key % shards.size();
+    ShardInfo &info = shard_info[s];
+    info.first_key = (info.first_key < 0) ? record.key : min(info.first_key, record.key);
+    info.last_key = max(info.last_key, record.key);
+    ++info.records;
+    ++num_inserts;
+    if (options.verbose) {
+      progress.update(num_inserts);
+    }
+    shards[s]->submit(record);
+    return;
+  }
+  if (failed) {
+    rethrow_write_error();
+  }
+  if (options.async) {
+    queue->push(record);
+    ++num_queued;
+  } else {
+    try {
+      write_record(record);
+    } catch (...) {
+      fail(current_exception());
+      throw;
+    }
+  }
+}
+
+/*
+ * Writes a record in the current transaction. The Datum is serialized straight
+ * into the LMDB page (see datum_writer.hpp): the pixels are transposed to CHW
+ * in their final place and never copied.
+ * In async mode this only runs in the writer thread.
+ */
+void LMDataBase::write_record(const LMRecord &record) {
+  unsigned int key = (record.key >= 0) ? record.key : num_inserts;
+  DatumHeader header;
+  if (!record.value.empty()) {
+    char *data = reserve_in_lmdb(key, record.value.size());
+    memcpy(data, record.value.data(), record.value.size());
+    if (mean != NULL) {
+      add_to_mean(record);
+    }
+
+    record_saved();
+    return;
+  }
+  if (record.img1.empty()) {
+    header.channels = record.labels.size();
+    header.height = 1;
+    header.width = 1;
+    char *data = reserve_in_lmdb(key, datum_wire_size(header, datum_channels));
+    data = write_datum_prefix(header, datum_channels, data);
+    memcpy(data, &record.labels[0], datum_channels);
+    write_datum_suffix(header, data + datum_channels);
+
+    record_saved();
+    return;
+  }
+
+  if (options.codec.type != CODEC_RAW) {
+    vector<float> float_data(record.labels.begin(), record.labels.end());
+    int label = (record.label != -10) ? record.label : -1;
+    string value;
+    {
+      StageTimer timer(STAGE_SERIALIZE);
+      value = encode_datum(record.img1, record.img2, label, float_data, options.codec);
+    }
+    memcpy(reserve_in_lmdb(key, value.size()), value.data(), value.size());
+    if (mean != NULL) {
+      add_to_mean(record);
+    }
+    record_saved();
+    return;
+  }
+
+  assert(record.img1.depth() == CV_8U);
+  header.channels = record.img1.channels() + (record.img2.empty() ? 0 : record.img2.channels());
+  header.height = record.img1.rows;
+  header.width = record.img1.cols;
+  header.has_label = record.label != -10;
+  header.label = record.label;
+  header.float_data.assign(record.labels.begin(), record.labels.end());
+  size_t data_size = header.channels * header.height * header.width;
+
+  char *data = reserve_in_lmdb(key, datum_wire_size(header, data_size));
+  {
+    StageTimer timer(STAGE_SERIALIZE);
+    data = write_datum_prefix(header, data_size, data);
+    if (record.img2.empty()) {
+      Mat2CHW(record.img1, data);
+    } else {
+      Mats2CHW(record.img1, record.img2, data);
+    }
+    write_datum_suffix(header, data + data_size);
+  }
+  if (mean != NULL) {
+    // The pixels that were just written, still in cache
+    mean->add(reinterpret_cast<unsigned char *>(data), header.channels, header.height, header.width,
+              record.img2.empty() ? 1 : 2);
+  }
+
+  record_saved();
+}
+
+/* Adds to the mean the images of a record that is not written as CHW pixels (encoded or serialized elsewhere) */
+void LMDataBase::add_to_mean(const LMRecord &record) {
+  if (record.value.empty()) {
+    mean_pixels.resize(record.img1.total() * record.img1.channels() +
+                       (record.img2.empty() ? 0 : record.img2.total() * record.img2.channels()));
+    if (record.img2.empty()) {
+      Mat2CHW(record.img1, &mean_pixels[0]);
+    } else {
+      Mats2CHW(record.img1, record.img2, &mean_pixels[0]);
+    }
+    mean->add(reinterpret_cast<unsigned char *>(&mean_pixels[0]),
+              record.img1.channels() + (record.img2.empty() ? 0 : record.img2.channels()), record.img1.rows,
+              record.img1.cols, record.img2.empty() ? 1 : 2);
+    return;
+  }
+  Datum datum;
+  if (!datum.ParseFromString(record.value) || datum.channels() * datum.height() * datum.width() == 0) {
+    throw runtime_error("The mean needs Datums with their shape, " + lmdb_path + " has one without it");
+  }
+  mean_pixels.resize((size_t)datum.channels() * datum.height() * datum.width());
+  decode_datum_data(datum.data().data(), datum.data().size(), datum.encoded(), datum.channels(), datum.height(),
+                    datum.width(), &mean_pixels[0]);
+  // A serialized Datum does not say if it is a pair. The pairs of these tools have 2 or 6 channels
+  int frames = (datum.channels() % 2 == 0) ? 2 : 1;
+  mean->add(reinterpret_cast<unsigned char *>(&mean_pixels[0]), datum.channels(), datum.height(), datum.width(),
+            frames);
+}
+
+void LMDataBase::writer_loop() {
+  LMRecord record;
+  unsigned long num_written = 0;
+  while (true) {
+    bool got_record = queue->pop(&record, chrono::milliseconds(10));
+    // After an error the records are only taken out of the queue, so the producers never block
+    if (got_record && !failed) {
+      try {
+        write_record(record);
+      } catch (...) {
+        fail(current_exception());
+      }
+      ++num_written;
+    }
+    // Commit whenever somebody is waiting for the records written so far
+    unsigned long target = flush_target.load();
+    if (!failed && target > num_committed && num_written >= target) {
+      try {
+        commit_data_to_lmdb();
+      } catch (...) {
+        fail(current_exception());
+        continue;
+      }
+      lock_guard<mutex> lock(flush_mutex);
+      num_committed = num_written;
+      flushed.notify_all();
+    }
+    if (!got_record && stopping) {
+      return;
+    }
+  }
+}
+
+/*
+ * Puts key in the current transaction and returns the buffer (owned by LMDB)
+ * where its size bytes of value have to be written, before any other operation
+ * on the database. Call record_saved() once the value is complete. Throws
+ * runtime_error if the put fails (e.g. the map is full).
+ */
+char *LMDataBase::reserve_in_lmdb(unsigned int key, size_t size) {
   // Get primary key for database
-  std::ostringstream s;
-  s << std::setw(8) << std::setfill('0') << num_inserts;
-  string key = s.str();
-
-  mdb_data.mv_size = data_value.size();
-  mdb_data.mv_data = reinterpret_cast<void *>(&data_value[0]);
-  mdb_key.mv_size = key.size();
-  mdb_key.mv_data = reinterpret_cast<void *>(&key[0]);
-  mdb_put(mdb_txn, mdb_dbi, &mdb_key, &mdb_data, 0);
-  if (num_inserts % 1000 == 0) {
+  char key_str[16];
+  snprintf(key_str, sizeof(key_str), "%08u", key);
+
+  mdb_data.mv_size = size;
+  mdb_data.mv_data = NULL;
+  mdb_key.mv_size = strlen(key_str);
+  mdb_key.mv_data = reinterpret_cast<void *>(key_str);
+  {
+    StageTimer timer(STAGE_PUT);
+    check_lmdb(mdb_put(mdb_txn, mdb_dbi, &mdb_key, &mdb_data, MDB_RESERVE),
+               "Could not write the record " + string(key_str) + " to " + lmdb_path);
+  }
+  build_metrics().add_bytes_written(mdb_key.mv_size + size);
+  return reinterpret_cast<char *>(mdb_data.mv_data);
+}
+
+/* Counts the record that was just written and commits every commit_interval records */
+void LMDataBase::record_saved() {
+  ++num_inserts;
+  build_metrics().add_records(1);
+  if (options.verbose) {
+    progress.update(num_inserts);
+  }
+  if (++num_uncommitted >= options.commit_interval) {
     commit_data_to_lmdb();
   }
 }
 
+/* Puts the checkpoint of the records written so far in the current transaction */
+void LMDataBase::save_checkpoint() {
+  string checkpoint = to_string(num_inserts) + "\n" + options.build_params;
+  MDB_val key, value;
+  key.mv_size = strlen(CHECKPOINT_KEY);
+  key.mv_data = const_cast<char *>(CHECKPOINT_KEY);
+  value.mv_size = checkpoint.size();
+  value.mv_data = &checkpoint[0];
+  check_lmdb(mdb_put(mdb_txn, mdb_dbi, &key, &value, 0), "Could not write the checkpoint of " + lmdb_path);
+}
+
+/* Throws runtime_error if the commit fails: the records of the transaction are lost */
 void LMDataBase::commit_data_to_lmdb() {
-  mdb_txn_commit(mdb_txn);
-  mdb_txn_begin(mdb_env, NULL, 0, &mdb_txn);
+  StageTimer timer(STAGE_COMMIT);
+  if (options.checkpoint) {
+    save_checkpoint();
+  }
+  // mdb_txn_commit frees the transaction even if it fails
+  MDB_txn *txn = mdb_txn;
+  mdb_txn = NULL;
+  check_lmdb(mdb_txn_commit(txn), "Could not commit to " + lmdb_path);
+  check_lmdb(mdb_txn_begin(mdb_env, NULL, 0, &txn), "Could not begin a transaction in " + lmdb_path);
+  mdb_txn = txn;
+  num_uncommitted = 0;
 }
 
+/* Commits the last records, unless a write already failed (then they are dropped) */
 void LMDataBase::close_env_lmdb(){
-  mdb_txn_commit(mdb_txn);
+  if (!failed) {
+    StageTimer timer(STAGE_COMMIT);
+    if (options.checkpoint || options.resume) {
+      // The build is complete: the last records and the removal of the checkpoint are committed together
+      MDB_val key;
+      key.mv_size = strlen(CHECKPOINT_KEY);
+      key.mv_data = const_cast<char *>(CHECKPOINT_KEY);
+      mdb_del(mdb_txn, mdb_dbi, &key, NULL);
+    }
+    MDB_txn *txn = mdb_txn;
+    mdb_txn = NULL;
+    int rc = mdb_txn_commit(txn);
+    if (rc != MDB_SUCCESS) {
+      fail(make_exception_ptr(runtime_error("Could not commit to " + lmdb_path + ": " + mdb_strerror(rc))));
+    }
+  }
+  if (mdb_txn != NULL) {
+    mdb_txn_abort(mdb_txn);
+  }
   mdb_close(mdb_env, mdb_dbi);
   mdb_env_close(mdb_env);
 }
@@ -108,25 +580,9 @@ void Mats2Datum(const Mat &img1, const Mat &img2, Datum *datum) {
   datum->clear_data();
   datum->clear_float_data();
   datum->set_encoded(false);
-  int datum_channels = datum->channels();
-  int datum_height = datum->height();
-  int datum_width = datum->width();
-  int datum_size = datum_channels * datum_height * datum_width;
+  int datum_size = datum->channels() * datum->height() * datum->width();
   string buffer(datum_size, ' ');
-
-  for (int h = 0; h < datum_height; ++h) {
-    const uchar *ptr1 = img1.ptr<uchar>(h);
-    const uchar *ptr2 = img2.ptr<uchar>(h);
-    int img_index = 0;
-    for (int w = 0; w < datum_width; ++w) {
-      for (int c = 0; c < datum_channels / 2; ++c) {
-        int datum_index = (c * datum_height + h) * datum_width + w;
-        buffer[datum_index] = static_cast<char>(ptr1[img_index]);
-        datum_index = ((c + datum_channels / 2) * datum_height + h) * datum_width + w;
-        buffer[datum_index] = static_cast<char>(ptr2[img_index++]);
-      }
-    }
-  }
+  Mats2CHW(img1, img2, &buffer[0]);
   datum->set_data(buffer);
 }
 
@@ -138,21 +594,36 @@ void Mat2Datum(const Mat &img, Datum *datum) {
   datum->clear_data();
   datum->clear_float_data();
   datum->set_encoded(false);
-  int datum_channels = datum->channels();
-  int datum_height = datum->height();
-  int datum_width = datum->width();
-  int datum_size = datum_channels * datum_height * datum_width;
+  int datum_size = datum->channels() * datum->height() * datum->width();
   string buffer(datum_size, ' ');
+  Mat2CHW(img, &buffer[0]);
+  datum->set_data(buffer);
+}
 
-  for (int h = 0; h < datum_height; ++h) {
-    const uchar *ptr = img.ptr<uchar>(h);
-    int img_index = 0;
-    for (int w = 0; w < datum_width; ++w) {
-      for (int c = 0; c < datum_channels; ++c) {
-        int datum_index = (c * datum_height + h) * datum_width + w;
-        buffer[datum_index] = static_cast<char>(ptr[img_index++]);
-      }
-    }
+/*
+ * Copies the two HWC images in dst as a single CHW image: the channels of
+ * img1 first and then the channels of img2. Both images are transposed in
+ * the same pass over the rows (see chw_kernels.hpp).
+ */
+void Mats2CHW(const Mat &img1, const Mat &img2, char *dst) {
+  assert(img1.depth() == CV_8U && img2.depth() == CV_8U);
+  size_t plane = img1.rows * img1.cols;
+  char *dst2 = dst + img1.channels() * plane;
+
+  for (int h = 0; h < img1.rows; ++h) {
+    hwc_to_planes(img1.ptr<uchar>(h), img1.cols, img1.channels(), dst + h * img1.cols, plane);
+    hwc_to_planes(img2.ptr<uchar>(h), img2.cols, img2.channels(), dst2 + h * img2.cols, plane);
+  }
+}
+
+void Mat2CHW(const Mat &img, char *dst) {
+  assert(img.depth() == CV_8U);
+  size_t plane = img.rows * img.cols;
+  if (img.isContinuous()) {
+    hwc_to_planes(img.ptr<uchar>(0), plane, img.channels(), dst, plane);
+    return;
+  }
+  for (int h = 0; h < img.rows; ++h) {
+    hwc_to_planes(img.ptr<uchar>(h), img.cols, img.channels(), dst + h * img.cols, plane);
   }
-  datum->set_data(buffer);
 }
@@ -5,6 +5,14 @@
 #include <iomanip>
 #include <sys/stat.h>
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 #include <lmdb.h>
@@ -13,8 +21,18 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/io.hpp"
+#include "build_metrics.hpp"
+#include "chw_kernels.hpp"
+#include "datum_codec.hpp"
+#include "datum_writer.hpp"
+#include "lmdb_shards.hpp"
+#include "mean_accumulator.hpp"
+#include "mpsc_ring.hpp"
 
 #define TB 1099511627776
+// Key of the checkpoint of an unfinished build. It sorts after the "%08u"
+// keys of the records, so a cursor finds it last.
+#define CHECKPOINT_KEY "checkpoint"
 
 using namespace std;
 using namespace cv;
@@ -25,6 +43,63 @@ typedef unsigned char Label;
 
 void Mats2Datum(const Mat &img1, const Mat &img2, Datum *datum);
 void Mat2Datum(const Mat &img, Datum *datum);
+// Write the pixels of the images in dst in the channel-major order used by Datum
+void Mats2CHW(const Mat &img1, const Mat &img2, char *dst);
+void Mat2CHW(const Mat &img, char *dst);
+
+/*
+ * One element to be written in the database: a single image (img1), a pair
+ * of images (img1 and img2), a vector of labels, a pair of images with its
+ * vector of labels, or an already serialized Datum (value). The Mats are
+ * just references, no pixels are copied when a record is created.
+ */
+typedef struct {
+  Mat img1;
+  Mat img2;
+  int label;
+  vector<Label> labels;
+  string value;
+  long key; // -1: the next key in insertion order
+} LMRecord;
+
+struct LMDataBaseOptions {
+  // Write the records from a dedicated thread. insert2db() only hands the
+  // record over to the writer and returns (it blocks if the queue is full).
+  bool async;
+  // Maximum number of records waiting for the writer thread (async only)
+  size_t queue_capacity;
+  // Records per LMDB transaction
+  unsigned int commit_interval;
+  // Write K LMDBs in parallel (one writer thread each) instead of one, see lmdb_shards.hpp
+  unsigned int num_shards;
+  // Print the progress (about once per second) and a summary at the end
+  bool verbose;
+  // Payload of the image records (see datum_codec.hpp). The images are encoded
+  // by the writer thread(s), use encode_datum() to encode them somewhere else.
+  DatumCodec codec;
+  // If not empty, the mean of the images is computed while they are written
+  // and saved here as a binaryproto when the database is closed (the same
+  // file as compute_image_mean). The mean and standard deviation of every
+  // channel are printed too. All the images must have the same size.
+  string mean_file;
+  // Crash-safe builds: every commit also stores a checkpoint (the number of
+  // records written so far and build_params) under CHECKPOINT_KEY, in the
+  // same transaction as the records. It is deleted when the database is
+  // closed, so only the databases of unfinished builds have one.
+  bool checkpoint;
+  // Whatever determines the records of the build (the options of the tool),
+  // a build is only resumed with the same build_params
+  string build_params;
+  // Continue the build of an existing database after the records it already
+  // has (see resumed_records()), with the same keys and the same mean as if
+  // the build had never stopped. Throws runtime_error if its checkpoint has
+  // other build_params. Not with num_shards > 1.
+  bool resume;
+
+  LMDataBaseOptions()
+      : async(false), queue_capacity(256), commit_interval(1000), num_shards(1), verbose(true), checkpoint(false),
+        resume(false) {}
+};
 
 class LMDataBase {
 public:
@@ -54,26 +129,92 @@ public:
    * LMDataBase(path, 3, 1)   for 3 int labels                 *
    * LMDataBase(path, 6, 224) for 3 channels images of 224x224 *
    * LMDataBase(path, 2, 28)  for 1 channel images of 28x28    *
+   *                                                           *
+   * With options.async the Datum conversion, serialization,   *
+   * puts and commits run in a writer thread, so the caller    *
+   * can keep decoding/transforming images in the meantime.    *
+   * The records are written in the order they were inserted. *
+   *                                                           *
+   * With options.num_shards > 1 lmdb_path is a directory of   *
+   * LMDBs written in parallel (see lmdb_shards.hpp). Use      *
+   * merge_lmdb_shards to get a single database for Caffe.     *
    *************************************************************/
-  LMDataBase(string lmdb_path, size_t dat_channels, size_t dat_size);
-  ~LMDataBase() {
-    close_env_lmdb();
-    cout << "\nFinished creation of LMDB with " << num_inserts << " pairs of images.\n";
-  };
+  LMDataBase(string lmdb_path, size_t dat_channels, size_t dat_size,
+             const LMDataBaseOptions &options = LMDataBaseOptions());
+  ~LMDataBase() noexcept(false);
   void insert2db(const Mat &img, int label);
   void insert2db(const Mat &img1, const Mat &img2, int label);
   void insert2db(const vector<Label> &labels);
+  // Same, but the record is stored under the given key instead of the next one.
+  // This allows writing the records in any order and still get a given order in
+  // the database (LMDB cursors always iterate in key order).
+  void insert2db(const Mat &img1, const Mat &img2, int label, unsigned int key);
+  void insert2db(const vector<Label> &labels, unsigned int key);
+  void insert2db(const Mat &img, int label, unsigned int key);
+  // A pair of images and its vector of labels in a single record: the labels
+  // go in the float_data field of the Datum. One database (and one cursor
+  // during training) instead of two kept in lockstep.
+  void insert2db(const Mat &img1, const Mat &img2, int label, const vector<Label> &labels, unsigned int key);
+  // Stores an already serialized Datum as it is
+  void insert2db(const string &serialized_datum, unsigned int key);
+  // Blocks until every record inserted so far is committed to disk
+  void flush();
+  // insert2db() and flush() throw runtime_error if a put or a commit failed
+  // (in async mode, the ones of the writer thread so far). The database is
+  // not written after the first error: it keeps the records of the last
+  // commit, and the build can be resumed from its checkpoint.
+  // Records that the database already had when it was opened with
+  // options.resume: the first records of the build, that must not be
+  // inserted again. All of them if the build had finished. 0 without resume.
+  unsigned int resumed_records() const { return num_resumed; }
 
 private:
   MDB_env *mdb_env;
   MDB_dbi mdb_dbi;
   MDB_val mdb_key, mdb_data;
   MDB_txn *mdb_txn;
+  string lmdb_path;
   size_t datum_channels;
   size_t datum_size;
   unsigned int num_inserts;
+  unsigned int num_uncommitted;
+  unsigned int num_resumed;
+  LMDataBaseOptions options;
+  ProgressReporter progress;
+
+  // Sharded output: the records are just handed over to the shards
+  vector<LMDataBase *> shards;
+  vector<ShardInfo> shard_info;
+
+  // Sums of the images for options.mean_file (one per shard with num_shards > 1)
+  MeanAccumulator *mean;
+  vector<char> mean_pixels; // CHW pixels of the records that are not written as CHW
+
+  // Async writer state
+  MPSCRing<LMRecord> *queue;
+  thread writer;
+  atomic<bool> stopping;
+  atomic<unsigned long> num_queued;
+  atomic<unsigned long> flush_target;
+  unsigned long num_committed; // protected by flush_mutex
+  mutex flush_mutex;
+  condition_variable flushed;
+  // First error of a put or a commit, nothing is written after it
+  exception_ptr write_error; // protected by flush_mutex
+  atomic<bool> failed;
 
-  void save_data_to_lmdb(string &data_value);
+  void submit(LMRecord &record);
+  void write_record(const LMRecord &record);
+  void add_to_mean(const LMRecord &record);
+  void save_mean();
+  void writer_loop();
+  void wait_for_writer();
+  void fail(exception_ptr error);
+  void rethrow_write_error();
+  char *reserve_in_lmdb(unsigned int key, size_t size);
+  void record_saved();
+  void resume_build();
+  void save_checkpoint();
   void commit_data_to_lmdb();
   void close_env_lmdb(); 
 };
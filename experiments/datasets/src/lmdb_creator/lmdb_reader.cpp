@@ -0,0 +1,147 @@
+#include "lmdb_reader.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+#define TB 1099511627776
+
+LMDataBaseReader::LMDataBaseReader(const string &lmdb_path)
+    : mdb_env(NULL), mdb_txn(NULL), mdb_cursor(NULL), num_records(0), started(false) {
+  int rc = mdb_env_create(&mdb_env);
+  if (rc == MDB_SUCCESS) {
+    mdb_env_set_mapsize(mdb_env, TB);
+    rc = mdb_env_open(mdb_env, lmdb_path.c_str(), MDB_RDONLY | MDB_NOTLS, 0664);
+  }
+  if (rc == MDB_SUCCESS) {
+    rc = mdb_txn_begin(mdb_env, NULL, MDB_RDONLY, &mdb_txn);
+  }
+  if (rc == MDB_SUCCESS) {
+    rc = mdb_open(mdb_txn, NULL, 0, &mdb_dbi);
+  }
+  if (rc == MDB_SUCCESS) {
+    rc = mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor);
+  }
+  if (rc != MDB_SUCCESS) {
+    if (mdb_txn != NULL) {
+      mdb_txn_abort(mdb_txn);
+    }
+    mdb_env_close(mdb_env);
+    throw runtime_error("Could not open " + lmdb_path + ": " + mdb_strerror(rc));
+  }
+  MDB_stat stat;
+  mdb_stat(mdb_txn, mdb_dbi, &stat);
+  num_records = stat.ms_entries;
+}
+
+LMDataBaseReader::~LMDataBaseReader() {
+  mdb_cursor_close(mdb_cursor);
+  mdb_txn_abort(mdb_txn);
+  mdb_env_close(mdb_env);
+}
+
+bool LMDataBaseReader::next(MDB_val *key, MDB_val *value) {
+  int rc = mdb_cursor_get(mdb_cursor, key, value, started ? MDB_NEXT : MDB_FIRST);
+  started = true;
+  if (rc == MDB_NOTFOUND) {
+    return false;
+  }
+  if (rc != MDB_SUCCESS) {
+    throw runtime_error(string("Could not read the database: ") + mdb_strerror(rc));
+  }
+  return true;
+}
+
+unsigned int lmdb_key_to_uint(const MDB_val &key) {
+  const char *digits = static_cast<const char *>(key.mv_data);
+  unsigned int value = 0;
+  for (size_t i = 0; i < key.mv_size; ++i) {
+    if (digits[i] < '0' || digits[i] > '9') {
+      throw runtime_error("Not a numeric key: " + string(digits, key.mv_size));
+    }
+    value = value * 10 + (digits[i] - '0');
+  }
+  return value;
+}
+
+vector<string> LMDataBaseReader::split_keys(unsigned int parts) {
+  vector<string> splits(1, "");
+  MDB_val key, value;
+  started = false;
+  if (parts > 1 && next(&key, &value)) {
+    try {
+      size_t width = key.mv_size;
+      unsigned long first = lmdb_key_to_uint(key);
+      if (mdb_cursor_get(mdb_cursor, &key, &value, MDB_LAST) != MDB_SUCCESS || key.mv_size != width) {
+        throw runtime_error("Keys of different lengths");
+      }
+      unsigned long last = lmdb_key_to_uint(key);
+      unsigned long step = max((last - first + 1 + parts - 1) / parts, 1UL);
+      for (unsigned long split = first + step; split <= last; split += step) {
+        // Same zero-padding as the keys, so they compare the same way
+        char key_str[24];
+        snprintf(key_str, sizeof(key_str), "%0*lu", (int)width, split);
+        splits.push_back(key_str);
+      }
+    } catch (const runtime_error &) {
+      splits.resize(1);
+    }
+  }
+  started = false;
+  splits.push_back("");
+  return splits;
+}
+
+LMDataBaseRangeReader::LMDataBaseRangeReader(const LMDataBaseReader &reader, const string &begin, const string &end)
+    : mdb_txn(NULL), mdb_cursor(NULL), mdb_dbi(reader.mdb_dbi), begin(begin), end(end), started(false),
+      finished(false) {
+  // Every range has its own read transaction (the environment is opened with MDB_NOTLS)
+  int rc = mdb_txn_begin(reader.mdb_env, NULL, MDB_RDONLY, &mdb_txn);
+  if (rc == MDB_SUCCESS) {
+    rc = mdb_cursor_open(mdb_txn, mdb_dbi, &mdb_cursor);
+  }
+  if (rc != MDB_SUCCESS) {
+    if (mdb_txn != NULL) {
+      mdb_txn_abort(mdb_txn);
+    }
+    throw runtime_error(string("Could not read the database: ") + mdb_strerror(rc));
+  }
+}
+
+LMDataBaseRangeReader::~LMDataBaseRangeReader() {
+  mdb_cursor_close(mdb_cursor);
+  mdb_txn_abort(mdb_txn);
+}
+
+bool LMDataBaseRangeReader::next(MDB_val *key, MDB_val *value) {
+  if (finished) {
+    return false;
+  }
+  int rc;
+  if (started) {
+    rc = mdb_cursor_get(mdb_cursor, key, value, MDB_NEXT);
+  } else if (begin.empty()) {
+    rc = mdb_cursor_get(mdb_cursor, key, value, MDB_FIRST);
+  } else {
+    key->mv_size = begin.size();
+    key->mv_data = const_cast<char *>(begin.data());
+    rc = mdb_cursor_get(mdb_cursor, key, value, MDB_SET_RANGE);
+  }
+  started = true;
+  if (rc == MDB_NOTFOUND) {
+    finished = true;
+    return false;
+  }
+  if (rc != MDB_SUCCESS) {
+    throw runtime_error(string("Could not read the database: ") + mdb_strerror(rc));
+  }
+  if (!end.empty()) {
+    MDB_val end_key;
+    end_key.mv_size = end.size();
+    end_key.mv_data = const_cast<char *>(end.data());
+    if (mdb_cmp(mdb_txn, mdb_dbi, key, &end_key) >= 0) {
+      finished = true;
+      return false;
+    }
+  }
+  return true;
+}
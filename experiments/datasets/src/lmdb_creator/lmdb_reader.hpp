@@ -0,0 +1,85 @@
+#ifndef _LMDB_READER_
+#define _LMDB_READER_
+#include <lmdb.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Read-only cursor over all the records of a LMDB, in key order.
+ *
+ * The keys and values returned by next() point straight into the memory map
+ * of the database: they are not copied and they are only valid until the
+ * next call to next() or until the reader is destroyed.
+ *
+ *   LMDataBaseReader reader(path);
+ *   MDB_val key, value;
+ *   while (reader.next(&key, &value)) {
+ *     datum.ParseFromArray(value.mv_data, value.mv_size);
+ *   }
+ *
+ * Several threads can read the same database at the same time, each one
+ * with a LMDataBaseRangeReader over its own range of keys:
+ *
+ *   vector<string> splits = reader.split_keys(num_threads);
+ *   // thread i
+ *   LMDataBaseRangeReader range(reader, splits[i], splits[i + 1]);
+ *   while (range.next(&key, &value)) { ... }
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+
+class LMDataBaseReader {
+public:
+  // Throws runtime_error if the database can not be opened
+  explicit LMDataBaseReader(const string &lmdb_path);
+  ~LMDataBaseReader();
+
+  size_t size() const { return num_records; }
+  bool next(MDB_val *key, MDB_val *value);
+  // Goes back to the first record
+  void rewind() { started = false; }
+  /*
+   * Keys that split the database in at most parts ranges [splits[i],
+   * splits[i + 1]) of about the same number of records. The first and the
+   * last splits are empty strings: from the first record, up to the last
+   * one. The numeric keys of LMDataBase are split by value, any other keys
+   * give a single range. Rewinds the reader.
+   */
+  vector<string> split_keys(unsigned int parts);
+
+private:
+  friend class LMDataBaseRangeReader;
+
+  MDB_env *mdb_env;
+  MDB_dbi mdb_dbi;
+  MDB_txn *mdb_txn;
+  MDB_cursor *mdb_cursor;
+  size_t num_records;
+  bool started;
+};
+
+/* Read-only cursor over the records of a range of keys of a LMDataBaseReader, in key order */
+class LMDataBaseRangeReader {
+public:
+  // Records with begin <= key < end. An empty begin is the first record, an empty end is past the last one
+  LMDataBaseRangeReader(const LMDataBaseReader &reader, const string &begin, const string &end);
+  ~LMDataBaseRangeReader();
+
+  bool next(MDB_val *key, MDB_val *value);
+
+private:
+  MDB_txn *mdb_txn;
+  MDB_cursor *mdb_cursor;
+  MDB_dbi mdb_dbi;
+  string begin;
+  string end;
+  bool started;
+  bool finished;
+};
+
+// The keys written by LMDataBase are zero-padded decimal numbers
+unsigned int lmdb_key_to_uint(const MDB_val &key);
+#endif
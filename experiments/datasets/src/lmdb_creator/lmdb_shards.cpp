@@ -0,0 +1,66 @@
+#include "lmdb_shards.hpp"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+string shard_name(unsigned int shard) {
+  char name[16];
+  snprintf(name, sizeof(name), "shard_%03u", shard);
+  return name;
+}
+
+void write_shard_manifest(const string &dir, const vector<ShardInfo> &shards) {
+  // Written to a temporary file and renamed, the manifest is either complete or missing
+  string path = dir + "/" + SHARD_MANIFEST;
+  string tmp_path = path + ".tmp";
+  ofstream out(tmp_path.c_str());
+  out << "# shard records first_key last_key\n";
+  out << "shards " << shards.size() << "\n";
+  for (size_t i = 0; i < shards.size(); ++i) {
+    out << shards[i].name << " " << shards[i].records << " " << shards[i].first_key << " " << shards[i].last_key
+        << "\n";
+  }
+  out.close();
+  if (!out || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    throw runtime_error("Could not write " + path);
+  }
+}
+
+vector<ShardInfo> read_shard_manifest(const string &dir) {
+  string path = dir + "/" + SHARD_MANIFEST;
+  ifstream in(path.c_str());
+  if (!in) {
+    throw runtime_error("Could not open " + path);
+  }
+  vector<ShardInfo> shards;
+  size_t num_shards = 0;
+  string line;
+  while (getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    istringstream fields(line);
+    string first;
+    fields >> first;
+    if (first == "shards") {
+      fields >> num_shards;
+      continue;
+    }
+    ShardInfo shard;
+    shard.name = first;
+    if (!(fields >> shard.records >> shard.first_key >> shard.last_key)) {
+      throw runtime_error("Malformed line in " + path + ": " + line);
+    }
+    shards.push_back(shard);
+  }
+  if (shards.size() != num_shards) {
+    throw runtime_error(path + " is incomplete");
+  }
+  return shards;
+}
+
+bool has_shard_manifest(const string &dir) {
+  return access((dir + "/" + SHARD_MANIFEST).c_str(), R_OK) == 0;
+}
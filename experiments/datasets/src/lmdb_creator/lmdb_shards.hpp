@@ -0,0 +1,40 @@
+#ifndef _LMDB_SHARDS_
+#define _LMDB_SHARDS_
+#include <string>
+#include <vector>
+
+/*
+ * Sharded LMDB output.
+ *
+ * A LMDB has a single write transaction, so one database can not be written
+ * by more than one thread. With LMDataBaseOptions::num_shards = K the records
+ * are spread over K LMDBs (record with key k goes to shard k % K), each one
+ * with its own writer thread:
+ *
+ *   lmdb_path/shard_000/  lmdb_path/shard_001/  ...  lmdb_path/manifest.txt
+ *
+ * The manifest lists the shards in order with their number of records and
+ * their first and last keys. merge_lmdb_shards assembles the shards (of one
+ * or several manifests, e.g. parts of a build made in different machines)
+ * into a single LMDB readable by Caffe.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+
+#define SHARD_MANIFEST "manifest.txt"
+
+typedef struct {
+  string name; // directory of the shard, relative to the manifest
+  unsigned long records;
+  long first_key; // -1 if the shard is empty
+  long last_key;
+} ShardInfo;
+
+string shard_name(unsigned int shard);
+void write_shard_manifest(const string &dir, const vector<ShardInfo> &shards);
+// Throws runtime_error if dir has no valid manifest
+vector<ShardInfo> read_shard_manifest(const string &dir);
+bool has_shard_manifest(const string &dir);
+#endif
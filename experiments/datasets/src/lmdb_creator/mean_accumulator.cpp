@@ -0,0 +1,226 @@
+#include "mean_accumulator.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// Bytes whose squares are added in 32 bit lanes before going to 64 bits.
+// Each lane gets at most 2 * 255^2 per vector, far from 2^31 in a block.
+#define SQUARES_BLOCK 65536
+
+MeanAccumulator::MeanAccumulator() : channels(0), height(0), width(0), frames(1), images(0), pending(0) {}
+
+void MeanAccumulator::add(const unsigned char *chw, int channels, int height, int width, int frames) {
+  if (images == 0) {
+    this->channels = channels;
+    this->height = height;
+    this->width = width;
+    this->frames = max(frames, 1);
+    pixel_sums.assign((size_t)channels * height * width, 0);
+    pixel_totals.assign(pixel_sums.size(), 0);
+    channel_squares.assign(channels, 0);
+  } else if (channels != this->channels || height != this->height || width != this->width) {
+    throw runtime_error("The mean needs images of the same size, got " + to_string(channels) + "x" +
+                        to_string(height) + "x" + to_string(width) + " after " + to_string(this->channels) + "x" +
+                        to_string(this->height) + "x" + to_string(this->width));
+  }
+  size_t plane = (size_t)height * width;
+  for (int c = 0; c < channels; ++c) {
+    channel_squares[c] += accumulate_pixels(chw + c * plane, plane, &pixel_sums[c * plane]);
+  }
+  images++;
+  if (++pending == MEAN_FLUSH_INTERVAL) {
+    flush();
+  }
+}
+
+void MeanAccumulator::flush() {
+  for (size_t i = 0; i < pixel_sums.size(); ++i) {
+    pixel_totals[i] += pixel_sums[i];
+    pixel_sums[i] = 0;
+  }
+  pending = 0;
+}
+
+void MeanAccumulator::merge(const MeanAccumulator &other) {
+  if (other.images == 0) {
+    return;
+  }
+  if (images == 0) {
+    *this = other;
+    return;
+  }
+  if (other.channels != channels || other.height != height || other.width != width) {
+    throw runtime_error("Can not merge the means of images of different sizes");
+  }
+  flush();
+  for (size_t i = 0; i < pixel_totals.size(); ++i) {
+    pixel_totals[i] += other.pixel_total(i);
+  }
+  for (int c = 0; c < channels; ++c) {
+    channel_squares[c] += other.channel_squares[c];
+  }
+  images += other.images;
+}
+
+double MeanAccumulator::channel_mean(int c) const {
+  size_t plane = (size_t)height * width;
+  uint64_t sum = 0;
+  for (size_t i = c * plane; i < (c + 1) * plane; ++i) {
+    sum += pixel_total(i);
+  }
+  return (double)sum / ((double)images * plane);
+}
+
+double MeanAccumulator::channel_std(int c) const {
+  double mean = channel_mean(c);
+  double mean_square = (double)channel_squares[c] / ((double)images * height * width);
+  return sqrt(max(mean_square - mean * mean, 0.0));
+}
+
+void MeanAccumulator::write_binaryproto(const string &path) const {
+  caffe::BlobProto blob;
+  blob.set_num(1);
+  blob.set_channels(channels);
+  blob.set_height(height);
+  blob.set_width(width);
+  for (size_t i = 0; i < pixel_totals.size(); ++i) {
+    blob.add_data((float)((double)pixel_total(i) / images));
+  }
+  caffe::WriteProtoToBinaryFile(blob, path.c_str());
+}
+
+void MeanAccumulator::print_stats(ostream &out) const {
+  int frame_channels = channels / frames;
+  for (int f = 0; f < frames; ++f) {
+    out << "Mean of " << images << " images";
+    if (frames > 1) {
+      out << " (frame " << f + 1 << " of " << frames << ")";
+    }
+    out << ":";
+    for (int c = f * frame_channels; c < (f + 1) * frame_channels; ++c) {
+      out << " " << channel_mean(c);
+    }
+    out << ", std:";
+    for (int c = f * frame_channels; c < (f + 1) * frame_channels; ++c) {
+      out << " " << channel_std(c);
+    }
+    out << "\n";
+  }
+  out.flush();
+}
+
+uint64_t accumulate_pixels_scalar(const unsigned char *src, size_t size, uint32_t *sums) {
+  uint64_t squares = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sums[i] += src[i];
+    squares += (uint32_t)src[i] * src[i];
+  }
+  return squares;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2"))) static uint64_t accumulate_pixels_sse2(const unsigned char *src, size_t size,
+                                                                        uint32_t *sums) {
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t squares = 0;
+  size_t i = 0;
+  for (size_t block = 0; block < size; block += SQUARES_BLOCK) {
+    size_t end = min(size, block + SQUARES_BLOCK);
+    __m128i block_squares = zero;
+    for (; i + 16 <= end; i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      __m128i lo = _mm_unpacklo_epi8(v, zero);
+      __m128i hi = _mm_unpackhi_epi8(v, zero);
+      block_squares = _mm_add_epi32(block_squares, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+      __m128i *s = reinterpret_cast<__m128i *>(sums + i);
+      _mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_unpacklo_epi16(lo, zero)));
+      _mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_unpackhi_epi16(lo, zero)));
+      _mm_storeu_si128(s + 2, _mm_add_epi32(_mm_loadu_si128(s + 2), _mm_unpacklo_epi16(hi, zero)));
+      _mm_storeu_si128(s + 3, _mm_add_epi32(_mm_loadu_si128(s + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), block_squares);
+    squares += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  return squares + accumulate_pixels_scalar(src + i, size - i, sums + i);
+}
+
+__attribute__((target("avx2"))) static uint64_t accumulate_pixels_avx2(const unsigned char *src, size_t size,
+                                                                        uint32_t *sums) {
+  uint64_t squares = 0;
+  size_t i = 0;
+  for (size_t block = 0; block < size; block += SQUARES_BLOCK) {
+    size_t end = min(size, block + SQUARES_BLOCK);
+    __m256i block_squares = _mm256_setzero_si256();
+    for (; i + 32 <= end; i += 32) {
+      __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 16));
+      __m256i lo = _mm256_cvtepu8_epi16(v0);
+      __m256i hi = _mm256_cvtepu8_epi16(v1);
+      block_squares =
+          _mm256_add_epi32(block_squares, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+      __m256i *s = reinterpret_cast<__m256i *>(sums + i);
+      _mm256_storeu_si256(s, _mm256_add_epi32(_mm256_loadu_si256(s), _mm256_cvtepu8_epi32(v0)));
+      _mm256_storeu_si256(s + 1, _mm256_add_epi32(_mm256_loadu_si256(s + 1),
+                                                  _mm256_cvtepu8_epi32(_mm_srli_si128(v0, 8))));
+      _mm256_storeu_si256(s + 2, _mm256_add_epi32(_mm256_loadu_si256(s + 2), _mm256_cvtepu8_epi32(v1)));
+      _mm256_storeu_si256(s + 3, _mm256_add_epi32(_mm256_loadu_si256(s + 3),
+                                                  _mm256_cvtepu8_epi32(_mm_srli_si128(v1, 8))));
+    }
+    uint32_t lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), block_squares);
+    for (int l = 0; l < 8; ++l) {
+      squares += lanes[l];
+    }
+  }
+  return squares + accumulate_pixels_scalar(src + i, size - i, sums + i);
+}
+
+#endif
+
+typedef uint64_t (*AccumulateKernel)(const unsigned char *, size_t, uint32_t *);
+
+static const char *select_isa() {
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return "sse2";
+  }
+#endif
+  return "scalar";
+}
+
+const char *accumulate_pixels_isa() {
+  static const char *isa = select_isa();
+  return isa;
+}
+
+static AccumulateKernel select_kernel() {
+#ifdef HAVE_X86_KERNELS
+  const char *isa = accumulate_pixels_isa();
+  if (strcmp(isa, "avx2") == 0) {
+    return accumulate_pixels_avx2;
+  }
+  if (strcmp(isa, "sse2") == 0) {
+    return accumulate_pixels_sse2;
+  }
+#endif
+  return accumulate_pixels_scalar;
+}
+
+uint64_t accumulate_pixels(const unsigned char *src, size_t size, uint32_t *sums) {
+  static const AccumulateKernel kernel = select_kernel();
+  return kernel(src, size, sums);
+}
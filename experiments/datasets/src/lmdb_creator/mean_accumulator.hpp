@@ -0,0 +1,84 @@
+#ifndef _MEAN_ACCUMULATOR_
+#define _MEAN_ACCUMULATOR_
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Mean image and per-channel mean and standard deviation of the images
+ * written to a database, computed while it is written.
+ *
+ * Caffe's compute_image_mean (utils/make_mean.sh) reads the whole LMDB again
+ * to average its Datums. A MeanAccumulator gets the CHW pixels of every
+ * record as they are written and keeps the sum of every pixel, plus the sum
+ * of squares of every channel, so the mean binaryproto is ready when the
+ * database is closed. The sums are exact integers: 32 bit sums per pixel,
+ * moved to 64 bit totals every MEAN_FLUSH_INTERVAL images (so they never
+ * overflow), added with SSE2/AVX2 kernels.
+ *
+ * The records of a pair stack the channels of its two frames, their
+ * statistics are reported per frame.
+ *
+ * It is not thread-safe: every writer has its own and they are merged at
+ * the end.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+
+// Images that fit in 32 bit sums of 8 bit pixels (2^32 / 255 is a bit more)
+#define MEAN_FLUSH_INTERVAL (1 << 24)
+
+class MeanAccumulator {
+public:
+  MeanAccumulator();
+
+  /*
+   * Adds an image of CHW pixels: channels planes of height x width bytes,
+   * like the data of a Datum, with the channels of `frames` images stacked.
+   * Throws runtime_error if the shape is not the one of the first image.
+   */
+  void add(const unsigned char *chw, int channels, int height, int width, int frames = 1);
+  // Adds the images of other, that must have the same shape
+  void merge(const MeanAccumulator &other);
+
+  unsigned long count() const { return images; }
+  double channel_mean(int c) const;
+  double channel_std(int c) const;
+
+  // The mean image as a 1 x C x H x W BlobProto, the same that compute_image_mean writes
+  void write_binaryproto(const string &path) const;
+  // Mean and standard deviation of every channel, for every frame
+  void print_stats(ostream &out) const;
+
+private:
+  int channels;
+  int height;
+  int width;
+  int frames;
+  unsigned long images;
+  unsigned long pending;        // images in pixel_sums
+  vector<uint32_t> pixel_sums;  // since the last flush
+  vector<uint64_t> pixel_totals;
+  vector<uint64_t> channel_squares;
+
+  void flush();
+  uint64_t pixel_total(size_t i) const { return pixel_totals[i] + pixel_sums[i]; }
+};
+
+/*
+ * Adds the size bytes of src to sums (sums[i] += src[i]) and returns the sum
+ * of their squares. The best version for the running CPU is picked the first
+ * time it is called.
+ */
+uint64_t accumulate_pixels(const unsigned char *src, size_t size, uint32_t *sums);
+
+// Always the portable version, regardless of the CPU. Useful to check the others
+uint64_t accumulate_pixels_scalar(const unsigned char *src, size_t size, uint32_t *sums);
+
+// Name of the kernel picked for this CPU ("avx2", "sse2" or "scalar")
+const char *accumulate_pixels_isa();
+#endif
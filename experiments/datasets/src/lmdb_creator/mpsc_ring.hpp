@@ -0,0 +1,120 @@
+#ifndef _MPSC_RING_
+#define _MPSC_RING_
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+/*
+ * Bounded lock-free multi-producer/single-consumer ring buffer.
+ *
+ * Every cell carries a sequence number that tells whether it is free for the
+ * producer that claimed that position or ready for the consumer (D. Vyukov's
+ * bounded queue). Producers claim positions with a CAS on `head`; the single
+ * consumer owns `tail` and does not need atomic read-modify-write operations.
+ *
+ * try_push/try_pop never block. push/pop spin, then yield, then sleep for a
+ * short while, so a producer only waits when the ring is full (backpressure)
+ * and an idle consumer does not burn a core.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+template <typename T> class MPSCRing {
+public:
+  /* capacity is rounded up to a power of two */
+  explicit MPSCRing(size_t capacity) : head(0), tail(0) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask = size - 1;
+    cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t capacity() const { return mask + 1; }
+
+  bool try_push(T &value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false; // full
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T *value) {
+    Cell *cell = &cells[tail & mask];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    if (seq != tail + 1) {
+      return false; // empty (or the producer has not finished writing the cell)
+    }
+    *value = std::move(cell->value);
+    cell->value = T();
+    cell->seq.store(tail + mask + 1, std::memory_order_release);
+    ++tail;
+    return true;
+  }
+
+  void push(T &value) {
+    for (unsigned int spins = 0; !try_push(value); ++spins) {
+      backoff(spins);
+    }
+  }
+
+  /* Waits at most ~max_wait for an element. Returns false if there was none */
+  bool pop(T *value, std::chrono::microseconds max_wait) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + max_wait;
+    for (unsigned int spins = 0; !try_pop(value); ++spins) {
+      if (spins > 64 && std::chrono::steady_clock::now() > deadline) {
+        return false;
+      }
+      backoff(spins);
+    }
+    return true;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  // Keep the producers' and the consumer's indices in different cache lines
+  char pad0[64];
+  std::atomic<size_t> head;
+  char pad1[64];
+  size_t tail;
+
+  static void backoff(unsigned int spins) {
+    if (spins < 16) {
+      return;
+    } else if (spins < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+};
+#endif
@@ -0,0 +1,124 @@
+#ifndef _ORDERED_PIPELINE_
+#define _ORDERED_PIPELINE_
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Small worker pool that computes work(0), work(1), ..., work(num_items-1)
+ * in parallel and hands the results back in index order.
+ *
+ * At most `lookahead` results are in flight (computed but not consumed yet),
+ * so the memory used by the pipeline is bounded no matter how many items
+ * there are. The consumer calls next() until it returns false.
+ *
+ * If work() throws, the exception is rethrown by next() in the consumer thread.
+ *
+ * Usage:
+ *   OrderedPipeline<Mat> p(paths.size(), [&](size_t i) { return imread(paths[i]); }, 8, 32);
+ *   Mat img;
+ *   while (p.next(&img)) { ... }
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+template <typename T> class OrderedPipeline {
+public:
+  OrderedPipeline(size_t num_items, std::function<T(size_t)> work, unsigned int num_workers, size_t lookahead)
+      : num_items(num_items), lookahead(lookahead > 0 ? lookahead : 1), next_claim(0), next_consume(0),
+        slots(this->lookahead), ready(this->lookahead, false), stopping(false), work(work) {
+    if (num_workers == 0) {
+      num_workers = 1;
+    }
+    for (unsigned int i = 0; i < num_workers; ++i) {
+      workers.push_back(std::thread(&OrderedPipeline::worker_loop, this));
+    }
+  }
+
+  ~OrderedPipeline() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stopping = true;
+    }
+    slot_free.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i) {
+      workers[i].join();
+    }
+  }
+
+  /* Blocks until the next item (in index order) is ready and moves it to *item.
+   * Returns false once every item has been consumed.
+   */
+  bool next(T *item) {
+    std::unique_lock<std::mutex> lock(m);
+    if (next_consume >= num_items) {
+      return false;
+    }
+    size_t slot = next_consume % lookahead;
+    item_ready.wait(lock, [&] { return ready[slot] || error; });
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    *item = std::move(slots[slot]);
+    slots[slot] = T();
+    ready[slot] = false;
+    ++next_consume;
+    lock.unlock();
+    slot_free.notify_all();
+    return true;
+  }
+
+  /* Index of the item that the next call to next() will return */
+  size_t position() {
+    std::lock_guard<std::mutex> lock(m);
+    return next_consume;
+  }
+
+private:
+  size_t num_items;
+  size_t lookahead;
+  size_t next_claim;
+  size_t next_consume;
+  std::vector<T> slots;
+  std::vector<bool> ready;
+  bool stopping;
+  std::exception_ptr error;
+  std::function<T(size_t)> work;
+  std::mutex m;
+  std::condition_variable slot_free;
+  std::condition_variable item_ready;
+  std::vector<std::thread> workers;
+
+  void worker_loop() {
+    while (true) {
+      size_t index;
+      {
+        std::unique_lock<std::mutex> lock(m);
+        slot_free.wait(lock, [&] {
+          return stopping || error || next_claim >= num_items || next_claim < next_consume + lookahead;
+        });
+        if (stopping || error || next_claim >= num_items) {
+          return;
+        }
+        index = next_claim++;
+      }
+      try {
+        T result = work(index);
+        std::lock_guard<std::mutex> lock(m);
+        slots[index % lookahead] = std::move(result);
+        ready[index % lookahead] = true;
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(m);
+        if (!error) {
+          error = std::current_exception();
+        }
+        slot_free.notify_all();
+      }
+      item_ready.notify_all();
+    }
+  }
+};
+#endif
@@ -0,0 +1,240 @@
+#include "remap_warp.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define AB_BITS 10 // precision of the source coordinates before rounding them to REMAP_INTER_BITS
+#define INTER_TAB_SIZE (1 << REMAP_INTER_BITS)
+#define PIXELS_PER_STEP 8
+
+void rotation_translation_matrix(float tx, float ty, float rot, int rows, int cols, double m[6]) {
+  // getRotationMatrix2D(Point2f(cols / 2, rows / 2), rot, 1.0)
+  double cx = cols / 2, cy = rows / 2;
+  double angle = rot * CV_PI / 180;
+  double alpha = cos(angle);
+  double beta = sin(angle);
+  m[0] = alpha;
+  m[1] = beta;
+  m[2] = (1 - alpha) * cx - beta * cy + tx;
+  m[3] = -beta;
+  m[4] = alpha;
+  m[5] = beta * cx + (1 - alpha) * cy + ty;
+}
+
+/* Same as invertAffineTransform() */
+static void invert_affine(const double m[6], double inv[6]) {
+  double d = m[0] * m[4] - m[1] * m[3];
+  d = (d != 0) ? 1. / d : 0.;
+  inv[0] = m[4] * d;
+  inv[4] = m[0] * d;
+  inv[1] = -m[1] * d;
+  inv[3] = -m[3] * d;
+  inv[2] = -inv[0] * m[2] - inv[1] * m[5];
+  inv[5] = -inv[3] * m[2] - inv[4] * m[5];
+}
+
+RemapTable::RemapTable(const double m[6], int rows, int cols) : rows(rows), cols(cols) {
+  int padded_cols = cols + 2;
+  if ((size_t)(rows + 2) * padded_cols + 4 > 65536) {
+    throw runtime_error("RemapTable is meant for small images (up to 254x254)");
+  }
+  double a[6];
+  invert_affine(m, a);
+
+  const int ab_scale = 1 << AB_BITS;
+  const int round_delta = ab_scale / INTER_TAB_SIZE / 2;
+  vector<int> adelta(cols), bdelta(cols);
+  for (int x = 0; x < cols; ++x) {
+    adelta[x] = lrint(a[0] * x * ab_scale);
+    bdelta[x] = lrint(a[3] * x * ab_scale);
+  }
+
+  // Rounded up to whole steps of the kernels (the extra pixels are never written)
+  size_t num_pixels = (size_t)rows * cols;
+  size_t table_size = (num_pixels + PIXELS_PER_STEP - 1) / PIXELS_PER_STEP * PIXELS_PER_STEP;
+  offsets.assign(table_size, 0);
+  top.assign(2 * table_size, 0);
+  bottom.assign(2 * table_size, 0);
+  const int weight_scale = 1 << (REMAP_COEF_BITS - 2 * REMAP_INTER_BITS);
+
+  for (int y = 0; y < rows; ++y) {
+    int x0 = lrint((a[1] * y + a[2]) * ab_scale) + round_delta;
+    int y0 = lrint((a[4] * y + a[5]) * ab_scale) + round_delta;
+    for (int x = 0; x < cols; ++x) {
+      int sx = (x0 + adelta[x]) >> (AB_BITS - REMAP_INTER_BITS);
+      int sy = (y0 + bdelta[x]) >> (AB_BITS - REMAP_INTER_BITS);
+      int fx = sx & (INTER_TAB_SIZE - 1);
+      int fy = sy & (INTER_TAB_SIZE - 1);
+      sx >>= REMAP_INTER_BITS;
+      sy >>= REMAP_INTER_BITS;
+      // Blocks completely outside of the image are black (null weights)
+      if (sx < -1 || sx >= cols || sy < -1 || sy >= rows) {
+        continue;
+      }
+      size_t i = (size_t)y * cols + x;
+      offsets[i] = (sy + 1) * padded_cols + (sx + 1);
+      top[2 * i] = (INTER_TAB_SIZE - fy) * (INTER_TAB_SIZE - fx) * weight_scale;
+      top[2 * i + 1] = (INTER_TAB_SIZE - fy) * fx * weight_scale;
+      bottom[2 * i] = fy * (INTER_TAB_SIZE - fx) * weight_scale;
+      bottom[2 * i + 1] = fy * fx * weight_scale;
+    }
+  }
+}
+
+void pad_for_remap(const Mat &img, vector<uchar> *padded) {
+  assert(img.type() == CV_8UC1);
+  int padded_cols = img.cols + 2;
+  // 4 extra bytes: the AVX2 kernel reads 32 bits per pixel
+  padded->assign((size_t)(img.rows + 2) * padded_cols + 4, 0);
+  for (int y = 0; y < img.rows; ++y) {
+    memcpy(&(*padded)[(y + 1) * padded_cols + 1], img.ptr<uchar>(y), img.cols);
+  }
+}
+
+void remap_warp_scalar(const uchar *padded, const RemapTable &table, uchar *dst) {
+  size_t num_pixels = (size_t)table.rows * table.cols;
+  int padded_cols = table.cols + 2;
+  for (size_t i = 0; i < num_pixels; ++i) {
+    const uchar *p = padded + table.offsets[i];
+    int v = p[0] * table.top[2 * i] + p[1] * table.top[2 * i + 1] + p[padded_cols] * table.bottom[2 * i] +
+            p[padded_cols + 1] * table.bottom[2 * i + 1];
+    dst[i] = (v + (1 << (REMAP_COEF_BITS - 1))) >> REMAP_COEF_BITS;
+  }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+static inline uint16_t load_pair(const uchar *p) {
+  uint16_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/*
+ * Each 16-bit load brings the two pixels of a row of the block, which are
+ * widened to 16 bits and multiplied by their weights with pmaddwd.
+ */
+__attribute__((target("sse2"))) static void remap_warp_sse2(const uchar *padded, const RemapTable &table,
+                                                            uchar *dst) {
+  size_t num_pixels = (size_t)table.rows * table.cols;
+  int padded_cols = table.cols + 2;
+  const uint16_t *off = &table.offsets[0];
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi32(1 << (REMAP_COEF_BITS - 1));
+  size_t i = 0;
+  for (; i + PIXELS_PER_STEP <= num_pixels; i += PIXELS_PER_STEP) {
+    const uchar *p = padded;
+    __m128i t = _mm_setr_epi16(load_pair(p + off[i]), load_pair(p + off[i + 1]), load_pair(p + off[i + 2]),
+                               load_pair(p + off[i + 3]), load_pair(p + off[i + 4]), load_pair(p + off[i + 5]),
+                               load_pair(p + off[i + 6]), load_pair(p + off[i + 7]));
+    p += padded_cols;
+    __m128i b = _mm_setr_epi16(load_pair(p + off[i]), load_pair(p + off[i + 1]), load_pair(p + off[i + 2]),
+                               load_pair(p + off[i + 3]), load_pair(p + off[i + 4]), load_pair(p + off[i + 5]),
+                               load_pair(p + off[i + 6]), load_pair(p + off[i + 7]));
+    const __m128i *wt = reinterpret_cast<const __m128i *>(&table.top[2 * i]);
+    const __m128i *wb = reinterpret_cast<const __m128i *>(&table.bottom[2 * i]);
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(t, zero), _mm_loadu_si128(wt)),
+                               _mm_madd_epi16(_mm_unpacklo_epi8(b, zero), _mm_loadu_si128(wb)));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi8(t, zero), _mm_loadu_si128(wt + 1)),
+                               _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), _mm_loadu_si128(wb + 1)));
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), REMAP_COEF_BITS);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), REMAP_COEF_BITS);
+    __m128i v = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(v, v));
+  }
+  for (; i < num_pixels; ++i) {
+    const uchar *p = padded + off[i];
+    int v = p[0] * table.top[2 * i] + p[1] * table.top[2 * i + 1] + p[padded_cols] * table.bottom[2 * i] +
+            p[padded_cols + 1] * table.bottom[2 * i + 1];
+    dst[i] = (v + (1 << (REMAP_COEF_BITS - 1))) >> REMAP_COEF_BITS;
+  }
+}
+
+/*
+ * Same as the SSE2 version, but the two pixels of each row of the 8 blocks
+ * are fetched with a single gather (32 bits each, the upper half is masked).
+ */
+__attribute__((target("avx2"))) static void remap_warp_avx2(const uchar *padded, const RemapTable &table,
+                                                            uchar *dst) {
+  size_t num_pixels = (size_t)table.rows * table.cols;
+  int padded_cols = table.cols + 2;
+  const int *base = reinterpret_cast<const int *>(padded);
+  const __m256i low_byte = _mm256_set1_epi32(0xFF);
+  const __m256i round = _mm256_set1_epi32(1 << (REMAP_COEF_BITS - 1));
+  const __m256i next_row = _mm256_set1_epi32(padded_cols);
+  size_t i = 0;
+  for (; i + PIXELS_PER_STEP <= num_pixels; i += PIXELS_PER_STEP) {
+    __m256i off = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(&table.offsets[i])));
+    __m256i t = _mm256_i32gather_epi32(base, off, 1);
+    __m256i b = _mm256_i32gather_epi32(base, _mm256_add_epi32(off, next_row), 1);
+    // (p0 | p1 << 8) -> (p0 | p1 << 16), two 16-bit lanes for pmaddwd
+    t = _mm256_or_si256(_mm256_and_si256(t, low_byte), _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(t, 8), low_byte), 16));
+    b = _mm256_or_si256(_mm256_and_si256(b, low_byte), _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(b, 8), low_byte), 16));
+    __m256i v = _mm256_add_epi32(
+        _mm256_madd_epi16(t, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&table.top[2 * i]))),
+        _mm256_madd_epi16(b, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&table.bottom[2 * i]))));
+    v = _mm256_srai_epi32(_mm256_add_epi32(v, round), REMAP_COEF_BITS);
+    __m128i v16 = _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(v16, v16));
+  }
+  for (; i < num_pixels; ++i) {
+    const uchar *p = padded + table.offsets[i];
+    int v = p[0] * table.top[2 * i] + p[1] * table.top[2 * i + 1] + p[padded_cols] * table.bottom[2 * i] +
+            p[padded_cols + 1] * table.bottom[2 * i + 1];
+    dst[i] = (v + (1 << (REMAP_COEF_BITS - 1))) >> REMAP_COEF_BITS;
+  }
+}
+#endif
+
+typedef void (*RemapKernel)(const uchar *, const RemapTable &, uchar *);
+
+static const char *select_isa() {
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return "avx2";
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return "sse2";
+  }
+#endif
+  return "scalar";
+}
+
+const char *remap_warp_isa() {
+  static const char *isa = select_isa();
+  return isa;
+}
+
+static RemapKernel select_kernel() {
+#ifdef HAVE_X86_KERNELS
+  const char *isa = remap_warp_isa();
+  if (strcmp(isa, "avx2") == 0) {
+    return remap_warp_avx2;
+  }
+  if (strcmp(isa, "sse2") == 0) {
+    return remap_warp_sse2;
+  }
+#endif
+  return remap_warp_scalar;
+}
+
+void remap_warp(const uchar *padded, const RemapTable &table, uchar *dst) {
+  static const RemapKernel kernel = select_kernel();
+  kernel(padded, table, dst);
+}
+
+Mat remap_warp(const Mat &img, const RemapTable &table) {
+  assert(img.rows == table.rows && img.cols == table.cols);
+  vector<uchar> padded;
+  pad_for_remap(img, &padded);
+  Mat res(table.rows, table.cols, CV_8UC1);
+  remap_warp(&padded[0], table, res.ptr<uchar>(0));
+  return res;
+}
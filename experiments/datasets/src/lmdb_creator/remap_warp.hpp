@@ -0,0 +1,70 @@
+#ifndef _REMAP_WARP_
+#define _REMAP_WARP_
+#include "opencv2/core/core.hpp"
+#include <cstdint>
+#include <vector>
+
+/*
+ * Bilinear affine warps of small single-channel 8-bit images through
+ * precomputed remap tables.
+ *
+ * A RemapTable holds, for every pixel of the output, the position of its 2x2
+ * block of source pixels and the four fixed-point bilinear weights. The table
+ * is computed exactly like warpAffine(INTER_LINEAR, BORDER_CONSTANT 0) does
+ * it: inverse matrix, source coordinates in 1/1024 pixels rounded to 1/32
+ * pixels and weights that are products of 1/32 fractions. Those weights are
+ * exact in 14 bits, so the result is the one of OpenCV's generic code (IPP
+ * builds may differ by 1 in some pixels).
+ *
+ * The source image is read from a copy with a border of one black pixel
+ * (pad_for_remap()), so the pixels on the borders need no special case: the
+ * blocks outside of the image just have null weights. The kernels (SSE2 and
+ * AVX2, picked for the running CPU) do 8 pixels at a time.
+ *
+ * Building a table costs about the same as a warp, so they pay off when the
+ * same transformations are used over and over (see MnistWarpTables).
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+using namespace cv;
+
+#define REMAP_INTER_BITS 5  // source coordinates in 1/32 pixels, like OpenCV
+#define REMAP_COEF_BITS 14  // weights sum 1 << 14
+
+class RemapTable {
+public:
+  RemapTable() : rows(0), cols(0) {}
+  // m: 2x3 matrix (row-major) that maps source to destination points, like the one of warpAffine
+  RemapTable(const double m[6], int rows, int cols);
+
+  int rows;
+  int cols;
+  // Per output pixel: offset of the top-left pixel of its block in the padded
+  // source, and the weights of the top (w00, w01) and bottom (w10, w11) pixels
+  vector<uint16_t> offsets;
+  vector<int16_t> top;
+  vector<int16_t> bottom;
+};
+
+/*
+ * The 2x3 matrix of transform_image(): rotation of rot degrees around the
+ * center of the image plus a translation of (tx, ty) pixels. Same values as
+ * getRotationMatrix2D() plus the translation.
+ */
+void rotation_translation_matrix(float tx, float ty, float rot, int rows, int cols, double m[6]);
+
+// Copies img (CV_8UC1) in padded with a black border of one pixel, as the kernels expect it
+void pad_for_remap(const Mat &img, vector<uchar> *padded);
+
+// Writes the rows * cols pixels of the warped image in dst
+void remap_warp(const uchar *padded, const RemapTable &table, uchar *dst);
+Mat remap_warp(const Mat &img, const RemapTable &table);
+
+// Always the portable version, regardless of the CPU. Useful to check the others
+void remap_warp_scalar(const uchar *padded, const RemapTable &table, uchar *dst);
+
+// Name of the kernel picked for this CPU ("avx2", "sse2" or "scalar")
+const char *remap_warp_isa();
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Converts between the usual siamese LMDBs (pairs of images made with
+ * insert2db(img1, img2, label), plus an optional LMDB of labels with the same
+ * keys) and a frame store (see frame_store.hpp).
+ *
+ *   to-frames  every image of every pair is hashed and stored once in the
+ *              frames of the store; the pairs only keep the ids of their two
+ *              frames, the label and the labels. Works with any database of
+ *              pairs, but only saves space when the same images are in several
+ *              pairs (e.g. MNIST, or KITTI without random crops).
+ *   to-pairs   materializes every pair of the store and writes the two LMDBs
+ *              again, with the keys of the pairs.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+#include "frame_store.hpp"
+#include "lmdb_creator.hpp"
+#include "lmdb_reader.hpp"
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef pair<uint64_t, uint64_t> FrameHash;
+
+/* Two independent 64 bit FNV-1a hashes, enough to tell millions of images apart */
+static FrameHash hash_frame(const char *data, size_t size) {
+  uint64_t h1 = 14695981039346656037ULL;
+  uint64_t h2 = 0x84222325cbf29ce4ULL ^ size;
+  for (size_t i = 0; i < size; ++i) {
+    unsigned char b = data[i];
+    h1 = (h1 ^ b) * 1099511628211ULL;
+    h2 = (h2 ^ b) * 0x100000001b3ULL;
+    h2 ^= h2 >> 29;
+  }
+  return FrameHash(h1, h2);
+}
+
+/* One of the images of a pair of CHW pixels (channels / 2 channels each) as a HWC Mat */
+static Mat chw_half_to_mat(const char *chw, int channels, int height, int width) {
+  Mat img(height, width, CV_8UC(channels));
+  size_t plane = (size_t)height * width;
+  for (int h = 0; h < height; ++h) {
+    uchar *row = img.ptr<uchar>(h);
+    for (int w = 0; w < width; ++w) {
+      for (int c = 0; c < channels; ++c) {
+        row[w * channels + c] = chw[c * plane + h * width + w];
+      }
+    }
+  }
+  return img;
+}
+
+static uint32_t find_or_add_frame(const char *chw, int channels, int height, int width,
+                                  map<FrameHash, uint32_t> *known, FrameStoreWriter *store) {
+  FrameHash hash = hash_frame(chw, (size_t)channels * height * width);
+  map<FrameHash, uint32_t>::iterator it = known->find(hash);
+  if (it != known->end()) {
+    return it->second;
+  }
+  uint32_t id = store->add_frame(chw_half_to_mat(chw, channels, height, width));
+  (*known)[hash] = id;
+  return id;
+}
+
+void to_frames(const string &data_path, const string &labels_path, const string &store_path,
+               const DatumCodec &codec) {
+  LMDataBaseReader data(data_path);
+  LMDataBaseReader *labels = labels_path.empty() ? NULL : new LMDataBaseReader(labels_path);
+  if (labels != NULL && labels->size() != data.size()) {
+    throw runtime_error(data_path + " and " + labels_path + " do not have the same number of records");
+  }
+  FrameStoreWriter store(store_path, codec);
+  map<FrameHash, uint32_t> known;
+
+  MDB_val key, value, labels_key, labels_value;
+  Datum datum, labels_datum;
+  vector<char> chw;
+  while (data.next(&key, &value)) {
+    if (!datum.ParseFromArray(value.mv_data, value.mv_size) || datum.channels() % 2 != 0) {
+      throw runtime_error("Not a pair of images: " + string(static_cast<char *>(key.mv_data), key.mv_size));
+    }
+    int channels = datum.channels() / 2;
+    size_t image_size = (size_t)channels * datum.height() * datum.width();
+    chw.resize(2 * image_size);
+    decode_datum_data(datum.data().data(), datum.data().size(), datum.encoded(), datum.channels(), datum.height(),
+                      datum.width(), &chw[0]);
+
+    PairEntry pair = make_pair_entry(
+        find_or_add_frame(&chw[0], channels, datum.height(), datum.width(), &known, &store),
+        find_or_add_frame(&chw[image_size], channels, datum.height(), datum.width(), &known, &store));
+    pair.label = datum.has_label() ? datum.label() : -1;
+
+    string pair_labels;
+    if (labels != NULL) {
+      labels->next(&labels_key, &labels_value);
+      if (lmdb_key_to_uint(labels_key) != lmdb_key_to_uint(key) ||
+          !labels_datum.ParseFromArray(labels_value.mv_data, labels_value.mv_size)) {
+        throw runtime_error("The labels of " + string(static_cast<char *>(key.mv_data), key.mv_size) +
+                            " are not in " + labels_path);
+      }
+      pair_labels = labels_datum.data();
+    } else {
+      for (int i = 0; i < datum.float_data_size(); ++i) {
+        pair_labels.push_back(datum.float_data(i));
+      }
+    }
+    if (pair_labels.size() > FRAME_STORE_MAX_LABELS) {
+      throw runtime_error("A pair can not have more than " + to_string(FRAME_STORE_MAX_LABELS) + " labels");
+    }
+    pair.num_labels = pair_labels.size();
+    memcpy(pair.labels, pair_labels.data(), pair_labels.size());
+    store.add_pair(pair, lmdb_key_to_uint(key));
+  }
+  delete labels;
+
+  cout << "Stored " << store.num_pairs() << " pairs with " << store.num_frames() << " distinct frames ("
+       << 2 * store.num_pairs() << " images in " << data_path << ")\n";
+}
+
+void to_pairs(const string &store_path, const string &data_path, bool write_labels) {
+  FrameStoreReader store(store_path);
+  cout << "Reading " << store.num_pairs() << " pairs and " << store.num_frames() << " frames from " << store_path
+       << endl;
+
+  LMDataBase *data_lmdb = NULL;
+  LMDataBase *labels_lmdb = NULL;
+  unsigned int key;
+  PairEntry pair;
+  Mat img1, img2;
+  vector<Label> labels;
+  while (store.next_pair(&key, &pair)) {
+    store.materialize(pair, &img1, &img2);
+    // The databases are created with the shape of the first pair
+    if (data_lmdb == NULL) {
+      data_lmdb = new LMDataBase(data_path, 2 * img1.channels(), img1.rows);
+      if (write_labels) {
+        labels_lmdb = new LMDataBase(data_path + "_labels", pair.num_labels, 1);
+      }
+    }
+    data_lmdb->insert2db(img1, img2, pair.label >= 0 ? pair.label : -10, key);
+    if (labels_lmdb != NULL) {
+      labels.assign(pair.labels, pair.labels + pair.num_labels);
+      labels_lmdb->insert2db(labels, key);
+    }
+  }
+  delete data_lmdb;
+  delete labels_lmdb;
+}
+
+int main(int argc, char **argv) {
+  string mode = argc > 1 ? argv[1] : "";
+  if (mode == "to-frames" && (argc == 5 || argc == 6)) {
+    DatumCodec codec = parse_codec(argc == 6 ? argv[5] : "raw");
+    to_frames(argv[2], string(argv[3]) == "-" ? "" : argv[3], argv[4], codec);
+    return 0;
+  }
+  if (mode == "to-pairs" && (argc == 4 || argc == 5)) {
+    to_pairs(argv[2], argv[3], argc == 5 && string(argv[4]) == "--labels");
+    return 0;
+  }
+  cout << "Usage:\n\n"
+       << argv[0] << " to-frames path/to/data_lmdb path/to/labels_lmdb|- path/to/frame_store [codec]\n"
+       << "    Use - when there is no labels LMDB (the labels of combined databases are\n"
+       << "    taken from float_data). codec is raw, png, jpeg:Q or lz4 (see datum_codec.hpp).\n\n"
+       << argv[0] << " to-pairs path/to/frame_store path/to/new/data_lmdb [--labels]\n"
+       << "    With --labels the labels of the pairs go to the same path + '_labels'.\n\n";
+  return 1;
+}
@@ -0,0 +1,304 @@
+/*
+ * Creates the LMDBs of classification datasets (SUN397, ILSVRC'12) from
+ * lists of images, like Caffe's convert_imageset but for many lists and
+ * sizes at once.
+ *
+ * The lists are the ones of create_SUN_splits.py and create_ILSVRC_splits.py:
+ * one "path label" per line, the path relative to the images root (the root
+ * and the path are just concatenated, like convert_imageset does). Every list
+ * and size gives a LMDB, output_dir/<list name>_<size>_lmdb, with the record
+ * i of the list under the key i (or under its position in a seeded shuffle,
+ * with --shuffle).
+ *
+ * The splits share most of their images, so each image is decoded once no
+ * matter how many lists have it: the images of all the lists are read in
+ * path order by a pool of threads, made square (see SquareMode), resized to
+ * every size and written to the LMDBs of every list that contains them.
+ * There are no intermediate image files: --square=pad does what
+ * preprocess_SUN.py did on disk.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+#include "build_metrics.hpp"
+#include "cli_options.hpp"
+#include "counter_rng.hpp"
+#include "lmdb_creator.hpp"
+#include "ordered_pipeline.hpp"
+#include "opencv2/core/core.hpp"
+#include "opencv2/highgui/highgui.hpp"
+#include "opencv2/imgproc/imgproc.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_SIZE 227
+#define SEED 0
+#define PREFETCH_PER_THREAD 4
+// Records waiting for each writer. There is one writer per list and size
+#define QUEUE_CAPACITY 64
+
+using namespace std;
+using namespace cv;
+
+enum SquareMode {
+  SQUARE_STRETCH, // resize to size x size whatever the aspect ratio (convert_imageset --resize_*)
+  SQUARE_PAD,     // center in a black square of the larger side first (preprocess_SUN.py)
+  SQUARE_CROP     // keep the centered square of the smaller side first
+};
+
+typedef struct {
+  vector<int> sizes;
+  SquareMode square;
+  DatumCodec codec;
+  bool shuffle;
+  bool mean;
+  unsigned int num_threads;
+} ConvertConfig;
+
+/* A line of a list */
+typedef struct {
+  unsigned int list;
+  unsigned int key; // position in the list, after the shuffle
+  int label;
+} Occurrence;
+
+/* An image, with all the lists where it is */
+typedef struct {
+  string path;
+  vector<Occurrence> occurrences;
+} SourceImage;
+
+typedef struct {
+  vector<Mat> images;     // one per size, none if the image could not be read
+  vector<string> encoded; // serialized Datums (with a codec), labeled as the first occurrence
+} ProcessedImage;
+
+/* Name of the LMDBs of a list: its file name without directories and extension */
+string list_name(const string &list_path) {
+  size_t slash = list_path.find_last_of('/');
+  string name = (slash == string::npos) ? list_path : list_path.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  return (dot == string::npos || dot == 0) ? name : name.substr(0, dot);
+}
+
+/* Adds the lines of the list to the images, merging the ones that are already there */
+void read_list(const string &list_path, unsigned int list, bool shuffle, vector<SourceImage> *sources,
+               map<string, size_t> *by_path) {
+  ifstream file(list_path.c_str());
+  if (!file) {
+    throw runtime_error("Could not open " + list_path);
+  }
+  vector<pair<string, int>> lines;
+  string line;
+  while (getline(file, line)) {
+    // Like convert_imageset, the label is after the last space (paths can have spaces)
+    size_t space = line.find_last_of(' ');
+    if (line.empty() || space == string::npos) {
+      continue;
+    }
+    lines.push_back(make_pair(line.substr(0, space), atoi(line.c_str() + space + 1)));
+  }
+  vector<unsigned int> keys(lines.size());
+  for (unsigned int i = 0; i < keys.size(); ++i) {
+    keys[i] = i;
+  }
+  if (shuffle) {
+    CounterRNG rng(SEED, list);
+    shuffle_with(keys, rng);
+  }
+  for (size_t i = 0; i < lines.size(); ++i) {
+    map<string, size_t>::iterator it = by_path->find(lines[i].first);
+    if (it == by_path->end()) {
+      SourceImage source;
+      source.path = lines[i].first;
+      it = by_path->insert(make_pair(source.path, sources->size())).first;
+      sources->push_back(source);
+    }
+    Occurrence occurrence = {list, keys[i], lines[i].second};
+    (*sources)[it->second].occurrences.push_back(occurrence);
+  }
+  cout << list_path << ": " << lines.size() << " images" << endl;
+}
+
+Mat make_square(const Mat &img, SquareMode mode) {
+  int side;
+  switch (mode) {
+  case SQUARE_PAD: {
+    side = max(img.rows, img.cols);
+    int top = (side - img.rows) / 2;
+    int left = (side - img.cols) / 2;
+    Mat padded;
+    copyMakeBorder(img, padded, top, side - img.rows - top, left, side - img.cols - left, BORDER_CONSTANT,
+                   Scalar::all(0));
+    return padded;
+  }
+  case SQUARE_CROP:
+    side = min(img.rows, img.cols);
+    return img(Rect((img.cols - side) / 2, (img.rows - side) / 2, side, side));
+  default:
+    return img;
+  }
+}
+
+/* Decodes an image once and makes all its sizes */
+ProcessedImage process_image(const string &path, int first_label, const ConvertConfig &config) {
+  ProcessedImage result;
+  Mat img;
+  {
+    StageTimer timer(STAGE_DECODE); // reading included
+    img = imread(path, CV_LOAD_IMAGE_COLOR);
+  }
+  if (img.empty()) {
+    return result;
+  }
+  {
+    StageTimer timer(STAGE_TRANSFORM);
+    Mat square = make_square(img, config.square);
+    for (size_t s = 0; s < config.sizes.size(); ++s) {
+      Mat resized;
+      resize(square, resized, Size(config.sizes[s], config.sizes[s]));
+      result.images.push_back(resized);
+    }
+  }
+  if (config.codec.type != CODEC_RAW) {
+    StageTimer timer(STAGE_SERIALIZE);
+    for (size_t s = 0; s < config.sizes.size(); ++s) {
+      result.encoded.push_back(encode_datum(result.images[s], Mat(), first_label, vector<float>(), config.codec));
+    }
+  }
+  return result;
+}
+
+void convert_lists(const string &images_root, const string &output_dir, const vector<string> &list_paths,
+                   const ConvertConfig &config) {
+  vector<SourceImage> sources;
+  map<string, size_t> by_path;
+  for (unsigned int l = 0; l < list_paths.size(); ++l) {
+    read_list(list_paths[l], l, config.shuffle, &sources, &by_path);
+  }
+  // In path order, so the images of a directory are read together
+  vector<size_t> order;
+  for (map<string, size_t>::iterator it = by_path.begin(); it != by_path.end(); ++it) {
+    order.push_back(it->second);
+  }
+  cout << sources.size() << " different images" << endl;
+
+  // LMDB of list l and size s: lmdbs[l * num_sizes + s]
+  size_t num_sizes = config.sizes.size();
+  vector<LMDataBase *> lmdbs;
+  mkdir(output_dir.c_str(), 0744);
+  for (size_t l = 0; l < list_paths.size(); ++l) {
+    for (size_t s = 0; s < num_sizes; ++s) {
+      string name = output_dir + "/" + list_name(list_paths[l]) + "_" + to_string(config.sizes[s]);
+      LMDataBaseOptions db_options;
+      db_options.async = true;
+      db_options.queue_capacity = QUEUE_CAPACITY;
+      db_options.verbose = false;
+      db_options.codec = config.codec;
+      if (config.mean) {
+        db_options.mean_file = name + "_mean.binaryproto";
+      }
+      lmdbs.push_back(new LMDataBase(name + "_lmdb", 3, config.sizes[s], db_options));
+    }
+  }
+
+  auto process = [&](size_t i) {
+    const SourceImage &source = sources[order[i]];
+    return process_image(images_root + source.path, source.occurrences[0].label, config);
+  };
+  unsigned int num_threads = max(config.num_threads, 1u);
+  OrderedPipeline<ProcessedImage> pipeline(order.size(), process, num_threads, PREFETCH_PER_THREAD * num_threads);
+  ProgressReporter progress;
+  ProcessedImage processed;
+  unsigned long num_missing = 0;
+  for (size_t i = 0; pipeline.next(&processed); ++i) {
+    const SourceImage &source = sources[order[i]];
+    if (processed.images.empty()) {
+      cerr << "Could not read " << images_root + source.path << endl;
+      num_missing++;
+      continue;
+    }
+    for (size_t o = 0; o < source.occurrences.size(); ++o) {
+      const Occurrence &occurrence = source.occurrences[o];
+      for (size_t s = 0; s < num_sizes; ++s) {
+        LMDataBase *lmdb = lmdbs[occurrence.list * num_sizes + s];
+        if (!processed.encoded.empty() && occurrence.label == source.occurrences[0].label) {
+          lmdb->insert2db(processed.encoded[s], occurrence.key);
+        } else {
+          // Encoded by the writer if there is a codec
+          lmdb->insert2db(processed.images[s], occurrence.label, occurrence.key);
+        }
+      }
+    }
+    progress.update(i + 1);
+  }
+  for (size_t i = 0; i < lmdbs.size(); ++i) {
+    delete lmdbs[i];
+  }
+  cout << "\nDecoded " << sources.size() - num_missing << " images for " << list_paths.size() << " lists and "
+       << num_sizes << " sizes";
+  if (num_missing > 0) {
+    cout << ", " << num_missing << " could not be read (their keys are missing in the LMDBs)";
+  }
+  cout << endl;
+}
+
+int main(int argc, char **argv) {
+  CliOptions opts(argc, argv);
+  if (opts.positional().size() < 3) {
+    cout << "Creates one LMDB per list of images and size, decoding every image only once\n\n"
+         << argv[0] << " path/to/images/root path/where/to/save/LMDBs list.txt [list.txt ...] [options]\n\n"
+         << "Every line of a list is 'path label', the path is appended to the root.\n\n"
+         << "Options:\n"
+         << "  --sizes=S[,S...]  height and width of the images, one LMDB per list and size\n"
+         << "                    (default: " << DEFAULT_SIZE << ")\n"
+         << "  --square=M        stretch (default, like convert_imageset), pad (center the image in a\n"
+         << "                    black square, like preprocess_SUN.py) or crop (the center square)\n"
+         << "  --shuffle         random order of the records of every list (seeded, always the same)\n"
+         << "  --codec=C         payload of the records: raw (default), png, jpeg, jpeg:Q or lz4\n"
+         << "  --mean            also write the mean of every LMDB in <LMDB name>_mean.binaryproto\n"
+         << "  --threads=N       number of threads decoding and resizing the images (default: all cores)\n"
+         << "  --metrics=F       where to write the JSON with the time spent in each stage of the\n"
+         << "                    build (default: path/where/to/save/LMDBs/build_metrics.json, - for stdout)\n\n"
+         << "Use the lists of sun397/create_SUN_splits.py and imagenet/create_ILSVRC_splits.py\n\n";
+    return 1;
+  }
+  ConvertConfig config;
+  stringstream sizes(opts.get("sizes", to_string(DEFAULT_SIZE)));
+  string size;
+  while (getline(sizes, size, ',')) {
+    if (atoi(size.c_str()) <= 0) {
+      cout << "--sizes must be a list of positive numbers\n";
+      return 1;
+    }
+    config.sizes.push_back(atoi(size.c_str()));
+  }
+  string square = opts.get("square", "stretch");
+  if (square != "stretch" && square != "pad" && square != "crop") {
+    cout << "--square must be stretch, pad or crop\n";
+    return 1;
+  }
+  config.square = (square == "pad") ? SQUARE_PAD : (square == "crop") ? SQUARE_CROP : SQUARE_STRETCH;
+  config.codec = parse_codec(opts.get("codec", "raw"));
+  config.shuffle = opts.has("shuffle");
+  config.mean = opts.has("mean");
+  config.num_threads = opts.get_int("threads", thread::hardware_concurrency());
+
+  vector<string> lists(opts.positional().begin() + 2, opts.positional().end());
+  convert_lists(opts.positional()[0], opts.positional()[1], lists, config);
+
+  build_metrics().print_summary(cout);
+  string metrics_path = opts.get("metrics", opts.positional()[1] + "/build_metrics.json");
+  if (!write_build_metrics(metrics_path, "convert_image_lists")) {
+    cerr << "Could not write the build metrics to " << metrics_path << endl;
+  }
+  return 0;
+}
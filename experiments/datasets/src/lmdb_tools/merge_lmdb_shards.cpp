@@ -0,0 +1,146 @@
+/*
+ * Merges LMDBs into a single one, in key order.
+ *
+ * The inputs can be directories of shards written with
+ * LMDataBaseOptions::num_shards (their manifest.txt says which shards there
+ * are and how many records they have) or plain LMDBs. They can come from
+ * different machines, each one building a part of the same database: the
+ * keys of all the inputs are merged as long as no key is repeated.
+ *
+ * The inputs are read in parallel cursors (a K-way merge) and the output is
+ * written with MDB_APPEND, so the records are just copied at the end of the
+ * database without searching the B-tree.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+#include "lmdb_reader.hpp"
+#include "lmdb_shards.hpp"
+#include <lmdb.h>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#define TB 1099511627776
+#define COMMIT_INTERVAL 10000
+
+using namespace std;
+
+typedef struct {
+  LMDataBaseReader *reader;
+  MDB_val key;
+  MDB_val value;
+} MergeInput;
+
+/* Same order as the default comparison of LMDB keys */
+static int compare_keys(const MDB_val &a, const MDB_val &b) {
+  int c = memcmp(a.mv_data, b.mv_data, min(a.mv_size, b.mv_size));
+  if (c != 0) {
+    return c;
+  }
+  return (a.mv_size < b.mv_size) ? -1 : (a.mv_size > b.mv_size);
+}
+
+static void check(int rc, const string &what) {
+  if (rc != MDB_SUCCESS) {
+    throw runtime_error(what + ": " + mdb_strerror(rc));
+  }
+}
+
+/* Expands the shard directories of the inputs to the paths of their LMDBs */
+vector<string> list_lmdbs(const vector<string> &inputs, vector<long> *expected_records) {
+  vector<string> paths;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!has_shard_manifest(inputs[i])) {
+      paths.push_back(inputs[i]);
+      expected_records->push_back(-1);
+      continue;
+    }
+    vector<ShardInfo> shards = read_shard_manifest(inputs[i]);
+    for (size_t s = 0; s < shards.size(); ++s) {
+      paths.push_back(inputs[i] + "/" + shards[s].name);
+      expected_records->push_back(shards[s].records);
+    }
+  }
+  return paths;
+}
+
+unsigned long merge_lmdbs(const vector<string> &inputs, const string &output_path) {
+  vector<long> expected_records;
+  vector<string> paths = list_lmdbs(inputs, &expected_records);
+
+  vector<MergeInput> sources(paths.size());
+  // Min-heap of the inputs by their current key
+  auto greater_key = [&](size_t a, size_t b) { return compare_keys(sources[a].key, sources[b].key) > 0; };
+  priority_queue<size_t, vector<size_t>, decltype(greater_key)> heap(greater_key);
+  unsigned long total = 0;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    sources[i].reader = new LMDataBaseReader(paths[i]);
+    if (expected_records[i] >= 0 && (size_t)expected_records[i] != sources[i].reader->size()) {
+      throw runtime_error(paths[i] + " does not have the records listed in its manifest");
+    }
+    total += sources[i].reader->size();
+    if (sources[i].reader->next(&sources[i].key, &sources[i].value)) {
+      heap.push(i);
+    }
+  }
+  cout << "Merging " << total << " records from " << paths.size() << " LMDBs" << endl;
+
+  MDB_env *env;
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  mkdir(output_path.c_str(), 0744);
+  check(mdb_env_create(&env), "mdb_env_create");
+  mdb_env_set_mapsize(env, TB);
+  // Synced once at the end
+  check(mdb_env_open(env, output_path.c_str(), MDB_NOSYNC, 0664), "Could not open " + output_path);
+  check(mdb_txn_begin(env, NULL, 0, &txn), "mdb_txn_begin");
+  check(mdb_open(txn, NULL, 0, &dbi), "mdb_open");
+
+  unsigned long num_records = 0;
+  while (!heap.empty()) {
+    size_t i = heap.top();
+    heap.pop();
+    MergeInput &source = sources[i];
+    int rc = mdb_put(txn, dbi, &source.key, &source.value, MDB_APPEND);
+    if (rc == MDB_KEYEXIST) {
+      throw runtime_error("Key " + string(static_cast<char *>(source.key.mv_data), source.key.mv_size) +
+                          " is repeated or " + output_path + " is not empty");
+    }
+    check(rc, "mdb_put");
+    if (++num_records % COMMIT_INTERVAL == 0) {
+      check(mdb_txn_commit(txn), "mdb_txn_commit");
+      check(mdb_txn_begin(env, NULL, 0, &txn), "mdb_txn_begin");
+      cout << "Merged " << num_records << "\r" << flush;
+    }
+    if (source.reader->next(&source.key, &source.value)) {
+      heap.push(i);
+    }
+  }
+  check(mdb_txn_commit(txn), "mdb_txn_commit");
+  check(mdb_env_sync(env, 1), "mdb_env_sync");
+  mdb_close(env, dbi);
+  mdb_env_close(env);
+
+  for (size_t i = 0; i < sources.size(); ++i) {
+    delete sources[i].reader;
+  }
+  return num_records;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    cout << "Merges LMDBs (or directories of LMDB shards with a " << SHARD_MANIFEST << ")\n"
+         << "into a single LMDB, in key order. No key can be in more than one input.\n\n"
+         << argv[0] << " path/to/new/lmdb path/to/shards_or_lmdb [path/to/shards_or_lmdb ...]\n\n";
+    return 1;
+  }
+  vector<string> inputs(argv + 2, argv + argc);
+  unsigned long num_records = merge_lmdbs(inputs, argv[1]);
+  cout << "\nFinished creation of " << argv[1] << " with " << num_records << " records.\n";
+  return 0;
+}
@@ -0,0 +1,415 @@
+/*
+ * Checks the content of a database of pairs (and of its labels LMDB, if
+ * any) without looking at the images one by one like
+ * utils/check-lmdb-content.py does.
+ *
+ * The keys are split in ranges that are read by a pool of threads, each one
+ * with its own read-only cursors (see LMDataBaseRangeReader). Every record
+ * is parsed and checked:
+ *  - the data records must be Datums of the expected channels, height and
+ *    width (datum_channels and datum_size of LMDataBase), with all their
+ *    pixels. With --decode the encoded payloads are decoded too.
+ *  - the label records must have one byte per label.
+ *  - the data and the labels LMDBs must have the same keys.
+ * It also counts the values of the labels (the label of the Datums, their
+ * float_data and every channel of the labels LMDB) and computes a digest of
+ * the content of each database: the same records give the same digest, no
+ * matter the number of threads, so two builds can be compared by their
+ * digests.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+#include "caffe/proto/caffe.pb.h"
+#include "cli_options.hpp"
+#include "datum_codec.hpp"
+#include "lmdb_reader.hpp"
+#include <lmdb.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Ranges of keys per thread, so a slow range does not keep the others waiting
+#define RANGES_PER_THREAD 8
+// Problems of each range that are printed, the rest are only counted
+#define MAX_PROBLEMS 10
+
+using namespace std;
+using namespace caffe;
+
+typedef struct {
+  int channels; // of the data records
+  int size;     // height and width of the data records
+  int label_channels;
+  bool decode;
+} Expected;
+
+typedef struct {
+  unsigned long records;
+  unsigned long bytes; // keys and values
+  unsigned long bad_records;
+  uint64_t digest;
+} DatabaseCounts;
+
+typedef struct {
+  DatabaseCounts data;
+  DatabaseCounts labels;
+  unsigned long only_in_data;
+  unsigned long only_in_labels;
+  map<int, unsigned long> label_histogram;            // label of the data records
+  vector<map<float, unsigned long>> float_histograms; // float_data of the data records
+  vector<vector<unsigned long>> channel_histograms;   // every channel of the labels LMDB
+  vector<string> problems;
+  unsigned long num_problems;
+} RangeReport;
+
+/* Same order as the default comparison of LMDB keys */
+static int compare_keys(const MDB_val &a, const MDB_val &b) {
+  int c = memcmp(a.mv_data, b.mv_data, min(a.mv_size, b.mv_size));
+  if (c != 0) {
+    return c;
+  }
+  return (a.mv_size < b.mv_size) ? -1 : (a.mv_size > b.mv_size);
+}
+
+/* 64 bit hash, 8 bytes at a time (the data records have hundreds of KB) */
+static uint64_t hash_bytes(const void *data, size_t size, uint64_t h) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 32;
+  }
+  for (; i < size; ++i) {
+    h = (h ^ bytes[i]) * 1099511628211ULL;
+  }
+  return h ^ size;
+}
+
+/* Digests are sums of the hashes of the records, so they do not depend on how the keys are split */
+static uint64_t hash_record(const MDB_val &key, const MDB_val &value) {
+  uint64_t h = hash_bytes(value.mv_data, value.mv_size, hash_bytes(key.mv_data, key.mv_size, 14695981039346656037ULL));
+  // Final mix of MurmurHash3
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  return h ^ (h >> 33);
+}
+
+static void add_problem(RangeReport *report, const MDB_val &key, const string &problem) {
+  if (report->problems.size() < MAX_PROBLEMS) {
+    report->problems.push_back(string(static_cast<char *>(key.mv_data), key.mv_size) + ": " + problem);
+  }
+  report->num_problems++;
+}
+
+static string shape(int channels, int height, int width) {
+  return to_string(channels) + "x" + to_string(height) + "x" + to_string(width);
+}
+
+static void count_record(DatabaseCounts *counts, const MDB_val &key, const MDB_val &value) {
+  counts->records++;
+  counts->bytes += key.mv_size + value.mv_size;
+  counts->digest += hash_record(key, value);
+}
+
+static void check_data_record(const MDB_val &key, const MDB_val &value, const Expected &expected, Datum *datum,
+                              vector<char> *pixels, RangeReport *report) {
+  count_record(&report->data, key, value);
+  if (!datum->ParseFromArray(value.mv_data, value.mv_size)) {
+    report->data.bad_records++;
+    add_problem(report, key, "not a Datum");
+    return;
+  }
+  if (datum->channels() != expected.channels || datum->height() != expected.size ||
+      datum->width() != expected.size) {
+    report->data.bad_records++;
+    add_problem(report, key, shape(datum->channels(), datum->height(), datum->width()) + " instead of " +
+                                 shape(expected.channels, expected.size, expected.size));
+    return;
+  }
+  size_t pixels_size = (size_t)datum->channels() * datum->height() * datum->width();
+  bool float_pixels = datum->data().empty() && (size_t)datum->float_data_size() == pixels_size;
+  if (!datum->encoded() && !float_pixels && datum->data().size() != pixels_size) {
+    report->data.bad_records++;
+    add_problem(report, key, to_string(datum->data().size()) + " bytes of pixels instead of " + to_string(pixels_size));
+    return;
+  }
+  if (datum->encoded() && expected.decode) {
+    pixels->resize(pixels_size);
+    try {
+      decode_datum_data(datum->data().data(), datum->data().size(), true, datum->channels(), datum->height(),
+                        datum->width(), &(*pixels)[0]);
+    } catch (const runtime_error &e) {
+      report->data.bad_records++;
+      add_problem(report, key, e.what());
+      return;
+    }
+  }
+  if (datum->has_label()) {
+    report->label_histogram[datum->label()]++;
+  }
+  if (!float_pixels) {
+    // The egomotion labels of the combined layout
+    if (report->float_histograms.size() < (size_t)datum->float_data_size()) {
+      report->float_histograms.resize(datum->float_data_size());
+    }
+    for (int i = 0; i < datum->float_data_size(); ++i) {
+      report->float_histograms[i][datum->float_data(i)]++;
+    }
+  }
+}
+
+static void check_label_record(const MDB_val &key, const MDB_val &value, const Expected &expected, Datum *datum,
+                               RangeReport *report) {
+  count_record(&report->labels, key, value);
+  if (!datum->ParseFromArray(value.mv_data, value.mv_size)) {
+    report->labels.bad_records++;
+    add_problem(report, key, "not a Datum (labels)");
+    return;
+  }
+  if (datum->channels() != expected.label_channels || datum->height() != 1 || datum->width() != 1 ||
+      datum->data().size() != (size_t)expected.label_channels) {
+    report->labels.bad_records++;
+    add_problem(report, key, to_string(datum->data().size()) + " bytes of " +
+                                 shape(datum->channels(), datum->height(), datum->width()) + " labels instead of " +
+                                 shape(expected.label_channels, 1, 1));
+    return;
+  }
+  const unsigned char *labels = reinterpret_cast<const unsigned char *>(datum->data().data());
+  for (int c = 0; c < expected.label_channels; ++c) {
+    report->channel_histograms[c][labels[c]]++;
+  }
+}
+
+/* Walks the keys of the range of both databases at the same time, like a merge */
+static void check_range(const LMDataBaseReader &data_db, const LMDataBaseReader *labels_db, const string &begin,
+                        const string &end, const Expected &expected, RangeReport *report) {
+  LMDataBaseRangeReader data(data_db, begin, end);
+  LMDataBaseRangeReader *labels = (labels_db != NULL) ? new LMDataBaseRangeReader(*labels_db, begin, end) : NULL;
+  report->channel_histograms.assign(expected.label_channels, vector<unsigned long>(256, 0));
+  Datum datum;
+  vector<char> pixels;
+  MDB_val data_key, data_value, label_key, label_value;
+  bool has_data = data.next(&data_key, &data_value);
+  bool has_label = (labels != NULL) && labels->next(&label_key, &label_value);
+  while (has_data || has_label) {
+    int c = !has_label ? -1 : (!has_data ? 1 : compare_keys(data_key, label_key));
+    if (c <= 0) {
+      check_data_record(data_key, data_value, expected, &datum, &pixels, report);
+      if (c < 0 && labels != NULL) {
+        report->only_in_data++;
+        add_problem(report, data_key, "not in the labels LMDB");
+      }
+      has_data = data.next(&data_key, &data_value);
+    }
+    if (c >= 0) {
+      check_label_record(label_key, label_value, expected, &datum, report);
+      if (c > 0) {
+        report->only_in_labels++;
+        add_problem(report, label_key, "not in the data LMDB");
+      }
+      has_label = labels->next(&label_key, &label_value);
+    }
+  }
+  delete labels;
+}
+
+static void merge_counts(DatabaseCounts *total, const DatabaseCounts &range) {
+  total->records += range.records;
+  total->bytes += range.bytes;
+  total->bad_records += range.bad_records;
+  total->digest += range.digest;
+}
+
+static void merge_report(RangeReport *total, const RangeReport &range) {
+  merge_counts(&total->data, range.data);
+  merge_counts(&total->labels, range.labels);
+  total->only_in_data += range.only_in_data;
+  total->only_in_labels += range.only_in_labels;
+  for (map<int, unsigned long>::const_iterator it = range.label_histogram.begin(); it != range.label_histogram.end();
+       ++it) {
+    total->label_histogram[it->first] += it->second;
+  }
+  if (total->float_histograms.size() < range.float_histograms.size()) {
+    total->float_histograms.resize(range.float_histograms.size());
+  }
+  for (size_t i = 0; i < range.float_histograms.size(); ++i) {
+    for (map<float, unsigned long>::const_iterator it = range.float_histograms[i].begin();
+         it != range.float_histograms[i].end(); ++it) {
+      total->float_histograms[i][it->first] += it->second;
+    }
+  }
+  total->channel_histograms.resize(range.channel_histograms.size(), vector<unsigned long>(256, 0));
+  for (size_t c = 0; c < range.channel_histograms.size(); ++c) {
+    for (int v = 0; v < 256; ++v) {
+      total->channel_histograms[c][v] += range.channel_histograms[c][v];
+    }
+  }
+  for (size_t i = 0; i < range.problems.size() && total->problems.size() < MAX_PROBLEMS; ++i) {
+    total->problems.push_back(range.problems[i]);
+  }
+  total->num_problems += range.num_problems;
+}
+
+/* The shape of the first record, for what was not given in the command line */
+static void guess_expected(LMDataBaseReader *reader, bool labels, Expected *expected) {
+  MDB_val key, value;
+  Datum datum;
+  if (!reader->next(&key, &value) || !datum.ParseFromArray(value.mv_data, value.mv_size)) {
+    reader->rewind();
+    return;
+  }
+  reader->rewind();
+  if (labels) {
+    if (expected->label_channels < 0) {
+      expected->label_channels = datum.channels();
+    }
+    return;
+  }
+  if (expected->channels < 0) {
+    expected->channels = datum.channels();
+  }
+  if (expected->size < 0) {
+    expected->size = datum.height();
+  }
+}
+
+static void print_histogram(const string &name, const map<float, unsigned long> &histogram) {
+  cout << "  " << name << ":";
+  for (map<float, unsigned long>::const_iterator it = histogram.begin(); it != histogram.end(); ++it) {
+    cout << " " << it->first << ":" << it->second;
+  }
+  cout << "\n";
+}
+
+static void print_report(const RangeReport &report, bool has_labels, double seconds, unsigned int num_threads) {
+  unsigned long records = report.data.records + report.labels.records;
+  unsigned long bytes = report.data.bytes + report.labels.bytes;
+  cout << "Checked " << records << " records (" << (bytes >> 20) << " MB) in " << seconds << " s ("
+       << num_threads << (num_threads == 1 ? " thread): " : " threads): ") << (unsigned long)(records / max(seconds, 1e-9)) << " records/s, "
+       << (unsigned long)((bytes >> 20) / max(seconds, 1e-9)) << " MB/s\n\n";
+
+  char digest[17];
+  snprintf(digest, sizeof(digest), "%016" PRIx64, report.data.digest);
+  cout << "Data: " << report.data.records << " records, " << report.data.bad_records << " bad, digest " << digest
+       << "\n";
+  if (!report.label_histogram.empty()) {
+    map<float, unsigned long> histogram(report.label_histogram.begin(), report.label_histogram.end());
+    print_histogram("label", histogram);
+  }
+  for (size_t i = 0; i < report.float_histograms.size(); ++i) {
+    print_histogram("float_data[" + to_string(i) + "]", report.float_histograms[i]);
+  }
+  if (has_labels) {
+    snprintf(digest, sizeof(digest), "%016" PRIx64, report.labels.digest);
+    cout << "Labels: " << report.labels.records << " records, " << report.labels.bad_records << " bad, digest "
+         << digest << "\n";
+    for (size_t c = 0; c < report.channel_histograms.size(); ++c) {
+      map<float, unsigned long> histogram;
+      for (int v = 0; v < 256; ++v) {
+        if (report.channel_histograms[c][v] > 0) {
+          histogram[v] = report.channel_histograms[c][v];
+        }
+      }
+      print_histogram("channel " + to_string(c), histogram);
+    }
+    cout << "Keys only in data: " << report.only_in_data << ", only in labels: " << report.only_in_labels << "\n";
+  }
+  if (report.num_problems > 0) {
+    cout << "\n" << report.num_problems << " problems";
+    if (report.num_problems > report.problems.size()) {
+      cout << ", the first ones";
+    }
+    cout << ":\n";
+    for (size_t i = 0; i < report.problems.size(); ++i) {
+      cout << "  " << report.problems[i] << "\n";
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  CliOptions opts(argc, argv);
+  if (opts.positional().empty()) {
+    cout << "Checks every record of a LMDB of images (and of its labels LMDB) in parallel\n\n"
+         << argv[0] << " path/to/lmdb [path/to/labels_lmdb] [options]\n\n"
+         << "Options:\n"
+         << "  --channels=C        channels of the data records (default: those of the first record)\n"
+         << "  --size=S            height and width of the data records (default: those of the first record)\n"
+         << "  --label-channels=N  labels per record of the labels LMDB (default: those of the first record)\n"
+         << "  --decode            also decode the encoded records (see datum_codec.hpp)\n"
+         << "  --threads=N         number of threads reading the databases (default: all cores)\n\n"
+         << "Returns 1 if any record is wrong or the keys of the databases do not match.\n\n";
+    return 1;
+  }
+  Expected expected;
+  expected.channels = opts.get_int("channels", -1);
+  expected.size = opts.get_int("size", -1);
+  expected.label_channels = opts.get_int("label-channels", -1);
+  expected.decode = opts.has("decode");
+  unsigned int num_threads = max((unsigned int)opts.get_int("threads", thread::hardware_concurrency()), 1u);
+
+  LMDataBaseReader data_db(opts.positional()[0]);
+  LMDataBaseReader *labels_db = NULL;
+  guess_expected(&data_db, false, &expected);
+  cout << opts.positional()[0] << ": " << data_db.size() << " records of "
+       << shape(expected.channels, expected.size, expected.size) << "\n";
+  if (opts.positional().size() > 1) {
+    labels_db = new LMDataBaseReader(opts.positional()[1]);
+    guess_expected(labels_db, true, &expected);
+    cout << opts.positional()[1] << ": " << labels_db->size() << " records of " << expected.label_channels
+         << " labels\n";
+  }
+  expected.label_channels = max(expected.label_channels, 0);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<string> splits = data_db.split_keys(num_threads * RANGES_PER_THREAD);
+  vector<RangeReport> reports(splits.size() - 1);
+  atomic<size_t> next_range(0);
+  vector<string> errors(num_threads);
+  vector<thread> threads;
+  for (unsigned int t = 0; t < num_threads; ++t) {
+    threads.push_back(thread([&, t]() {
+      try {
+        for (size_t r = next_range++; r < reports.size(); r = next_range++) {
+          check_range(data_db, labels_db, splits[r], splits[r + 1], expected, &reports[r]);
+        }
+      } catch (const exception &e) {
+        errors[t] = e.what();
+      }
+    }));
+  }
+  for (unsigned int t = 0; t < num_threads; ++t) {
+    threads[t].join();
+  }
+  for (unsigned int t = 0; t < num_threads; ++t) {
+    if (!errors[t].empty()) {
+      throw runtime_error(errors[t]);
+    }
+  }
+
+  // In key order, so the problems are the first ones of the database
+  RangeReport total = RangeReport();
+  for (size_t r = 0; r < reports.size(); ++r) {
+    merge_report(&total, reports[r]);
+  }
+  chrono::duration<double> seconds = chrono::steady_clock::now() - start;
+  print_report(total, labels_db != NULL, seconds.count(), num_threads);
+  delete labels_db;
+
+  bool ok = total.num_problems == 0;
+  cout << (ok ? "\nOK\n" : "\nFAILED\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#include "mnist_transforms.hpp"
+
+TransformGrid make_transform_grid() {
+  TransformGrid grid;
+  grid.translations = vector<float>(NUM_TRASLATIONS);
+  float value = LOWER_TRASLATION;
+  for (unsigned int i = 0; i < grid.translations.size(); i++) {
+    grid.translations[i] = value++;
+  }
+
+  value = LOWER_ANGLE;
+  grid.rotations = vector<float>(NUM_ROTATIONS);
+  for (unsigned int i = 0; i < grid.rotations.size(); i++) {
+    grid.rotations[i] = (++value == 0) ? ++value : value;
+  }
+  return grid;
+}
+
+MnistTransform draw_mnist_transform(CounterRNG &rng, const TransformGrid &grid) {
+  MnistTransform t;
+  // Generate random X translation
+  unsigned int rand_index = rng.generate_rand(NUM_TRASLATIONS);
+  t.x = rand_index;
+  t.tx = grid.translations[rand_index];
+  // Generate random Y translation
+  rand_index = rng.generate_rand(NUM_TRASLATIONS);
+  t.y = rand_index;
+  t.ty = grid.translations[rand_index];
+  // Calculate random bin of rotation (0 to 19)
+  rand_index = rng.generate_rand(NUM_BIN_ROTATIONS);
+  t.z = rand_index;
+  // Calculate the real index of the array of rotations (0 to 59)
+  rand_index *= 3;
+  rand_index += rng.generate_rand(3);
+  t.rotation = rand_index;
+  t.rot = grid.rotations[rand_index];
+  // Which image goes first
+  t.swapped = rng.generate_rand(2);
+  return t;
+}
+
+int mnist_sfa_label(const MnistTransform &t) {
+  return t.x >= 2 && t.x <= 4 && t.y >= 2 && t.y <= 4 && (t.z == 9 || t.z == 10);
+}
+
+MnistWarpTables::MnistWarpTables(const TransformGrid &grid, int rows, int cols) {
+  tables.reserve(NUM_TRASLATIONS * NUM_TRASLATIONS * NUM_ROTATIONS);
+  double m[6];
+  for (int x = 0; x < NUM_TRASLATIONS; ++x) {
+    for (int y = 0; y < NUM_TRASLATIONS; ++y) {
+      for (int r = 0; r < NUM_ROTATIONS; ++r) {
+        rotation_translation_matrix(grid.translations[x], grid.translations[y], grid.rotations[r], rows, cols, m);
+        tables.push_back(RemapTable(m, rows, cols));
+      }
+    }
+  }
+}
+
+const RemapTable &MnistWarpTables::table(const MnistTransform &t) const {
+  return tables[(t.x * NUM_TRASLATIONS + t.y) * NUM_ROTATIONS + t.rotation];
+}
+
+void MnistWarpTables::warp(const Mat &img, const MnistTransform *t, size_t n, Mat *out) const {
+  vector<uchar> padded;
+  pad_for_remap(img, &padded);
+  for (size_t i = 0; i < n; ++i) {
+    out[i].create(img.rows, img.cols, CV_8UC1);
+    remap_warp(&padded[0], table(t[i]), out[i].ptr<uchar>(0));
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef _MNIST_TRANSFORMS_
+#define _MNIST_TRANSFORMS_
+#include "counter_rng.hpp"
+#include "remap_warp.hpp"
+#include "opencv2/core/core.hpp"
+#include <vector>
+
+/*
+ * The transformations of the MNIST siamese pairs (section 3.4.1 of "Learning
+ * to See by Moving"): a translation in x and y of -3..3 pixels and a rotation
+ * of -30..30 degrees, quantized in 7, 7 and 20 classes.
+ *
+ * draw_mnist_transform() takes the random numbers always in the same order,
+ * so preprocess_mnist_siamese and the pair generator (pairgen/) make the same
+ * pairs out of the same random stream.
+ *
+ * There are only NUM_TRASLATIONS^2 * NUM_ROTATIONS (2940) different
+ * transformations, so MnistWarpTables computes the remap tables of all of
+ * them once (~23 MB for 28x28 digits) and every warp is just a pass of the
+ * remap kernel (see remap_warp.hpp). The pixels are the same as the ones of
+ * transform_image().
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+using namespace cv;
+
+#define NUM_TRASLATIONS 7
+#define NUM_ROTATIONS 60
+#define NUM_BIN_ROTATIONS 20
+#define LOWER_ANGLE -31
+#define LOWER_TRASLATION -3
+
+typedef struct {
+  vector<float> translations;
+  vector<float> rotations;
+} TransformGrid;
+
+typedef struct {
+  // Classes: x and y translation (0..6) and bin of the rotation (0..19)
+  unsigned char x;
+  unsigned char y;
+  unsigned char z;
+  // Index of the rotation in the grid (0..59)
+  unsigned int rotation;
+  float tx;
+  float ty;
+  float rot;
+  bool swapped; // the transformed image goes first in the pair
+} MnistTransform;
+
+TransformGrid make_transform_grid();
+MnistTransform draw_mnist_transform(CounterRNG &rng, const TransformGrid &grid);
+// Label of the pairs for SFA: 1 if the transformation is small
+int mnist_sfa_label(const MnistTransform &t);
+
+class MnistWarpTables {
+public:
+  // Tables of every transformation of grid for CV_8UC1 images of rows x cols
+  MnistWarpTables(const TransformGrid &grid, int rows, int cols);
+
+  const RemapTable &table(const MnistTransform &t) const;
+  // Warps img with the n transformations of t. The padded copy of img is made
+  // once and stays in L1 for all of them
+  void warp(const Mat &img, const MnistTransform *t, size_t n, Mat *out) const;
+
+private:
+  vector<RemapTable> tables; // (x * NUM_TRASLATIONS + y) * NUM_ROTATIONS + rotation
+};
+#endif
@@ -1,4 +1,17 @@
 #include "mnist_utils.hpp"
+#include <arpa/inet.h>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IDX_IMAGES_MAGIC 0x00000803 // unsigned byte, 3 dimensions
+#define IDX_LABELS_MAGIC 0x00000801 // unsigned byte, 1 dimension
 
 typedef struct {
   uint32_t magic;
@@ -7,126 +20,107 @@ typedef struct {
   uint32_t rows;
 } MNIST_metadata;
 
-uint32_t get_uint32_t(ifstream &f, streampos offset);
-vector<unsigned char> read_block(ifstream &f, unsigned int size, streampos offset);
-MNIST_metadata parse_images_header(ifstream &f);
-MNIST_metadata parse_labels_header(ifstream &f);
-void parse_images_data(ifstream &f, MNIST_metadata meta, vector<Mat> *mnist);
-void parse_labels_data(ifstream &f, MNIST_metadata meta, vector<unsigned char> *labels);
+/*
+ * A whole IDX file mapped read-only in memory.
+ * The mapping is never copied: the Mats returned by load_images() point
+ * straight into it.
+ */
+class IdxFile {
+public:
+  explicit IdxFile(const string &path) : data(NULL), size(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw runtime_error("Could not open " + path);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size = st.st_size;
+    if (size > 0) {
+      void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      data = (addr == MAP_FAILED) ? NULL : static_cast<const unsigned char *>(addr);
+    }
+    close(fd);
+    if (data == NULL) {
+      throw runtime_error("Could not map " + path);
+    }
+    // Everything is read once from start to end
+    madvise(const_cast<unsigned char *>(data), size, MADV_SEQUENTIAL);
+    madvise(const_cast<unsigned char *>(data), size, MADV_WILLNEED);
+  }
+  ~IdxFile() { munmap(const_cast<unsigned char *>(data), size); }
+
+  const unsigned char *data;
+  size_t size;
+
+  /* IDX headers are big-endian, this swaps them once to the host order */
+  uint32_t header_field(unsigned int i) const {
+    uint32_t value;
+    memcpy(&value, data + i * sizeof(uint32_t), sizeof(uint32_t));
+    return ntohl(value);
+  }
+};
+
+/*
+ * Files stay mapped until the process ends, so the Mats that point into them
+ * are always valid and loading the same file twice is free.
+ */
+static shared_ptr<IdxFile> map_idx_file(const string &path, uint32_t magic, unsigned int header_fields) {
+  static map<string, shared_ptr<IdxFile>> mapped_files;
+  static mutex mapped_files_mutex;
+
+  lock_guard<mutex> lock(mapped_files_mutex);
+  shared_ptr<IdxFile> &file = mapped_files[path];
+  if (!file) {
+    file = make_shared<IdxFile>(path);
+  }
+  if (file->size < header_fields * sizeof(uint32_t) || file->header_field(0) != magic) {
+    throw runtime_error(path + " is not an IDX file of the expected type");
+  }
+  return file;
+}
 
 vector<Mat> load_images(string path) {
-  ifstream f;
-  f.open(path, ios::in | ios::binary);
+  shared_ptr<IdxFile> f = map_idx_file(path, IDX_IMAGES_MAGIC, 4);
 
-  MNIST_metadata meta = parse_images_header(f);
+  MNIST_metadata meta;
+  meta.magic = f->header_field(0);
+  meta.num_elems = f->header_field(1);
+  meta.rows = f->header_field(2);
+  meta.cols = f->header_field(3);
   cout << "MNIST data info:" << endl;
   cout << "  Magic number: " << meta.magic << endl;
   cout << "  Number of Images: " << meta.num_elems << endl;
   cout << "  Rows: " << meta.rows << endl;
   cout << "  Columns: " << meta.cols << endl;
+
+  // 4 integers in the header of the images file
+  size_t offset = sizeof(uint32_t) * 4;
+  size_t size_img = meta.cols * meta.rows;
+  if (f->size < offset + meta.num_elems * size_img) {
+    throw runtime_error(path + " is truncated");
+  }
   vector<Mat> mnist(meta.num_elems);
-  parse_images_data(f, meta, &mnist);
+  for (unsigned int i = 0; i < meta.num_elems; i++) {
+    void *img_data = const_cast<unsigned char *>(f->data + offset + i * size_img);
+    mnist[i] = Mat(meta.rows, meta.cols, CV_8UC1, img_data);
+  }
   return mnist;
 }
 
 vector<unsigned char> load_labels(string path) {
-  ifstream f;
-  f.open(path, ios::in | ios::binary);
+  shared_ptr<IdxFile> f = map_idx_file(path, IDX_LABELS_MAGIC, 2);
 
-  MNIST_metadata meta = parse_labels_header(f);
+  MNIST_metadata meta;
+  meta.magic = f->header_field(0);
+  meta.num_elems = f->header_field(1);
   cout << "MNIST labels info:" << endl;
   cout << "  Magic number: " << meta.magic << endl;
   cout << "  Number of Labels: " << meta.num_elems << endl;
-  vector<unsigned char> labels_mnist(meta.num_elems);
-  parse_labels_data(f, meta, &labels_mnist);
-  return labels_mnist;
-}
-
-MNIST_metadata parse_images_header(ifstream &f) {
-  MNIST_metadata meta;
-  streampos offset = 0;
-  meta.magic = get_uint32_t(f, offset);
-  offset += sizeof(uint32_t);
-  meta.num_elems = get_uint32_t(f, offset);
-  offset += sizeof(uint32_t);
-  meta.rows = get_uint32_t(f, offset);
-  offset += sizeof(uint32_t);
-  meta.cols = get_uint32_t(f, offset);
-  return meta;
-}
 
-void parse_images_data(ifstream &f, MNIST_metadata meta, vector<Mat> *mnist) {
-  unsigned int size_img = meta.cols * meta.rows;
-  // 4 integers in the header of the images file
-  streampos offset = sizeof(uint32_t) * 4;
-  for (unsigned int i = 0; i < meta.num_elems; i++) {
-    vector<unsigned char> raw_data = read_block(f, size_img, offset);
-    Mat mchar(raw_data, false);
-    mchar = mchar.reshape(1, meta.rows);
-    (*mnist)[i] = mchar.clone();
-    offset += size_img;
+  // 2 integers in the header of the labels file
+  size_t offset = sizeof(uint32_t) * 2;
+  if (f->size < offset + meta.num_elems) {
+    throw runtime_error(path + " is truncated");
   }
-}
-
-MNIST_metadata parse_labels_header(ifstream &f) {
-  MNIST_metadata meta;
-  streampos offset = 0;
-  meta.magic = get_uint32_t(f, offset);
-  offset += sizeof(uint32_t);
-  meta.num_elems = get_uint32_t(f, offset);
-  return meta;
-}
-
-void parse_labels_data(ifstream &f, MNIST_metadata meta, vector<unsigned char> *labels) {
-  // 4 integers in the header of the images file
-  streampos offset = sizeof(uint32_t) * 2;
-  for (unsigned int i = 0; i < meta.num_elems; i++) {
-    f.seekg(offset);
-    unsigned char label;
-    f.read((char *)&label, sizeof(unsigned char));
-    (*labels)[i] = label;
-    offset += sizeof(unsigned char);
-  }
-}
-
-vector<unsigned char> read_block(ifstream &f, unsigned int size, streampos offset) {
-  char *bytes;
-  bytes = (char *)malloc(size * sizeof(unsigned char));
-
-  f.seekg(offset);
-  f.read(bytes, size);
-
-  vector<unsigned char> raw_data(size);
-  for (unsigned int i = 0; i < size; i++) {
-    raw_data[i] = (unsigned char)bytes[i];
-  }
-
-  free(bytes);
-
-  return raw_data;
-}
-
-/*
- * It parses a int (32 bits) from the file f.
- * The MNIST dataset uses big-endian. It parses assuming the
- * host is little-endian
- *
- * PRECONDITION: f has to be opened with ios::in | ios::binary flags
- */
-uint32_t get_uint32_t(ifstream &f, streampos offset) {
-  uint32_t *i_int;
-  char *b_int;
-
-  b_int = (char *)malloc(sizeof(uint32_t));
-
-  for (unsigned int i = 0; i < sizeof(uint32_t); i++) {
-    f.seekg(offset + (streampos)i);
-    f.read(b_int + (sizeof(uint32_t) - i - 1), sizeof(char));
-  }
-  i_int = reinterpret_cast<uint32_t *>(b_int);
-
-  uint32_t res = *i_int;
-  free(b_int);
-
-  return res;
+  return vector<unsigned char>(f->data + offset, f->data + offset + meta.num_elems);
 }
@@ -10,6 +10,10 @@
 /*
  * This small module has utilities to parse the MNIST dataset (data and labels)
  * and return a vector of OpenCV Mats or a vector of labels (unsigned char)
+ *
+ * The IDX files are memory-mapped. The Mats returned by load_images() are
+ * read-only views into the mapping (no pixel is copied) and stay valid until
+ * the program ends. Clone them if you need to modify them.
  * Author: Ezequiel Torti Lopez
  */
 
@@ -25,8 +25,15 @@
  * Author: Ezequiel Torti Lopez
  */
 
+#include "build_metrics.hpp"
+#include "cli_options.hpp"
+#include "counter_rng.hpp"
+#include "frame_store.hpp"
+#include "image_pool.hpp"
 #include "lmdb_creator.hpp"
+#include "mnist_transforms.hpp"
 #include "mnist_utils.hpp"
+#include "ordered_pipeline.hpp"
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
@@ -39,162 +46,377 @@
 #include <string.h>
 #include <string>
 #include <sys/stat.h>
+#include <thread>
 #include <vector>
 
 using namespace std;
 using namespace cv;
 
-#define NUM_TRASLATIONS 7
-#define NUM_ROTATIONS 60
-#define NUM_BIN_ROTATIONS 20
+// The transformations of the pairs are defined in mnist_transforms.hpp
 #define NUM_CLASSES 3
 #define LABEL_WIDTH NUM_BIN_ROTATIONS
-#define LOWER_ANGLE -31
-#define LOWER_TRASLATION -3
-#define BATCHES 6
+#define NUM_PAIRS 5000000
+#define MEMORY_BUDGET_MB 1024
+#define SEED 0
+// Pairs generated by a worker in one go (the pairs of a digit can be split
+// between two blocks). Each digit has its own random stream, so this only
+// affects the scheduling and the size of the blocks in memory, never the pairs.
+#define PAIRS_PER_BLOCK 4096
+// Blocks that the workers may have ready ahead of the writer (per thread)
+#define BLOCKS_AHEAD_PER_THREAD 2
+// 1/PIPELINE_SHARE of the memory budget is kept for the pipeline (the blocks
+// being generated and the ones ahead of the writer), the rest is the shuffle
+// window. Neither depends on the threads or on the number of pairs.
+#define PIPELINE_SHARE 4
 
 typedef struct {
   Mat img1;
   Mat img2;
-  Label x;
-  Label y;
-  Label z;
+  unsigned int image; // index of the original digit
+  MnistTransform t;
 } DataBlob;
 
-void create_lmdb(string images, string lmdb_path);
-Mat transform_image(Mat &img, float tx, float ty, float rot);
-vector<DataBlob> process_images(vector<Mat> &list_imgs, unsigned int pairs_per_img);
-unsigned int generate_rand(int range_limit);
+typedef struct {
+  unsigned long num_pairs;
+  size_t memory_budget; // bytes
+  unsigned int num_threads;
+  unsigned int num_shards; // LMDBs written in parallel per database
+  bool frames;             // write a frame store instead of the two LMDBs
+  string mean_file;        // binaryproto with the mean of the pairs, empty for none
+  bool resume;             // continue an unfinished build of the same LMDBs
+} BuildConfig;
+
+/*
+ * Distributes num_pairs as evenly as possible among num_imgs images:
+ * every image gets `base` pairs and the first `remainder` images one more.
+ */
+typedef struct {
+  unsigned int base;
+  unsigned int remainder;
+} PairSchedule;
+
+void create_lmdb(string images, string lmdb_path, const BuildConfig &config);
+PairEntry make_frame_pair(const DataBlob &d, int sfa_label);
+PairSchedule make_pair_schedule(unsigned long num_pairs, unsigned int num_imgs);
+unsigned int pairs_for_image(const PairSchedule &schedule, unsigned int img);
+unsigned long pairs_before_image(const PairSchedule &schedule, unsigned int img);
+unsigned int image_of_pair(const PairSchedule &schedule, unsigned long pair);
+DataBlob make_data_blob(const Mat &img, unsigned int image, const MnistTransform &t, const Mat &new_img);
+vector<DataBlob> process_pairs(vector<Mat> &list_imgs, unsigned long begin, unsigned long end,
+                               const PairSchedule &schedule, const TransformGrid &grid,
+                               const MnistWarpTables *tables, ImagePool *pool);
 
 int main(int argc, char **argv) {
-  if (argc < 3) {
+  CliOptions opts(argc, argv);
+  if (opts.positional().size() < 2) {
     cout << "You must provide the path where the MNIST original dataset\n"
          << "lives and the path were you want to save your generated LMDBs:\n\n"
-         << argv[0] << " path/to/train-images-idx3-ubyte path/where/to/save/LMDB\n\n";
+         << argv[0] << " path/to/train-images-idx3-ubyte path/where/to/save/LMDB [options]\n\n"
+         << "Options:\n"
+         << "  --threads=N   number of worker threads used to generate the pairs\n"
+         << "                (default: all cores). The output does not depend on N.\n"
+         << "  --pairs=N     number of pairs to generate (default: " << NUM_PAIRS << ")\n"
+         << "  --memory=MB   memory budget for the generated pairs (default: " << MEMORY_BUDGET_MB << ").\n"
+         << "                The pairs are shuffled in windows that fit in this budget, so the\n"
+         << "                order of the records depends on it.\n"
+         << "  --shards=K    write each database as K LMDB shards in parallel (default: 1).\n"
+         << "                Use merge_lmdb_shards to get a single LMDB.\n"
+         << "  --format=F    lmdb (default) or frames: a frame store (see frame_store.hpp) with\n"
+         << "                the original digits and the transformation of every pair instead\n"
+         << "                of the images. Same pairs in the same order as lmdb, use\n"
+         << "                convert_frame_store to-pairs to get the LMDBs.\n"
+         << "  --mean=FILE   also compute the mean of the pairs while they are written and save\n"
+         << "                it in FILE (a binaryproto, like compute_image_mean). lmdb format only.\n"
+         << "  --resume      continue a build that stopped (it checkpoints every commit) with the\n"
+         << "                same options. The LMDBs are the same as in a build that never stopped.\n"
+         << "                lmdb format without shards only.\n"
+         << "  --metrics=F   where to write the JSON with the time spent in each stage of the\n"
+         << "                build (default: build_metrics.json next to the LMDBs, - for stdout).\n\n";
     cout << "Please use the script experiments/mnist/download_mnist.sh to get the "
          << "original version of the MNIST dataset\n\n";
   } else {
     cout << "Creating LMDB\n";
-    string orig_imgs_path(argv[1]);
-    string lmdb_data_path = string(argv[2]) + "/mnist_train_siamese_lmdb";
-    create_lmdb(orig_imgs_path, lmdb_data_path);
+    string orig_imgs_path(opts.positional()[0]);
+    string lmdb_data_path = opts.positional()[1] + "/mnist_train_siamese_lmdb";
+    BuildConfig config;
+    config.num_threads = opts.get_int("threads", thread::hardware_concurrency());
+    config.num_pairs = opts.get_int("pairs", NUM_PAIRS);
+    config.memory_budget = (size_t)opts.get_int("memory", MEMORY_BUDGET_MB) << 20;
+    config.num_shards = opts.get_int("shards", 1);
+    config.frames = opts.get("format", "lmdb") == "frames";
+    config.mean_file = opts.get("mean", "");
+    config.resume = opts.has("resume");
+    if (config.resume && (config.frames || config.num_shards > 1)) {
+      cout << "--resume only works with the lmdb format without shards\n";
+      return 1;
+    }
+    if (config.frames) {
+      lmdb_data_path = opts.positional()[1] + "/mnist_train_siamese_frames";
+    }
+    try {
+      create_lmdb(orig_imgs_path, lmdb_data_path, config);
+    } catch (const runtime_error &e) {
+      cerr << e.what() << endl;
+      return 1;
+    }
     cout << "Created LMDB in " << lmdb_data_path << endl;
+    build_metrics().print_summary(cout);
+    string metrics_path = opts.get("metrics", opts.positional()[1] + "/build_metrics.json");
+    if (!write_build_metrics(metrics_path, "preprocess_mnist_siamese")) {
+      cerr << "Could not write the build metrics to " << metrics_path << endl;
+    }
   }
 
   return 0;
 }
 
-void create_lmdb(string images, string lmdb_path) {
+/*
+ * Streams the pairs from the generation workers to the LMDBs.
+ *
+ * The workers produce blocks of PAIRS_PER_BLOCK pairs in image order through
+ * a bounded queue (OrderedPipeline). The writer groups consecutive blocks in
+ * shuffle windows, shuffles each window with its own seeded stream and writes
+ * it. Only one window plus the blocks in the queue live in memory at any time,
+ * and both are sized from config.memory_budget, so the peak memory is set by
+ * the budget and not by the number of pairs or threads. Throws runtime_error
+ * if the budget can not hold a window and the pipeline.
+ */
+void create_lmdb(string images, string lmdb_path, const BuildConfig &config) {
   // Load images/labels
-  vector<Mat> list_imgs = load_images(images);
-
-  // Create databases objects
-  string labels_path = lmdb_path + "_labels";
-  LMDataBase *labels_lmdb = new LMDataBase(labels_path, (size_t)NUM_CLASSES, 1);
-  LMDataBase *data_lmdb = new LMDataBase(lmdb_path, (size_t)2, (size_t)list_imgs[0].rows);
-
-  // Processing and generating million of images at once will consume too much RAM (>7GB) and it will
-  // (probably) throw a std::bad_alloc exception. Lets split the processing in several batches instead.
-  // list_imgs.size() has to be multiple of BATCHES (to simplify things)
-  int len_batch = list_imgs.size() / BATCHES;
-  for (unsigned int i = 0; i < BATCHES; i++) {
-    unsigned int begin = i * len_batch;
-    unsigned int end = begin + len_batch;
-    vector<Mat> batch_imgs = vector<Mat>(list_imgs.begin() + begin, list_imgs.begin() + end);
-    unsigned int pairs_per_img = 83 * (i != 0) + 85 * (i == 0); // for a total of 5million imgs
-    vector<DataBlob> batch_data = process_images(batch_imgs, pairs_per_img);
-    cout << "Batch images: " << batch_imgs.size() << " Batch pairs: " << batch_data.size() << endl;
-    random_shuffle(std::begin(batch_data), std::end(batch_data));
-    for (unsigned int item_id = 0; item_id < batch_data.size(); ++item_id) {
-      int sfa_label = (Label)(batch_data[item_id].x >= 2 && batch_data[item_id].x <= 4 && batch_data[item_id].y >= 2 &&
-                              batch_data[item_id].y <= 4 && (batch_data[item_id].z == 9 || batch_data[item_id].z == 10));
-      data_lmdb->insert2db(batch_data[item_id].img1, batch_data[item_id].img2, sfa_label);
-      vector<Label> labels = {(Label)batch_data[item_id].x, (Label)batch_data[item_id].y,
-                              (Label)batch_data[item_id].z};
-      labels_lmdb->insert2db(labels);
+  vector<Mat> list_imgs;
+  {
+    StageTimer timer(STAGE_LOAD);
+    list_imgs = load_images(images);
+  }
+  unsigned int num_imgs = list_imgs.size();
+  unsigned int num_threads = max(config.num_threads, 1u);
+
+  const TransformGrid grid = make_transform_grid();
+  // The frame store only needs the transformations, not the images
+  MnistWarpTables *tables = NULL;
+  // The transformed digits live in a pool and go back to it when the writer is done with them
+  ImagePool *pool = NULL;
+  if (!config.frames) {
+    tables = new MnistWarpTables(grid, list_imgs[0].rows, list_imgs[0].cols);
+    pool = new ImagePool(list_imgs[0].total() * list_imgs[0].elemSize());
+  }
+  const PairSchedule schedule = make_pair_schedule(config.num_pairs, num_imgs);
+  unsigned long num_blocks = (config.num_pairs + PAIRS_PER_BLOCK - 1) / PAIRS_PER_BLOCK;
+
+  // Every pair owns its transformed image (the original is shared). The frame
+  // store does not need the images, but the windows (and therefore the order
+  // of the pairs) must be the same in both formats.
+  size_t pair_bytes = list_imgs[0].total() * list_imgs[0].elemSize() + sizeof(DataBlob) + 64;
+  size_t block_bytes = (size_t)PAIRS_PER_BLOCK * pair_bytes;
+  size_t pipeline_blocks = config.memory_budget / PIPELINE_SHARE / block_bytes;
+  size_t window_blocks = (config.memory_budget - pipeline_blocks * block_bytes) / block_bytes;
+  if (pipeline_blocks == 0 || window_blocks == 0) {
+    throw runtime_error("--memory=" + to_string(config.memory_budget >> 20) + " is too small, it must be at least " +
+                        to_string(((PIPELINE_SHARE * block_bytes) >> 20) + 1) + " MB");
+  }
+  unsigned long pairs_per_window = window_blocks * PAIRS_PER_BLOCK;
+  // At most pipeline_blocks blocks are generated or waiting at any time: with
+  // more threads than that, the extra ones just wait
+  size_t lookahead = min((size_t)BLOCKS_AHEAD_PER_THREAD * num_threads, pipeline_blocks);
+  cout << "Shuffle window: " << pairs_per_window << " pairs (~" << (window_blocks * block_bytes >> 20)
+       << " MB), pipeline: " << lookahead << " blocks (~" << (lookahead * block_bytes >> 20) << " MB)" << endl;
+
+  // Create databases objects. Each one writes from its own thread, so the
+  // serialization and disk writes overlap with the generation of the pairs.
+  LMDataBase *labels_lmdb = NULL;
+  LMDataBase *data_lmdb = NULL;
+  FrameStoreWriter *frame_store = NULL;
+  if (config.frames) {
+    // Frame i is the digit i, every pair is the digit and one transformation of it
+    frame_store = new FrameStoreWriter(lmdb_path);
+    for (unsigned int i = 0; i < num_imgs; ++i) {
+      frame_store->add_frame(list_imgs[i]);
     }
+  } else {
+    LMDataBaseOptions db_options;
+    db_options.async = true;
+    db_options.num_shards = config.num_shards;
+    // The pairs only depend on these (and the digits), the windows set their order
+    db_options.checkpoint = config.num_shards == 1;
+    db_options.build_params = "preprocess_mnist_siamese images=" + to_string(num_imgs) +
+                              " pairs=" + to_string(config.num_pairs) + " window_pairs=" +
+                              to_string(pairs_per_window) + " seed=" + to_string(SEED);
+    db_options.resume = config.resume;
+    string labels_path = lmdb_path + "_labels";
+    labels_lmdb = new LMDataBase(labels_path, (size_t)NUM_CLASSES, 1, db_options);
+    db_options.mean_file = config.mean_file;
+    data_lmdb = new LMDataBase(lmdb_path, (size_t)2, (size_t)list_imgs[0].rows, db_options);
+  }
+
+  // With --resume, each database skips the pairs it already has. The generation
+  // starts at the window of the first pair missing in either of them: every
+  // window has its own streams, so it is generated exactly as the first time.
+  unsigned long data_done = 0;
+  unsigned long labels_done = 0;
+  if (data_lmdb != NULL) {
+    data_done = data_lmdb->resumed_records();
+    labels_done = labels_lmdb->resumed_records();
   }
+  unsigned long resume_at = min(data_done, labels_done);
+  unsigned long first_window = min(resume_at, config.num_pairs) / pairs_per_window;
+  unsigned long first_block = first_window * window_blocks;
+
+  auto process_block = [&](size_t i) {
+    unsigned long begin = (first_block + i) * PAIRS_PER_BLOCK;
+    unsigned long end = min(begin + PAIRS_PER_BLOCK, config.num_pairs);
+    return process_pairs(list_imgs, begin, end, schedule, grid, tables, pool);
+  };
+  OrderedPipeline<vector<DataBlob>> pipeline(num_blocks - min(first_block, num_blocks), process_block, num_threads,
+                                             lookahead);
+
+  vector<DataBlob> window;
+  vector<DataBlob> block_data;
+  for (unsigned long w = first_window; w * window_blocks < num_blocks; ++w) {
+    window.clear();
+    for (unsigned int b = 0; b < window_blocks && pipeline.next(&block_data); ++b) {
+      window.insert(window.end(), block_data.begin(), block_data.end());
+    }
+    // The shuffle has its own stream too (one per window) so it does not depend on the threads
+    CounterRNG shuffle_rng(SEED, num_imgs + w);
+    shuffle_with(window, shuffle_rng);
+    unsigned long window_start = w * pairs_per_window;
+    for (unsigned int item_id = 0; item_id < window.size(); ++item_id) {
+      const DataBlob &d = window[item_id];
+      int sfa_label = mnist_sfa_label(d.t);
+      if (frame_store != NULL) {
+        frame_store->add_pair(make_frame_pair(d, sfa_label));
+        continue;
+      }
+      if (window_start + item_id >= data_done) {
+        data_lmdb->insert2db(d.img1, d.img2, sfa_label);
+      }
+      if (window_start + item_id >= labels_done) {
+        vector<Label> labels = {d.t.x, d.t.y, d.t.z};
+        labels_lmdb->insert2db(labels);
+      }
+    }
+  }
+  // The last window and the writers hold the last images of the pool
+  window.clear();
+  block_data.clear();
   delete labels_lmdb;
   delete data_lmdb;
+  delete frame_store;
+  delete tables;
+  if (pool != NULL) {
+    pool->print_stats(cout, "Image");
+    delete pool;
+  }
   return;
 }
 
+PairEntry make_frame_pair(const DataBlob &d, int sfa_label) {
+  PairEntry pair = make_pair_entry(d.image, d.image);
+  uint8_t *transform = d.t.swapped ? &pair.transform_a : &pair.transform_b;
+  float *params = d.t.swapped ? pair.params_a : pair.params_b;
+  *transform = TRANSFORM_AFFINE;
+  params[0] = d.t.tx;
+  params[1] = d.t.ty;
+  params[2] = d.t.rot;
+  pair.label = sfa_label;
+  pair.num_labels = NUM_CLASSES;
+  pair.labels[0] = d.t.x;
+  pair.labels[1] = d.t.y;
+  pair.labels[2] = d.t.z;
+  return pair;
+}
+
 /*
- * rot (Rotation) is in degrees
- * tx, ty (Translations) are pixels
+ * One pair (original, transformed) out of img. Without new_img (frame store)
+ * the pair only has the transformation.
  */
-Mat transform_image(Mat &img, float tx, float ty, float rot) {
-  Mat res;
-  Point2f mid(img.cols / 2, img.rows / 2);
-  Mat rotMat = getRotationMatrix2D(mid, rot, 1.0);
-  Mat transMat = (Mat_<double>(2, 3) << 0, 0, tx, 0, 0, ty);
-  rotMat = rotMat + transMat;
-  // Set constant value for border to be white
-  warpAffine(img, res, rotMat, Size(img.cols, img.rows), INTER_LINEAR, BORDER_CONSTANT, Scalar(0, 0, 0));
-  return res;
+DataBlob make_data_blob(const Mat &img, unsigned int image, const MnistTransform &t, const Mat &new_img) {
+  DataBlob d;
+  d.image = image;
+  d.t = t;
+  if (new_img.empty()) {
+    return d;
+  }
+  d.img1 = img;
+  d.img2 = new_img;
+  if (t.swapped) {
+    d.img1 = new_img;
+    d.img2 = img;
+  }
+  return d;
 }
 
-vector<DataBlob> process_images(vector<Mat> &list_imgs, unsigned int pairs_per_img) {
-  vector<DataBlob> final_data;
-  srand(0);
-  unsigned int rand_index = 0;
-  vector<float> translations(NUM_TRASLATIONS);
-  float value = LOWER_TRASLATION;
-  for (unsigned int i = 0; i < translations.size(); i++) {
-    translations[i] = value++;
-  }
+PairSchedule make_pair_schedule(unsigned long num_pairs, unsigned int num_imgs) {
+  PairSchedule schedule;
+  schedule.base = num_pairs / num_imgs;
+  schedule.remainder = num_pairs % num_imgs;
+  return schedule;
+}
+
+unsigned int pairs_for_image(const PairSchedule &schedule, unsigned int img) {
+  return schedule.base + (img < schedule.remainder);
+}
+
+/* Pairs of the images before img, the index of its first pair */
+unsigned long pairs_before_image(const PairSchedule &schedule, unsigned int img) {
+  return (unsigned long)schedule.base * img + min(img, schedule.remainder);
+}
 
-  value = LOWER_ANGLE;
-  vector<float> rotations(NUM_ROTATIONS);
-  for (unsigned int i = 0; i < rotations.size(); i++) {
-    rotations[i] = (++value == 0) ? ++value : value;
+/* The image of the pair with the given index (pairs in image order) */
+unsigned int image_of_pair(const PairSchedule &schedule, unsigned long pair) {
+  unsigned long longer = (unsigned long)(schedule.base + 1) * schedule.remainder; // pairs of the first images
+  if (pair < longer) {
+    return pair / (schedule.base + 1);
   }
+  return schedule.remainder + (pair - longer) / schedule.base;
+}
 
-  // Debugging
-  // namedWindow("Normal");
-  // namedWindow("Transformed");
-  for (unsigned int i = 0; i < list_imgs.size(); i++) {
+/*
+ * Generates the pairs [begin, end) of the build, in image order.
+ * Image i always draws its random numbers from the stream (SEED, i), so the
+ * result does not depend on which thread generates it nor on how its pairs
+ * are split between blocks (the draws of the pairs of another block are
+ * skipped). All the transformations of an image are drawn first and then
+ * warped in one go, while the image is in cache, into images of the pool.
+ * Without tables the images are not warped.
+ */
+vector<DataBlob> process_pairs(vector<Mat> &list_imgs, unsigned long begin, unsigned long end,
+                               const PairSchedule &schedule, const TransformGrid &grid,
+                               const MnistWarpTables *tables, ImagePool *pool) {
+  vector<DataBlob> final_data;
+  final_data.reserve(end - begin);
+  vector<MnistTransform> transforms;
+  vector<Mat> new_imgs;
+  for (unsigned int i = image_of_pair(schedule, begin); i < list_imgs.size(); i++) {
+    unsigned long first_pair = pairs_before_image(schedule, i);
+    if (first_pair >= end) {
+      break;
+    }
+    unsigned int skip = (begin > first_pair) ? begin - first_pair : 0;
+    unsigned int pairs_per_img = min((unsigned long)pairs_for_image(schedule, i), end - first_pair) - skip;
+    CounterRNG rng(SEED, i);
+    for (unsigned int j = 0; j < skip; j++) {
+      draw_mnist_transform(rng, grid);
+    }
+    transforms.resize(pairs_per_img);
     for (unsigned int j = 0; j < pairs_per_img; j++) {
-      DataBlob d;
-      // Generate random X translation
-      rand_index = generate_rand(NUM_TRASLATIONS);
-      d.x = rand_index;
-      float tx = translations[rand_index];
-      // Generate random Y translation
-      rand_index = generate_rand(NUM_TRASLATIONS);
-      d.y = rand_index;
-      float ty = translations[rand_index];
-      // Calculate random bin of rotation (0 to 19)
-      rand_index = generate_rand(NUM_BIN_ROTATIONS);
-      d.z = rand_index;
-      // Calculate the real index of the array of rotations (0 to 61)
-      rand_index *= 3;
-      rand_index += generate_rand(3);
-      float rot = rotations[rand_index];
-
-      // Finally, apply the selected transformations to the image
-      Mat new_img = transform_image(list_imgs[i], tx, ty, rot);
-
-      d.img1 = list_imgs[i];
-      d.img2 = new_img;
-
-      if (generate_rand(2)) {
-        d.img1 = new_img;
-        d.img2 = list_imgs[i];
+      transforms[j] = draw_mnist_transform(rng, grid);
+    }
+    new_imgs.assign(pairs_per_img, Mat());
+    if (tables != NULL && pairs_per_img > 0) {
+      for (unsigned int j = 0; j < pairs_per_img; j++) {
+        new_imgs[j].allocator = pool;
       }
-
-      final_data.push_back(d);
-
-      // Debugging
-      // imshow("Normal", list_imgs[i]);
-      // imshow("Transformed", new_img);
-      // waitKey(100);
+      StageTimer timer(STAGE_TRANSFORM);
+      tables->warp(list_imgs[i], &transforms[0], pairs_per_img, &new_imgs[0]);
+    }
+    // list_imgs outlives every pair: the pairs share a header without reference
+    // count, instead of all the threads updating the count of the same digit
+    const Mat &img = list_imgs[i];
+    Mat original(img.rows, img.cols, img.type(), img.data, img.step);
+    for (unsigned int j = 0; j < pairs_per_img; j++) {
+      final_data.push_back(make_data_blob(original, i, transforms[j], new_imgs[j]));
     }
   }
   return final_data;
 }
-
-/* Generate a random number between 0 and range_limit-1
- * Useful to get a random element in an array of size range_limit
- */
-unsigned int generate_rand(int range_limit) { return rand() % range_limit; }
@@ -0,0 +1,64 @@
+#include "kitti_sampler.hpp"
+#include "egomotion_labels.hpp"
+#include "lmdb_creator.hpp"
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+
+KittiSampler::KittiSampler(const vector<string> &paths_files, const vector<string> &poses_files,
+                           const string &images_dir, FrameCache &cache, const KittiSamplerOptions &options)
+    : images_dir(images_dir), cache(cache), options(options) {
+  sequences = open_sequence_indices(paths_files, poses_files, options.index_dir, thread::hardware_concurrency());
+  for (size_t i = 0; i < sequences.size(); ++i) {
+    if (sequences[i]->num_frames() < 2 || sequences[i]->num_poses() < sequences[i]->num_frames()) {
+      throw runtime_error("The sequence " + paths_files[i] + " has less than 2 frames or is missing poses");
+    }
+  }
+  if (sequences.empty()) {
+    throw runtime_error("KittiSampler needs at least one sequence");
+  }
+}
+
+int KittiSampler::sample(CounterRNG &rng, char *data, Label *labels) const {
+  const SequenceIndex &seq = *sequences[rng.generate_rand(sequences.size())];
+  int num_frames = seq.num_frames();
+
+  // Same choice of neighbours as generate_pairs() in preprocess_kitti_siamese
+  int index = rng.generate_rand(num_frames);
+  int offset = rng.generate_rand(options.max_offset) + 1;
+  int pair_index;
+  if (index == 0) {
+    pair_index = min(index + offset, num_frames - 1);
+  } else if (index == num_frames - 1) {
+    pair_index = max(index - offset, 0);
+  } else if (rng.generate_rand(2)) {
+    pair_index = max(index - offset, 0);
+  } else {
+    pair_index = min(index + offset, num_frames - 1);
+  }
+
+  Mat im1 = cache.get(images_dir + "/" + seq.path(index));
+  Mat im2 = cache.get(images_dir + "/" + seq.path(pair_index));
+  int size = options.crop_size;
+  if (im1.empty() || im2.empty() || min(im1.rows, im2.rows) <= size || min(im1.cols, im2.cols) <= size) {
+    throw runtime_error("Could not read a frame of " + seq.path(index) + " or it is smaller than the crop");
+  }
+  unsigned int top = rng.generate_rand(min(im1.rows, im2.rows) - size);
+  unsigned int left = rng.generate_rand(min(im1.cols, im2.cols) - size);
+  Rect r(left, top, size, size);
+  Mats2CHW(im1(r), im2(r), data);
+
+  PosePairs poses;
+  poses.push_back(seq.pose(index), seq.pose(pair_index));
+  EgomotionLabels ego;
+  compute_egomotion_labels(poses, options.six_dof, &ego);
+  labels[0] = ego.x[0];
+  labels[1] = ego.y[0];
+  labels[2] = ego.z[0];
+  if (options.six_dof) {
+    labels[3] = ego.ty[0];
+    labels[4] = ego.rx[0];
+    labels[5] = ego.rz[0];
+  }
+  return abs(index - pair_index) <= 7;
+}
@@ -0,0 +1,57 @@
+#ifndef _KITTI_SAMPLER_
+#define _KITTI_SAMPLER_
+#include "frame_cache.hpp"
+#include "pair_sampler.hpp"
+#include "sequence_index.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Pairs of KITTI frames like the ones of preprocess_kitti_siamese: a random
+ * frame of a random sequence and a neighbour up to max_offset frames away,
+ * both cropped at the same random position. Labels: the egomotion bins of
+ * the pair (x, y angle, z and, with six_dof, y, x angle and z angle, see
+ * egomotion_labels.hpp). The label of the pair is 1 if both frames are at
+ * most 7 frames apart.
+ *
+ * The decoded frames are shared through a FrameCache, so consecutive epochs
+ * do not decode the same PNGs again as long as they fit in it.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+
+struct KittiSamplerOptions {
+  int crop_size;
+  int max_offset; // 7 for egomotion, 20 for SFA
+  bool six_dof;
+  string index_dir; // binary indices of the sequences, see sequence_index.hpp
+
+  KittiSamplerOptions() : crop_size(227), max_offset(7), six_dof(false), index_dir("kitti_index") {}
+};
+
+class KittiSampler : public PairSampler {
+public:
+  /*
+   * paths_files and poses_files: the paths/NN.txt and poses/NN.txt of each
+   * sequence. The paths are relative to images_dir (.../sequences).
+   */
+  KittiSampler(const vector<string> &paths_files, const vector<string> &poses_files, const string &images_dir,
+               FrameCache &cache, const KittiSamplerOptions &options = KittiSamplerOptions());
+
+  int channels() const { return 3; }
+  int height() const { return options.crop_size; }
+  int width() const { return options.crop_size; }
+  int num_labels() const { return options.six_dof ? 6 : 3; }
+
+  int sample(CounterRNG &rng, char *data, Label *labels) const;
+
+private:
+  vector<shared_ptr<SequenceIndex>> sequences;
+  string images_dir;
+  FrameCache &cache;
+  KittiSamplerOptions options;
+};
+#endif
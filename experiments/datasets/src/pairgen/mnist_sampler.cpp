@@ -0,0 +1,29 @@
+#include "mnist_sampler.hpp"
+#include "lmdb_creator.hpp"
+#include <stdexcept>
+
+static const vector<Mat> &check_images(const vector<Mat> &images) {
+  if (images.empty() || images[0].type() != CV_8UC1) {
+    throw runtime_error("MnistSampler needs at least one single-channel 8-bit image");
+  }
+  return images;
+}
+
+MnistSampler::MnistSampler(const vector<Mat> &images)
+    : images(check_images(images)), grid(make_transform_grid()), tables(grid, images[0].rows, images[0].cols) {}
+
+int MnistSampler::sample(CounterRNG &rng, char *data, Label *labels) const {
+  const Mat &img = images[rng.generate_rand(images.size())];
+  MnistTransform t = draw_mnist_transform(rng, grid);
+  Mat new_img;
+  tables.warp(img, &t, 1, &new_img);
+  if (t.swapped) {
+    Mats2CHW(new_img, img, data);
+  } else {
+    Mats2CHW(img, new_img, data);
+  }
+  labels[0] = t.x;
+  labels[1] = t.y;
+  labels[2] = t.z;
+  return mnist_sfa_label(t);
+}
@@ -0,0 +1,37 @@
+#ifndef _MNIST_SAMPLER_
+#define _MNIST_SAMPLER_
+#include "mnist_transforms.hpp"
+#include "pair_sampler.hpp"
+#include "opencv2/core/core.hpp"
+#include <vector>
+
+/*
+ * Pairs of MNIST digits like the ones of preprocess_mnist_siamese: a random
+ * digit and a random transformation of it (see mnist_transforms.hpp), in a
+ * random order. Labels: x, y and z classes of the transformation.
+ * The digits are warped with precomputed remap tables (MnistWarpTables).
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+using namespace cv;
+
+class MnistSampler : public PairSampler {
+public:
+  // images: the digits, e.g. load_images(path/to/train-images-idx3-ubyte)
+  explicit MnistSampler(const vector<Mat> &images);
+
+  int channels() const { return images[0].channels(); }
+  int height() const { return images[0].rows; }
+  int width() const { return images[0].cols; }
+  int num_labels() const { return 3; }
+
+  int sample(CounterRNG &rng, char *data, Label *labels) const;
+
+private:
+  vector<Mat> images;
+  TransformGrid grid;
+  MnistWarpTables tables;
+};
+#endif
@@ -0,0 +1,58 @@
+#include "pair_generator.hpp"
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+PairGenerator::PairGenerator(const PairSampler &sampler, const PairGeneratorOptions &options)
+    : sampler(sampler), options(options), start(chrono::steady_clock::now()) {
+  // The pairs of an epoch have the streams e * 2^32 + i, they must not reach the next epoch
+  if (options.batch_size == 0 || options.batches_per_epoch == 0 ||
+      options.batches_per_epoch > (1ULL << 32) / options.batch_size) {
+    throw runtime_error("PairGenerator needs 0 < batch_size * batches_per_epoch <= 2^32 (got " +
+                        to_string(options.batch_size) + " * " + to_string(options.batches_per_epoch) + ")");
+  }
+  size_t num_batches = numeric_limits<size_t>::max();
+  if (options.num_epochs > 0) {
+    num_batches = options.num_epochs * options.batches_per_epoch;
+  }
+  pipeline.reset(new OrderedPipeline<PairBatch>(num_batches, [this](size_t b) { return make_batch(b); },
+                                                options.num_threads, options.prefetch));
+}
+
+bool PairGenerator::next(PairBatch *batch) { return pipeline->next(batch); }
+
+/* Runs in the worker threads */
+PairBatch PairGenerator::make_batch(size_t b) {
+  PairBatch batch;
+  batch.epoch = options.first_epoch + b / options.batches_per_epoch;
+  batch.index = b % options.batches_per_epoch;
+  batch.size = options.batch_size;
+  batch.channels = 2 * sampler.channels();
+  batch.height = sampler.height();
+  batch.width = sampler.width();
+  size_t pair_size = (size_t)batch.channels * batch.height * batch.width;
+  size_t num_labels = sampler.num_labels();
+
+  // Do not get ahead of the target rate (this only delays the batch, it never changes it)
+  if (options.target_rate > 0) {
+    chrono::duration<double> due(b * options.batch_size / options.target_rate);
+    this_thread::sleep_until(start + chrono::duration_cast<chrono::steady_clock::duration>(due));
+  }
+
+  batch.data.resize(batch.size * pair_size);
+  batch.labels.resize(batch.size * num_labels);
+  batch.pair_labels.resize(batch.size);
+  for (size_t i = 0; i < batch.size; ++i) {
+    CounterRNG rng(options.seed, (batch.epoch << 32) + batch.index * options.batch_size + i);
+    char *data = reinterpret_cast<char *>(&batch.data[i * pair_size]);
+    batch.pair_labels[i] = sampler.sample(rng, data, &batch.labels[i * num_labels]);
+  }
+
+  if (options.float_output) {
+    batch.float_data.resize(batch.data.size());
+    for (size_t i = 0; i < batch.data.size(); ++i) {
+      batch.float_data[i] = batch.data[i] * options.scale;
+    }
+  }
+  return batch;
+}
@@ -0,0 +1,85 @@
+#ifndef _PAIR_GENERATOR_
+#define _PAIR_GENERATOR_
+#include "ordered_pipeline.hpp"
+#include "pair_sampler.hpp"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+ * Generates batches of pairs on the fly, at training time, instead of
+ * reading them from a pre-built LMDB: every epoch sees new pairs and nothing
+ * is stored on disk.
+ *
+ * A pool of background threads fills the batches (in order) ahead of the
+ * consumer. The pair i of epoch e is always made with the random stream
+ * CounterRNG(seed, e * 2^32 + i), so a run is reproducible from the seed and
+ * the epoch number, for any number of threads, and training can be resumed at
+ * any epoch (first_epoch).
+ *
+ * Usage:
+ *   MnistSampler sampler(load_images(path));
+ *   PairGeneratorOptions options;
+ *   options.batch_size = 64;
+ *   PairGenerator generator(sampler, options);
+ *   PairBatch batch;
+ *   while (generator.next(&batch)) { ... batch.data / batch.labels ... }
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+using namespace std;
+
+struct PairGeneratorOptions {
+  size_t batch_size;
+  size_t batches_per_epoch; // batch_size * batches_per_epoch must be <= 2^32 (checked)
+  uint64_t num_epochs; // 0: never stop
+  uint64_t first_epoch;
+  uint64_t seed;
+  unsigned int num_threads;
+  size_t prefetch; // batches ready ahead of the consumer
+  // Maximum pairs per second (0: as fast as possible), to leave CPU for the training
+  double target_rate;
+  // Also fill PairBatch::float_data with the pixels multiplied by scale
+  bool float_output;
+  float scale;
+
+  PairGeneratorOptions()
+      : batch_size(64), batches_per_epoch(1000), num_epochs(0), first_epoch(0), seed(0), num_threads(1),
+        prefetch(4), target_rate(0), float_output(false), scale(0.00390625) {}
+};
+
+/*
+ * size pairs in NCHW order (N = size, C = 2 * channels: the channels of the
+ * first image and then the ones of the second image, like the siamese Datums).
+ */
+typedef struct {
+  uint64_t epoch;
+  size_t index; // of the batch in the epoch
+  size_t size;
+  int channels;
+  int height;
+  int width;
+  vector<unsigned char> data;
+  vector<float> float_data;    // only with float_output
+  vector<Label> labels;        // size * num_labels, row-major
+  vector<int> pair_labels;     // size (SFA labels)
+} PairBatch;
+
+class PairGenerator {
+public:
+  PairGenerator(const PairSampler &sampler, const PairGeneratorOptions &options);
+
+  // Blocks until the next batch is ready. Returns false after the last epoch
+  bool next(PairBatch *batch);
+
+private:
+  const PairSampler &sampler;
+  PairGeneratorOptions options;
+  chrono::steady_clock::time_point start;
+  unique_ptr<OrderedPipeline<PairBatch>> pipeline;
+
+  PairBatch make_batch(size_t b);
+};
+#endif
@@ -0,0 +1,34 @@
+#ifndef _PAIR_SAMPLER_
+#define _PAIR_SAMPLER_
+#include "counter_rng.hpp"
+
+/*
+ * A source of random pairs of images for siamese networks.
+ *
+ * sample() draws every random number it needs from rng and writes one pair
+ * in the layout of the Datums of the siamese LMDBs: the CHW pixels of the
+ * first image followed by the CHW pixels of the second one
+ * (2 * channels() * height() * width() bytes), plus num_labels() labels.
+ * It returns the label of the pair (the SFA label).
+ *
+ * The same rng state must always give the same pair, and sample() is called
+ * from several threads at the same time.
+ *
+ * Author: Ezequiel Torti Lopez
+ */
+
+typedef unsigned char Label;
+
+class PairSampler {
+public:
+  virtual ~PairSampler() {}
+
+  // Shape of each image of the pair
+  virtual int channels() const = 0;
+  virtual int height() const = 0;
+  virtual int width() const = 0;
+  virtual int num_labels() const = 0;
+
+  virtual int sample(CounterRNG &rng, char *data, Label *labels) const = 0;
+};
+#endif